@@ -1,8 +1,8 @@
 //	dmiapi.c 	28082021/MOE
-//	Build: cc dmiapi.c -o dmiapi -lssl -lcrypto -ljson-c -lm
+//	Build: cc dmiapi.c -o dmiapi -lssl -lcrypto -ljson-c -lm -lpthread -lnghttp2 -lz -lbrotlidec
 //      https://github.com/michaelorno/DMIOV.git
 //
-//	Call: ./dmiapi <configurationfile>
+//	Call: ./dmiapi <configurationfile> [-load]
 //	
 //	Monitor DMI metObs/oceanObs/lightning API
 //		See https://www.dmi.dk/friedata/guides-til-frie-data/
@@ -32,6 +32,54 @@
 //      	[CLIMATEOBSAPI_THRESHOLD_WARNING] threshold for issue of warning i syslog in ms (int)
 //      	[CLIMATEOBSAPI_THRESHOLD_ERROR] threshold for issue of error in syslog in  ms  (int)
 //      	[SILENT] 0|1  (0=slient, 1=console output))
+//      	[METOBS_FREQ] [OCEANOBS_FREQ] [LIGHTOBS_FREQ] [CLIMATEOBS_FREQ] seconds between requests to API (int, optional - default [FREQ])
+//      	[METOBS_PHASE] [OCEANOBS_PHASE] [LIGHTOBS_PHASE] [CLIMATEOBS_PHASE] offset of first request in ms (int, optional)
+//      	[JITTER] max. random delay in ms added to each deadline (int, optional)
+//      	[ADAPTIVE] 0|1 raise request rate when API is degraded (optional)
+//      	[ADAPTIVE_MIN_FREQ] min. ms between requests to a degraded API (int)
+//      	[BUDGET_PER_HOUR] max. requests per hour to all API's (int)
+//      	[LOAD_API] metObs|oceanObs|lightObs|climateObs - API for -load
+//      	[LOAD_CONNECTIONS] number of concurrent connections for -load (int)
+//      	[LOAD_RATES] requests/s for each step, comma separated (eg. 10,20,50)
+//      	[LOAD_STEP_DURATION] seconds for each step (int)
+//      	[BULK_API] API for -bulk (api-key of the API is used)
+//      	[BULK_PATH] query for first page, {KEY} & {DATETIME} are replaced (eg. /v2/lightningdata/collections/observation/items?datetime={DATETIME}&limit=10000&api-key={KEY})
+//      	[BULK_FROM] [BULK_TO] time range for -bulk (eg. 2024-01-01T00:00:00Z)
+//      	[BULK_PARTITION] hours in each time range (int, optional - default 24)
+//      	[BULK_CONNECTIONS] number of concurrent connections for -bulk (int, optional - default 4)
+//      	[BULK_DIR] directory for NDJSON & state file (optional - default .)
+//      	[BENCH_BASELINE] file with baseline for -bench (optional - default dmiapi.bench)
+//      	[BENCH_TOLERANCE] % slower than baseline before -bench fails (optional - default 20)
+//      	[BENCH_CORPUS] directory with raw responses (*.http) for -bench (optional)
+//      	[CAPTURE] file - raw responses are appended for -replay (optional)
+//      	[WORKERS] number of probe threads (int, optional - default 1)
+//      	[KEEPALIVE] 0|1 keep connection to gateway between requests (optional)
+//      	[PIPELINE] n requests for the next n stations are sent back to back on one connection (optional - default 1)
+//      	[HTTP2] 0|1 use HTTP/2 if gateway supports it (ALPN) - due API's are sent as streams on one connection (optional)
+//      	[COMPRESSION] 0|1 ask for gzip or brotli compressed responses (optional)
+//      	[CONDITIONAL] 0|1 send validators of latest response (If-None-Match / If-Modified-Since) (optional)
+//      	[TIMESTAMPING] 0|1 response time from kernel software receive timestamps (optional)
+//      	[TRACE] 0|1 write spans of each request as OTLP-JSON to ÅÅÅÅ-MM-DD_dmiapi.trace (optional)
+//      	[TS_MEMORY] kB of memory for time series of observations, older data is kept in dmiapi.ts (optional - default 4096)
+//      	[ARENA] kB of memory for the JSON of one request in each worker (optional - default 4096)
+//      	[PROBE_CPU] comma separated CPUs for the workers - low-jitter mode: pinned, memory locked (optional)
+//      	[SCHED_FIFO] real-time priority 1-99 of the workers with [PROBE_CPU] (optional - default 0 = off)
+//      	[SHM] name of shared memory segment with live statistics eg. /dmiapi (optional)
+//      	[HTTPHOST] value of Host-header (optional - default dmigw.govcloud.dk)
+//      	[IPHOST_<NAME>] address of further gateway eg. staging (optional)
+//      	[IPHOST_<NAME>_APIS] comma separated API's requested on gateway (optional - default all)
+//      	[API] name - define a new API endpoint. metObs, oceanObs, lightObs & climateObs are predefined
+//      	[<NAME>_KEY] api-key for endpoint, [METOBSKEY] etc. are accepted as well
+//      	[<NAME>_PATH] query, {KEY} & {STATION} are replaced (eg. /v2/metObs/...&api-key={KEY}&stationId={STATION})
+//      	[<NAME>_STATIONS] comma separated station id's (optional)
+//      	[<NAME>_JSON] path to value in response (eg. features.0.properties.value)
+//      	[<NAME>_JSON_TIME] path to time of value (optional)
+//      	[<NAME>_UNIT] unit shown after value, '_' is shown as space (optional)
+//      	[<NAME>_CODE] letter for statistics-log (optional - default first letter of name)
+//      	[<NAME>_THRESHOLD_WARNING] [<NAME>_THRESHOLD_ERROR] [<NAME>_FREQ] [<NAME>_PHASE] as above
+//      	[<NAME>_BATCH] query for all stations in one request eg. bbox=... ({KEY} & {STATIONS} are replaced) (optional)
+//      	[<NAME>_BATCH_STATION] path to station id in each feature (optional - default properties.stationId)
+//      	[<NAME>_BATCH_TIME] path to time in each feature (optional - default properties.observed)
 //      	(*) Remark: [PARAMETER] and value must be separated by a white space
 //
 //	Dokumentation: dmiapi.txt
@@ -47,9 +95,34 @@
 //		0.98 Fixed minor issue, colormonitor & upgraded til metObs v2
 //		0.99 SSL/TLS, JSON lib & climateObs
 //		1.00 Individual thresholds for each API
+//		1.01 Differential console output, sparklines & console colors
+//		1.02 Drift-free timerfd scheduler with individual frequency for each API
+//		1.03 Adaptive sampling rate during degradation within hourly request budget
+//		1.04 Open-loop load generation mode (-load)
+//		1.05 Probe worker threads, lock-free sample rings & keep-alive connections
+//		1.06 API endpoints defined in configuration, requests prebuilt at start
+//		1.07 Several gateways in one probe, target registry with per-target statistics
+//		1.08 Batch queries - all stations of an API in one request, table of observations
+//		1.09 HTTP/1.1 pipelining, time to first byte for each response
+//		1.10 HTTP/2 - API's multiplexed as streams on one connection
+//		1.11 Compressed responses (gzip, br) decoded while received, wire & decoded bytes
+//		1.12 Conditional requests (ETag / If-Modified-Since), 304 reuses cached observation
+//		1.13 Bulk download mode (-bulk) - paged time ranges to NDJSON, resumable
+//		1.14 Time series of observations - Gorilla compressed in memory, spilled to disk, series.json
+//		1.15 Rollups of response times at 1m/5m/1h/1d in round robin archives (dmiapi.rrd), -report
+//		1.16 Response times in ns from CLOCK_MONOTONIC_RAW, optional kernel receive timestamps
+//		1.17 TCP_INFO after each request - RTT, retransmits, cwnd in translog. Server time = TTFB - RTT
+//		1.18 Trace of each request - DNS, connect, TLS, send, TTFB, body, decode & log spans as OTLP-JSON
+//		1.19 -bench: ns/op, MB/s & allocs/op of response parsing & decoding against a baseline
+//		1.20 [CAPTURE] of raw responses & -replay through the parser, fast or with original timing
+//		1.21 Own cost per cycle - CPU, context switches, allocations & syscalls by subsystem, dmiapi.prom
+//		1.22 No heap allocations in the probe loop - JSON in a per request arena, OpenSSL, nghttp2 & brotli from a pool
+//		1.23 Low-jitter mode - workers pinned to [PROBE_CPU], SCHED_FIFO, locked memory. Timing floor measured at start
+//		1.24 Live statistics in POSIX shared memory ([SHM]) under a seqlock, -shm reads a snapshot
 //	To-do:
 //		match on-line with gravetee.io translog
 
+#define _GNU_SOURCE		// ppoll, strcasestr, CPU affinity
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
@@ -59,6 +132,7 @@
 #include <resolv.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <syslog.h>
@@ -66,6 +140,25 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <linux/net_tstamp.h>
+#include <strings.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <ctype.h>
+#include <sched.h>
+#include <malloc.h>
 
 // SSL
 #include <openssl/bio.h>
@@ -77,40 +170,57 @@
 
 // JSON-C
 #include <json-c/json.h>
+#include <nghttp2/nghttp2.h>
+#include <zlib.h>
+#include <brotli/decode.h>
 
 #define	TCPIPDEBUG 0		// if !=0 then debugmsg to tty
 #define	HTTPLOGGING 0		// if !=0 then output http send/receive on tty
-#define VERSION "1.00"
+#define VERSION "1.24"
 #define MAX_BUF 5000
-#define NUM_OF_APIS 3		// Counting from 0 = 1 API, 3 = 4 APIs
+#define MAX_BODY 65536		// Max. size of response body
+#define RING_SIZE 256		// Samples in each worker's ring
+#define MAX_APIS 16		// Max. number of API endpoints
+#define MAX_STATIONS 100	// Max. stations for each endpoint
+#define MAX_GATEWAYS 8		// [IPHOST] & [IPHOST_<NAME>]
+#define MAX_GROUPS 32		// (gateway, API) pairs - each has its own schedule & console block
+#define MAX_TARGETS 4096	// (gateway, API, station)
+#define TARGET_BATCH 0xFFFF	// Station of target requesting all stations of group
+#define MAX_PIPELINE 32		// Max. [PIPELINE]
+#define MAX_STREAMS 128		// Max. HTTP/2 streams in one round
+#define H2_COALESCE_NS 10000000LL	// Groups due within 10 ms share a HTTP/2 round
 
 #define HTML_GREEN  "<span style=\"color:green\">"
 #define HTML_YELLOW "<span style=\"color:orange\">"
 #define HTML_RED    "<span style=\"color:red\">"
 #define HTML_END    "</span>"
 
+// Console - 4 header lines, 7 lines for each group, 1 status line & 2 lines of overhead
+#define CONSOLE_ROWS (4 + 7 * MAX_GROUPS + 3)
+#define CONSOLE_COLS 132
+#define CONSOLE_REFRESH 100	// Full redraw every n frames
+#define SPARK_LEN 40		// Number of latencies in sparkline
+#define TTY_DEFAULT 0
+#define TTY_GREEN 1
+#define TTY_YELLOW 2
+#define TTY_RED 3
+
 // File definitions
 FILE *http_debug_file;	// HTTP debugging
 FILE *http_out;		// Write index.html-file
-FILE *syslog_out;	// Local copy of messages to syslog
 FILE *statlog_out;	// Statistics-log
 FILE *translog_out;	// Transaction-log
+FILE *trace_out;	// Spans of requests - kept open, flushed after each drain of the workers
 FILE *config_file;	// Configuration-file
 
 // Measure mem
 struct rusage r_usage;
 
-// Variables for TCPIP
-int online, server = 0;
+// Latest com. returncode (console)
+int online = 0;
 
-// Variables for SSL
-BIO *certbio = NULL;
+// Debug output
 BIO *outbio = NULL;
-X509 *cert = NULL;
-X509_NAME *certname = NULL;
-const SSL_METHOD *method;
-SSL_CTX *ctx;
-SSL *ssl;
 
 // Variables for timekeeping
 time_t start_time;
@@ -118,24 +228,49 @@ time_t current_time;
 time_t file_current_time;
 struct tm *today;
 char start_c_time_string[30] = {0};;
-struct timeval t0;
-struct timeval t1;
 char trans_dato[80] = {0};
 
 // Outputscreen
 struct screen_array{
    char line[132];
-   } screen[32];
+   } screen[CONSOLE_ROWS];
+int console_rows;
+
+// Console frames - current & last written to tty
+struct console_cell{
+   char ch[5];		// UTF-8 glyph
+   unsigned char color;
+   } frame[CONSOLE_ROWS][CONSOLE_COLS], prev_frame[CONSOLE_ROWS][CONSOLE_COLS];
+int frame_count = 0;
+
+// Latency history for sparklines (ringbuffer, -1 = failed request)
+struct spark_record{
+   float value[SPARK_LEN];
+   int next;
+   int count;
+   } spark[MAX_GROUPS], server_spark[MAX_GROUPS];	// server_spark: server time (TTFB - RTT)
+
+// TCP_INFO of connection after a request - kernel's view of the network path
+struct tcp_record{
+   float rtt;			// Smoothed RTT, ms
+   float rttvar;		// RTT variance, ms
+   unsigned int retrans;	// Segments retransmitted during request
+   unsigned int cwnd;		// Congestion window, segments
+   unsigned int inflight;	// Bytes sent & not acknowledged
+   };
 
 // Statistics
 struct data_record{
    char data[45];
-   } observation[NUM_OF_APIS + 1];
+   } observation[MAX_GROUPS];
 
 struct http_resp_record{
    int http_204;
+   int http_304;
    int http_other;
-   } http_resp[NUM_OF_APIS + 1];
+   double ms_200;		// Sum of response times - origin path
+   double ms_304;		// Sum of response times - gateway's cache path
+   } http_resp[MAX_GROUPS];
 
 struct measure_record{
    int requests;
@@ -156,10 +291,590 @@ struct measure_record{
    char  elapsed_gns1000_html_color[35];
    int   last_returncode;
    char  last_returncode_html_color[35];
-   } mea[NUM_OF_APIS + 1];
-
-// Locations [0]-[16]
-int stations_count = 0;
+   int   g10;
+   int   g100;
+   int   g1000;
+   int   station;		// Station of latest request
+   int64_t interval_ns;		// Scheduler state of latest request
+   long  missed;
+   struct tcp_record tcp;	// Latest TCP_INFO
+   float server;		// Server time of latest request, TTFB - RTT (ms)
+   } mea[MAX_GROUPS];
+double budget_view;
+
+// Phases of one request in ns of CLOCK_MONOTONIC_RAW - 0 = phase not in this request.
+// Connection phases are only set on the first request of a new connection
+struct trace_record{
+   int64_t open;		// init_com started
+   int64_t dns;			// Host resolved
+   int64_t connect;		// TCP connected
+   int64_t tls;			// TLS handshake done
+   int64_t send;		// Request written ...
+   int64_t sent;		// ... until
+   int64_t decode;		// Response interpreted ...
+   int64_t decoded;		// ... until
+   };
+
+// Result of one request - written by a worker, applied to mea[] etc. by main thread
+struct sample{
+   int   api;			// Group
+   int   target;
+   int   station;
+   int   online;		// Returncode from api_request, 0 = ok
+   int   http_ret;
+   int   returncode;		// http returncode for console (999 = unexpected)
+   float elapsed;		// ms
+   float first_byte;		// ms from request sent to first byte of response
+   int64_t elapsed_ns;		// Response time in ns - elapsed is ms for display
+   int64_t first_byte_ns;
+   struct tcp_record tcp;	// rtt = 0 if not read
+   struct trace_record trace;
+   long  wire_bytes;		// Response as received
+   long  body_bytes;		// Body after Content-Encoding is decoded
+   char  trans_id[80];
+   char  trans_date[40];	// "" = not in response
+   char  observation[45];	// "" = no new data
+   int64_t interval_ns;
+   long  missed;
+   double budget;
+   int   num_values;		// Values for stations station..station+num_values-1
+   float value[MAX_STATIONS];	// NAN = no value
+   time_t observed[MAX_STATIONS];	// Time of value, 0 = not in response
+   };
+
+// Samples from one worker. Single producer (worker) / single consumer (main thread) - no locks
+struct shard{
+   struct sample ring[RING_SIZE];
+   atomic_ulong head;		// Next slot to write
+   atomic_ulong tail;		// Next slot to read
+   atomic_long dropped;		// Samples lost because ring was full
+   };
+
+// Time of send or receive - CLOCK_MONOTONIC_RAW and the kernel's time (CLOCK_REALTIME) if the socket has
+// receive timestamps. Latency from kernel times does not include the time data waited for the probe
+struct stamp{
+   int64_t raw;
+   int64_t kernel;		// 0 = none
+   };
+
+struct conn_record{
+   SSL_CTX* ctx;
+   SSL*  ssl;
+   int   fd;
+   int   gateway;
+   nghttp2_session* h2;		// != NULL if HTTP/2 is negotiated
+   struct stamp h2_read;	// Time of latest read on HTTP/2 session
+   int   timestamping;		// Kernel software receive timestamps
+   int64_t rx_ns;		// Kernel receive time of latest read, CLOCK_REALTIME - 0 = none
+   unsigned int retrans;	// TCP retransmits on connection at latest TCP_INFO
+   int64_t t_open, t_dns, t_connect, t_tls;	// Phases of init_com for trace
+   int   fresh;			// No request sent on connection yet
+   };
+
+// API endpoints - predefined & from configuration
+struct endpoint_record{
+   char  name[40];
+   char  code;			// Letter in statistics-log
+   char  path[400];		// Query template with {KEY} & {STATION}
+   char  key[80];
+   char  json_value[80];	// Path to value in JSON-response
+   char  json_time[80];		// Path to time of value ("" = none)
+   char  unit[40];
+   char  freq[80];		// [xxx_FREQ] seconds - default [FREQ]
+   char  phase[80];		// [xxx_PHASE] ms - "" = spread over interval
+   char  batch[400];		// Query for all stations ("" = one station for each request)
+   char  batch_station[80];	// Path to station id in each feature
+   char  batch_time[80];	// Path to time in each feature
+   int   num_stations;
+   char  station[MAX_STATIONS][8];
+   } endpoint[MAX_APIS];
+int num_apis;
+char httphost[80];
+
+// Gateways - [IPHOST] is gateway 0
+struct gateway_record{
+   char  name[40];		// "" for [IPHOST]
+   char  url[80];
+   char  httphost[80];
+   char  apis[200];		// API's requested on gateway - "" = all
+   } gateway[MAX_GATEWAYS];
+int num_gateways;
+
+// Groups - all stations of one API on one gateway. Scheduled as one unit, one station at a time
+struct group_record{
+   int   gateway;
+   int   api;
+   int   first;			// First target of group
+   int   count;			// Number of targets
+   char  name[80];		// eg. "metObs" or "metObs@staging" - endpoint & gateway name
+   int   obs;			// First station in observation table
+   int   stations;		// Number of stations
+   } group[MAX_GROUPS];
+int num_groups;
+
+// Conditional requests - validators & decoded result of latest 200 for each target. Allocated at
+// first response with a validator, owned by the worker of the target's group
+#define REQ_SIZE 1200		// Prebuilt request incl. validators
+struct cond_record{
+   char  etag[80];
+   char  last_modified[40];
+   char  observation[45];
+   int   num_values;
+   float value[MAX_STATIONS];
+   time_t observed[MAX_STATIONS];
+   };
+struct cond_record* cond[MAX_TARGETS];
+char conditional[80];
+char timestamping[80];
+char tracing[80];
+
+// Latest observation for each station of each group (main thread only)
+struct observation_table{
+   float  value[MAX_TARGETS];	// NAN = no value yet
+   time_t observed[MAX_TARGETS];	// Time of value from API, 0 = unknown
+   time_t updated[MAX_TARGETS];	// Time of request
+   } obs;
+int num_obs;
+
+// Time series of each observation slot - Gorilla compressed blocks, oldest spilled to TS_FILE
+#define TS_BLOCK_BYTES 256	// ~80 points of a regular series
+#define TS_FILE "dmiapi.ts"
+#define TS_JSON_HOURS 24	// Hours in series.json
+struct ts_block{
+   struct ts_block* next;	// Newer block of series - next free block in pool
+   int   series;
+   int   count;			// Points
+   int   bits;			// Bits used in data
+   long  seq;			// Allocation order - oldest is spilled first
+   time_t t_first;
+   time_t t_last;
+   long  delta;			// Encoder state: latest delta, value & XOR window
+   uint32_t v_prev;
+   int   lead;
+   int   trail;
+   uint8_t data[TS_BLOCK_BYTES];
+   };
+
+struct ts_series{
+   struct ts_block* first;
+   struct ts_block* last;	// Block being written
+   long  points;		// Points added since start
+   time_t t_last;
+   int   spilled;		// Blocks in TS_FILE
+   } ts[MAX_TARGETS];
+
+// Spilled block - fields before offset are the header in TS_FILE
+struct ts_spill{
+   char  key[48];		// Series eg. "metObs@staging/06041"
+   int   count;
+   int   bits;
+   time_t t_first;
+   time_t t_last;
+   long  offset;		// Data in TS_FILE
+   int   series;
+   };
+
+struct ts_range{
+   int   count;
+   float min;
+   float max;
+   FILE* f;
+   };
+
+// Rollups of response times - round robin archive for each group & resolution
+#define ROLLUP_FILE "dmiapi.rrd"
+#define ROLLUP_MAGIC "DMIRRD02"
+#define ROLLUP_BUCKETS 32	// 0.1 ms * sqrt(2)^n, up to ~4.6 s
+#define ROLLUP_RES 4
+#define ROLLUP_ROWS (1440 + 2016 + 744 + 730)
+struct{
+   char  name[4];
+   int   step;			// Seconds
+   int   rows;
+   int   first;			// First row in group
+   } rollup_res[ROLLUP_RES] = {{"1m", 60, 1440, 0}, {"5m", 300, 2016, 1440}, {"1h", 3600, 744, 3456}, {"1d", 86400, 730, 4200}};
+
+struct rollup_slot{
+   time_t start;		// Time of slot - another time means the slot is old
+   uint32_t count;
+   uint32_t errors;
+   double sum;			// ms
+   float min;
+   float max;
+   uint32_t hist[ROLLUP_BUCKETS];
+   };
+
+struct rollup_header{
+   char  magic[8];
+   int   num_groups;
+   char  group[MAX_GROUPS][sizeof(group[0].name)];
+   struct rollup_slot slot[];	// num_groups * ROLLUP_ROWS
+   } *rollup;
+
+struct ts_block* ts_pool;
+struct ts_block* ts_free;
+int ts_pool_size;
+long ts_seq;
+struct ts_spill* ts_spill;
+int ts_num_spill, ts_max_spill;
+FILE* ts_file;
+char ts_memory[80];
+
+// Target registry - (gateway, API, station). Arrays of each field, ~60 bytes for each target.
+// Written by the main thread only, except the prebuilt requests which are read-only after start
+struct target_registry{
+   unsigned char  gateway[MAX_TARGETS];
+   unsigned char  api[MAX_TARGETS];
+   unsigned short station[MAX_TARGETS];
+   struct iovec   req[MAX_TARGETS];	// Prebuilt request
+   unsigned int   requests[MAX_TARGETS];
+   unsigned int   errors[MAX_TARGETS];	// No connection or http returncode != 200
+   unsigned short last_rc[MAX_TARGETS];
+   float          last_ms[MAX_TARGETS];
+   float          ttfb_ms[MAX_TARGETS];	// Time to first byte of latest response
+   float          rtt_ms[MAX_TARGETS];	// Smoothed RTT from TCP_INFO of latest response
+   float          min_ms[MAX_TARGETS];
+   float          max_ms[MAX_TARGETS];
+   double         sum_ms[MAX_TARGETS];
+   double         wire_sum[MAX_TARGETS];	// Bytes received
+   double         body_sum[MAX_TARGETS];	// Decoded body bytes
+   } target;
+int num_targets;
+
+// HTTP response parser
+#define HP_HEADER 0
+#define HP_BODY 1		// Content-Length body
+#define HP_CHUNK_SIZE 2
+#define HP_CHUNK_DATA 3
+#define HP_CHUNK_END 4		// CRLF after chunk data
+#define HP_TRAILER 5
+#define HP_BODY_EOF 6		// Body ends when connection closes
+#define HP_DONE 7
+#define HP_ERROR 8
+
+#define HP_IDENTITY 0
+#define HP_GZIP 1
+#define HP_BR 2
+
+struct http_parser{
+   int   state;
+   int   status;		// http returncode
+   int   chunked;
+   long  content_length;	// -1 = not in header
+   long  chunk_left;
+   long  body_len;		// Decoded body bytes
+   long  coded_len;		// Body bytes before Content-Encoding is decoded
+   long  wire_len;		// Bytes received incl. header & chunk framing
+   int   encoding;		// Content-Encoding, HP_IDENTITY, HP_GZIP or HP_BR
+   z_stream* z;			// Decoders are kept for the next response on the parser
+   BrotliDecoderState* br;
+   char  header[MAX_BUF];
+   int   header_len;
+   char  line[80];		// Chunk size or trailer line
+   int   line_len;
+   char* body;			// Body is copied here if != NULL
+   long  body_size;
+   int   overflow;		// Body larger than body_size
+   struct json_tokener* tok;	// Body is parsed while received if != NULL - no size limit
+   struct json_object* json;	// Result of tok
+   };
+
+// Latency histogram in us - exact below 64 us, then 32 sub-buckets per power of 2 (~3%)
+#define HIST_BUCKETS 1024
+struct histogram{
+   long  count[HIST_BUCKETS];
+   long  total;
+   int64_t max;
+   };
+
+// Load generation (-load)
+char load_api[80];
+char load_connections[80];
+char load_rates[80];
+char load_step_duration[80];
+
+// Benchmark of response handling (-bench)
+#define BENCH_CASES 40
+struct bench_case{
+   char  name[40];
+   char* data;			// Response as received from the socket
+   long  len;
+   int   read_size;		// Bytes given to http_parse at a time
+   int   batch;			// Body is parsed while received (batch request)
+   } bench_case[BENCH_CASES];
+int num_bench;
+char bench_baseline[200];
+char bench_tolerance[80];
+char bench_corpus[200];
+struct http_parser bench_hp;
+char* bench_buf;
+struct json_tokener* bench_tok;
+struct sample bench_smp;
+
+// Capture of raw responses ([CAPTURE]) & -replay. A record is one exchange on a connection:
+// capture_head, count x (group, target), reads x capture_read & the bytes read
+#define CAPTURE_MAGIC "DMICAP01"
+#define CAPTURE_READS 4096		// Reads in one exchange
+#define CAPTURE_BYTES 4194304		// Bytes in one exchange
+struct capture_head{
+   int64_t sent;		// CLOCK_REALTIME ns of request
+   uint32_t len;		// Bytes read
+   uint16_t count;		// Responses asked for
+   uint16_t reads;
+   };
+struct capture_read{
+   int64_t ns;			// From request sent until read
+   int64_t len;
+   };
+struct capture_buf{
+   struct capture_head head;
+   int64_t t0;			// raw_ns of request
+   uint16_t target[2 * MAX_STREAMS];
+   struct capture_read read[CAPTURE_READS];
+   char  data[CAPTURE_BYTES];
+   };
+char capture[200];
+FILE* capture_out;
+FILE* replay_in;
+pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+char replay_file[200];
+int replay_paced;
+atomic_int replay_done;
+long replay_exchanges, replay_responses, replay_bytes;
+int64_t replay_ns;
+
+// Own cost of the probe - CPU, context switches, allocations & I/O for each cycle (one sample)
+#define OVERHEAD_NS 10000000000LL	// Period of the per cycle figures & OVERHEAD_FILE
+#define OVERHEAD_FILE "dmiapi.prom"	// Counters for the node_exporter textfile collector
+#define OVERHEAD_BUFFER 4096		// stdio buffer - one write syscall each
+#define OV_NET 0			// Subsystems: TLS reads & writes on probe connections
+#define OV_LOG 1			// translog, statlog, log, trace & http log
+#define OV_HTML 2			// index.html, series.json & OVERHEAD_FILE
+#define OV_CONSOLE 3
+#define OV_DATA 4			// Time series spill & [CAPTURE]
+#define OV_SUBS 5
+const char* ov_name[OV_SUBS] = {"net", "log", "html", "console", "data"};
+struct overhead_io{
+   atomic_long syscalls;
+   atomic_long bytes;		// Written
+   } ov_io[OV_SUBS];
+atomic_long alloc_count;	// malloc, calloc & realloc of the process
+atomic_long ov_connects;	// init_com - socket, SSL_CTX & handshake
+struct overhead_record{
+   int64_t at;			// raw_ns of snapshot, 0 = none
+   long  cycles;
+   double utime, stime;		// CPU s
+   long  nvcsw, nivcsw;		// Context switches - voluntary / involuntary
+   long  allocs;
+   long  connects;
+   long  syscalls[OV_SUBS];
+   long  bytes[OV_SUBS];
+   long  syscr, syscw;		// Read & write syscalls of the process - /proc/self/io
+   } ov_now, ov_prev;		// Latest two snapshots
+long ov_cycles;			// Samples applied by main thread
+long trace_pending;		// Bytes written to trace_out since flush
+
+// Live statistics in POSIX shared memory ([SHM]) for local readers - fixed layout, changed only with SHM_VERSION.
+// Main thread is the only writer. Seqlock: seq is odd while the segment is written - a reader copies the
+// groups and retries if seq was odd or has changed since it started
+#define SHM_MAGIC 0x314D48534D494D44ULL	// "DMIMSHM1"
+#define SHM_VERSION 1
+#define SHM_RETRIES 10000		// Reader checks the writer after this many torn copies ...
+#define SHM_WAIT_NS 1000000000LL	// ... & gives up after 1 s
+struct shm_group{
+   int64_t interval_ns;		// Current interval of schedule
+   int64_t missed;		// Deadlines missed
+   double ms_200;		// Sum of response times - origin path
+   double ms_304;		// Sum of response times - gateway's cache path
+   int32_t requests;
+   int32_t http_204;
+   int32_t http_304;
+   int32_t http_other;
+   int32_t last_returncode;
+   int32_t station;		// Index of station of latest request
+   float elapsed;		// ms - as mea[]
+   float elapsed_low;
+   float elapsed_high;
+   float elapsed_gns10;
+   float elapsed_gns100;
+   float elapsed_gns1000;
+   float server;		// TTFB - RTT
+   float rtt;
+   char  name[80];		// Group eg. "metObs@staging"
+   char  station_name[40];
+   char  observation[48];	// Latest datapoint as on console
+   };
+struct shm_segment{
+   uint64_t magic;
+   uint32_t version;
+   uint32_t size;		// sizeof(struct shm_segment)
+   atomic_ulong seq;
+   int64_t updated;		// time_t of latest update
+   int64_t cycles;		// Samples applied
+   int32_t pid;			// Writer
+   int32_t num_groups;
+   struct shm_group group[MAX_GROUPS];
+   };
+char shm_name[80];
+struct shm_segment* shm_seg;	// Writer's mapping - NULL = no [SHM]
+
+// Per request memory: JSON parsed by a worker is taken from its arena (json-c has no allocator hooks, so
+// malloc() sends it there while arena_cur is set). The arena is reset before the next probe. free() of an
+// arena block does nothing - all arenas are in one region, so any thread can tell an arena block
+struct arena{
+   char* base;
+   size_t size;
+   size_t used;
+   atomic_long high;		// High water mark in bytes
+   atomic_long overflow;	// Allocations that did not fit - taken from the heap
+   };
+struct arena* arenas;
+int num_arenas;
+char* arena_lo;			// Region of all arenas
+char* arena_hi;
+char arena_size[80];
+__thread struct arena* arena_own;	// Arena of thread - NULL = none
+__thread struct arena* arena_cur;	// Allocations go here if != NULL
+
+// Library allocations (OpenSSL, nghttp2, brotli) live longer than a request. Freed blocks are kept on free
+// lists of the thread by size class (64 B - 128 kB) & reused, so a steady state does not call malloc
+#define POOL_CLASSES 12
+#define POOL_KEEP 32			// Free blocks kept in each class
+struct pool_head{
+   int   class;			// -1 = larger than the classes
+   size_t size;
+   };
+__thread void* pool_free_list[POOL_CLASSES];
+__thread int pool_free_count[POOL_CLASSES];
+
+// Bulk download (-bulk)
+char bulk_api[80];
+char bulk_path[400];
+char bulk_from[80];
+char bulk_to[80];
+char bulk_partition[80];
+char bulk_connections[80];
+char bulk_dir[200];
+int api_bulk;			// Endpoint
+
+struct bulk_range{
+   time_t from;
+   time_t to;
+   char* next;			// Next page at restart - NULL = first page
+   long  offset;		// Size of file at restart
+   long  features;
+   int   resume;
+   int   done;
+   };
+
+struct{
+   struct bulk_range* range;
+   int   count;
+   atomic_int taken;		// Ranges taken by threads
+   atomic_int finished;		// Threads ended
+   atomic_int ranges_done;
+   atomic_long pages;
+   atomic_long features;
+   atomic_long wire;		// Bytes received
+   atomic_long body;		// Decoded bytes
+   atomic_long errors;
+   FILE* state;
+   pthread_mutex_t lock;	// State file
+   } bulk = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+struct load_conn{
+   SSL*  ssl;
+   int   fd;
+   int   busy;
+   int   want;		// poll event SSL is waiting for
+   int64_t intended_ns;	// Scheduled send time of request in flight
+   int64_t sent_ns;
+   struct iovec* req;
+   int   req_off;
+   struct http_parser hp;
+   };
+
+// HTTP/2 stream - response is fed to its own parser as in HTTP/1.1
+struct h2_stream{
+   int   id;
+   struct http_parser hp;	// Header is rebuilt as text, DATA is body
+   char* body;			// Kept for the next round - MAX_BODY
+   struct json_tokener* tok;
+   struct stamp t_first;	// First frame of response
+   struct stamp t_done;		// Stream closed
+   int   done;			// 1 = complete, -1 = reset
+   };
+
+// Probe workers - each thread owns its connection, parser & ring
+// Timing floor of the host - wake-up latency of the timer & gaps in a busy loop, measured by each worker at start
+#define JITTER_WAKEUPS 200		// 1 ms absolute timer wake-ups
+#define JITTER_LOOP_NS 100000000LL	// Busy loop reading the clock
+#define JITTER_GAP_NS 10000		// Loop gaps above this are counted
+#define PREFAULT_STACK (256 * 1024)	// Stack touched by a worker in low-jitter mode
+#define WORKER_STACK (1024 * 1024)	// Stack of a worker in low-jitter mode - locked memory, not the 8 MB default
+struct jitter_record{
+   int64_t wake_p50, wake_p99, wake_max;
+   int64_t gap_max;
+   long  gaps;
+   };
+
+struct worker{
+   pthread_t thread;
+   int   id;
+   int   timer_fd;
+   struct conn_record conn[MAX_GATEWAYS];	// One connection for each gateway
+   struct http_parser hp;
+   char  body[MAX_BODY];
+   struct json_tokener* tok;	// Batch responses
+   struct sample pipe[MAX_STREAMS];	// Samples of pipelined responses & HTTP/2 streams
+   char  pipe_req[MAX_PIPELINE * REQ_SIZE];	// Pipelined requests
+   struct h2_stream* streams;	// HTTP/2 streams - one for each sample in pipe
+   struct shard shard;
+   struct capture_buf* cap;	// Exchange being captured - NULL if [CAPTURE] is not set
+   struct arena* arena;		// JSON of the current probe
+   int   cpu;			// [PROBE_CPU] of worker - -1 = not pinned
+   struct jitter_record jitter;	// Timing floor measured at start
+   };
+struct worker* workers;
+int num_workers;
+int sample_fd;			// eventfd - workers wake main thread
+char workers_cfg[80];
+char keepalive[80];
+char pipeline[80];
+char http2[80];
+char compression[80];
+pthread_mutex_t budget_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Low-jitter mode - workers pinned to [PROBE_CPU], optionally SCHED_FIFO. Memory is locked & pre-faulted
+char probe_cpu[80];
+char sched_fifo[80];
+int probe_cpus[MAX_GROUPS];	// Worker n runs on probe_cpus[n % num_probe_cpus]
+int num_probe_cpus;
+pthread_barrier_t workers_ready;	// Workers have measured the timing floor - main thread sets the schedule
+struct jitter_record jitter_floor;	// Worst of the workers
+
+// Scheduler - absolute deadlines on CLOCK_MONOTONIC
+struct schedule_record{
+   int64_t interval_ns;
+   int64_t start_ns;
+   int64_t periods;		// Deadline = start_ns + periods * interval_ns
+   int64_t fire_ns;		// Deadline incl. jitter
+   long  missed;		// Deadlines passed while busy
+   int   station;		// Current station
+   int64_t base_ns;		// Interval from [xxx_FREQ]
+   long  budget_limited;	// Accelerations refused by budget
+   } sched[MAX_GROUPS];
+
+// Adaptive sampling - token bucket for requests above the base rate
+char adaptive[80];
+char adaptive_min_freq[80];
+char budget_per_hour[80];
+double budget_tokens;
+double budget_capacity;
+double budget_rate;		// Tokens per ns
+int64_t budget_updated_ns;
+
+// Names of known stations
 struct maalestation{ 	// metObs
    char* kode;
    char* navn;
@@ -207,52 +922,208 @@ struct maalestation	// oceanObs
 // Parametre fra konfigurationsfil
 char config_filename[80];
 char userid[80];
-char key_metobs[80];
-char key_oceanobs[80];
-char key_lightobs[80];
-char key_climateobs[80];
 char iphost[80];
 char freq[80];
 char wwwpath[80];
 char silent[80];
+char jitter[80];
 struct thresholds{
    char trs_warning[80];
    char trs_error[80];
-   } th[NUM_OF_APIS + 1];
+   } th[MAX_APIS];
    
 // Function prototypes
 // TCPIP
-int create_socket(char url_str[], BIO *out);
-int init_com();
-void close_com();
+int create_socket(char url_str[], BIO *out, int64_t* resolved);
+int init_com(struct conn_record* c);
+void close_com(struct conn_record* c);
 int log_ssl();
-long unsigned int get_length(char* buffer);
+int h2_start(struct conn_record* c);
+ssize_t h2_send(nghttp2_session* session, const uint8_t* data, size_t length, int flags, void* user_data);
+int h2_begin_headers(nghttp2_session* session, const nghttp2_frame* frame, void* user_data);
+int h2_header(nghttp2_session* session, const nghttp2_frame* frame, const uint8_t* name, size_t namelen,
+   const uint8_t* value, size_t valuelen, uint8_t flags, void* user_data);
+int h2_frame_recv(nghttp2_session* session, const nghttp2_frame* frame, void* user_data);
+int h2_data(nghttp2_session* session, uint8_t flags, int32_t stream_id, const uint8_t* data, size_t len, void* user_data);
+int h2_stream_close(nghttp2_session* session, int32_t stream_id, uint32_t error_code, void* user_data);
+void http_parser_init(struct http_parser* hp, char* body, long body_size);
+int http_parse(struct http_parser* hp, const char* data, int len);
+int http_header(struct http_parser* hp, const char* name, char* value, int size);
+int http_decoder(struct http_parser* hp, const char* encoding);
+
+// Load generation
+int load_run();
+int load_step(SSL_CTX* lctx, struct load_conn* conn, int nconn, int api, double rate, int duration, FILE* out);
+int load_connect(SSL_CTX* lctx, struct load_conn* c);
+int load_service(struct load_conn* c);
+
+// Bulk download
+int bulk_run();
+void* bulk_main(void* arg);
+void bulk_path_build(char* path, int size, char* from, char* to);
+void hist_add(struct histogram* h, int64_t us);
+int64_t hist_value(int idx);
+int64_t hist_percentile(struct histogram* h, double p);
 
 // Logs
 void write_syslog(const char* msg, int pri);
 void write_statlog(char* trans_type, char* trans_date, double trans_tid, double low, double high);
-void write_translog(char* trans_date, int api_id, int http_code, char* trans_id, double trans_tid);
+void write_translog(char* trans_date, int api_id, int http_code, char* trans_id, double trans_tid, struct tcp_record* tcp);
+void trace_write(struct sample* smp, int64_t log_start, int64_t log_end);
+void trace_span(int64_t trace_id, int64_t seq, int id, const char* name, int64_t start, int64_t end, int64_t offset);
+void json_escape(char* out, int size, const char* in);
 void http_log(char* msg1, char* msg2);
 
 // Output
 void view_console();
 void html_output();
 void compute_colors();
+int threshold_level(int api, float value);
+void spark_add(int api, float value);
+void spark_put(struct spark_record* s, float value);
+void html_spark(char* out, struct spark_record* s);
+void con_text(int row, const char* text);
+void con_color(int row, int col, int len, int color);
+void con_spark(int row, int col, int api);
+void con_flush();
 
 // Init & and functions
 int goodbye(int status_code);
+void shm_init();
+int shm_owner();
+void shm_publish();
+int shm_report();
 void read_config(char* config_filename);
 
 // Misc.
-float timedifference_msec(struct timeval t0, struct timeval t1);
+int64_t raw_ns();
+int64_t real_ns();
+void stamp_send(struct conn_record* c, struct stamp* s);
+void stamp_recv(struct conn_record* c, struct stamp* s);
+int64_t stamp_ns(struct stamp* t0, struct stamp* t1);
+void sample_time(struct sample* smp, struct stamp* t0, struct stamp* t_first, struct stamp* t_done);
+void tcp_read(struct conn_record* c, struct sample* smp);
+void trace_conn(struct conn_record* c, struct sample* smp);
+void trace_send(struct conn_record* c, struct sample* smp, int count, struct stamp* t0);
+BIO* sock_bio_new(struct conn_record* c);
+int sock_bio_write(BIO* b, const char* data, int len);
+int sock_bio_read(BIO* b, char* data, int len);
+long sock_bio_ctrl(BIO* b, int cmd, long num, void* ptr);
+
+// Scheduler
+void sched_init();
+int sched_wait(struct worker* w);
+void sched_next(int api, struct sample* smp, int stations);
+int64_t mono_ns();
+long random_r_ms(long n);
+int64_t adapt_interval(int api, struct sample* smp);
+
+// Workers
+struct sample* shard_slot(struct shard* sh);
+void shard_push(struct shard* sh);
+int shard_drain(struct shard* sh);
+void workers_start();
+void lowjitter_start();
+void lowjitter_worker(struct worker* w);
+void lowjitter_lock();
+void jitter_measure(struct worker* w);
+void jitter_report();
+void* worker_main(void* arg);
+void process_sample(struct sample* smp);
+
+// Time series
+void ts_init();
+void ts_key(char* key, int y);
+int ts_find(char* key);
+int ts_spill_valid(struct ts_spill* sp);
+void ts_spill_add(struct ts_spill* sp);
+void ts_add(int y, time_t t, float value);
+void ts_query(int y, time_t from, time_t to, void (*fn)(time_t, float, void*), void* arg);
+void ts_minmax(time_t t, float value, void* arg);
+void ts_json(time_t t, float value, void* arg);
+void ts_json_output();
+
+// Overhead
+void overhead_io(int sub, long syscalls, long bytes);
+void overhead_write(int sub, long bytes);
+void overhead_file(int sub, long bytes);
+long overhead_bio(BIO* b, int oper, const char* argp, size_t len, int argi, long argl, int ret, size_t* processed);
+void overhead_update();
+double overhead_cycle(double now, double prev);
+void overhead_prom();
+
+// Arena & pool
+void arena_init(int n);
+void* arena_alloc(struct arena* a, size_t size);
+void arena_reset(struct arena* a);
+void* pool_alloc(size_t size);
+void* pool_realloc(void* ptr, size_t size);
+void pool_free(void* ptr);
+void* pool_crypto_malloc(size_t size, const char* file, int line);
+void* pool_crypto_realloc(void* ptr, size_t size, const char* file, int line);
+void pool_crypto_free(void* ptr, const char* file, int line);
+void* pool_h2_malloc(size_t size, void* user_data);
+void* pool_h2_calloc(size_t n, size_t size, void* user_data);
+void* pool_h2_realloc(void* ptr, size_t size, void* user_data);
+void pool_h2_free(void* ptr, void* user_data);
+void* pool_br_alloc(void* opaque, size_t size);
+void pool_br_free(void* opaque, void* ptr);
+
+// Capture & replay
+void capture_begin(struct worker* w, struct sample* smp, int count, struct stamp* t0);
+void capture_read(struct worker* w, const char* data, int len);
+void capture_end(struct worker* w);
+void replay_start();
+void* replay_main(void* arg);
+int replay_summary();
+
+// Benchmark
+int bench_run(int save);
+void bench_add(const char* name, char* body, long body_len, int chunk, int gzip, int read_size, int batch);
+char* bench_body(int features, long* len);
+void bench_op(int op, struct bench_case* bc);
+double bench_time(int op, struct bench_case* bc, double* allocs);
+
+// Rollups
+int rollup_init();
+int rollup_same();
+int rollup_open();
+struct rollup_slot* rollup_slot(int g, int r, time_t t);
+void rollup_add(int g, time_t t, float ms);
+float rollup_percentile(struct rollup_slot* s, double p);
+void rollup_query(int g, int r, time_t from, time_t to, void (*fn)(int, struct rollup_slot*, void*), void* arg);
+int rollup_report(char* res);
+
+// Statistics
+void calc_stats(int api);
+void stat_name(char* stat_code, int api, int n);
 
 // API functions
-int api_request(char* api, char* station_id);
-int decode_data(int api, char* server_reply);
+int api_request(struct worker* w, int t, struct sample* smp);
+int api_pipeline(struct worker* w, int api, int depth);
+int api_h2(struct worker* w, int gw, int count);
+int api_response(struct http_parser* hp, int t, struct sample* smp);
+void api_meta(struct http_parser* hp, struct sample* smp);
+void sample_init(struct sample* smp, int api, int t);
+void cond_update(struct http_parser* hp, int t, struct sample* smp);
+int request_get(int t, char* req);
+int decode_data(int api, char* body, struct sample* smp);
+int decode_batch(int api, struct json_object* root, struct sample* smp);
+struct json_object* json_path(struct json_object* root, char* path);
+time_t json_time(struct json_object* obj);
+
+// Endpoints
+void endpoint_defaults();
+int endpoint_add(char* name);
+int endpoint_param(char* parameter, char* value);
+int gateway_param(char* parameter, char* value);
+void target_build();
+char* station_name(int api, int station);
 
 int main(int argc, char *argv[]){
-   int g10, g100, g1000, x;
-   char c, syslog_txt[80];
+   int x, y;
+   uint64_t n;
+   char c;
 
    http_debug_file = fopen ("dmiapi_http.log", "w");
    write_syslog("Monitor started", 0);
@@ -261,10 +1132,43 @@ int main(int argc, char *argv[]){
    strcpy(config_filename,argv[1]); // filename
    read_config(config_filename);
 
-   // Initialize SSL/TLS comm
+   // Initialize SSL/TLS comm - OpenSSL allocates from the pool
+   if (CRYPTO_set_mem_functions(pool_crypto_malloc, pool_crypto_realloc, pool_crypto_free) == 0)
+      write_syslog("OpenSSL allocations could not be moved to the pool", 2);
+   SSL_library_init();
    OpenSSL_add_all_algorithms();
    ERR_load_BIO_strings();
    SSL_load_error_strings();
+   outbio = BIO_new_fp(stdout, BIO_NOCLOSE);
+   signal(SIGPIPE, SIG_IGN); // Write to closed keep-alive connection
+
+   // Load generation mode
+   if (argc > 2 && strcmp(argv[2], "-load") == 0)
+      goodbye(load_run());
+
+   // Bulk download mode
+   if (argc > 2 && strcmp(argv[2], "-bulk") == 0)
+      goodbye(bulk_run());
+
+   // Rollups as CSV
+   if (argc > 3 && strcmp(argv[2], "-report") == 0)
+      goodbye(rollup_report(argv[3]));
+
+   // Replay of captured responses - "paced" keeps the original timing
+   if (argc > 3 && strcmp(argv[2], "-replay") == 0){
+      snprintf(replay_file, sizeof(replay_file), "%s", argv[3]);
+      replay_paced = argc > 4 && strcmp(argv[4], "paced") == 0;
+      capture[0] = 0;
+      strcpy(tracing, "0"); // No network phases in a replay
+      }
+
+   // Snapshot of the live statistics of a running probe
+   if (argc > 2 && strcmp(argv[2], "-shm") == 0)
+      goodbye(shm_report());
+
+   // Benchmark of response handling - "save" writes a new baseline
+   if (argc > 2 && strcmp(argv[2], "-bench") == 0)
+      goodbye(bench_run(argc > 3 && strcmp(argv[3], "save") == 0));
 
    // Start time
    start_time = time(NULL);
@@ -276,7 +1180,7 @@ int main(int argc, char *argv[]){
    start_c_time_string[strlen(start_c_time_string)-1]=0;
 
    // Initialize
-   for (x = 0; x <= NUM_OF_APIS; x++){
+   for (x = 0; x < num_groups; x++){
       mea[x].requests = 0;
       mea[x].elapsed = 0;
       mea[x].elapsed_low = 1000;
@@ -287,533 +1191,1700 @@ int main(int argc, char *argv[]){
       mea[x].elapsed_sum10 = 0;
       mea[x].elapsed_sum100 = 0;
       mea[x].elapsed_sum1000 = 0;
+      mea[x].g10 = mea[x].g100 = mea[x].g1000 = 1;
       http_resp[x].http_204 = 0;
+      http_resp[x].http_304 = 0;
       http_resp[x].http_other = 0;
+      http_resp[x].ms_200 = 0;
+      http_resp[x].ms_304 = 0;
       }
-   g10 = g100 = g1000 = 1;
-
+   for (x = 0; x < num_targets; x++)
+      target.min_ms[x] = 1000;
+   for (x = 0; x < num_obs; x++)
+      obs.value[x] = NAN;
+   ts_init();
+   if (rollup_init() == 0) write_syslog("Could not open " ROLLUP_FILE " - no rollups", 2);
+   if (strlen(shm_name) > 0) shm_init();
+   if (strlen(replay_file) > 0){
+      sched_init();
+      replay_start();
+      }
+   else workers_start();
 
    while(1){
-      // Do #NUM_OF_APIS requests
-      for (x = 0; x <= 3; x++){
-         if (x == 0) online=api_request("metObsAPI", stations_liste[stations_count].kode);
-         if (x == 1) online=api_request("oceanObsAPI", kyst_stations_liste[stations_count].kode);
-         if (x == 2) online=api_request("lightObsAPI", kyst_stations_liste[stations_count].kode);
-         if (x == 3) online=api_request("climateObsAPI", stations_liste[stations_count].kode);
-
-         if (online == 0){
-            mea[x].elapsed_sum10 = mea[x].elapsed_sum10 + mea[x].elapsed;
-            mea[x].elapsed_sum100 = mea[x].elapsed_sum100 + mea[x].elapsed;
-            mea[x].elapsed_sum1000 = mea[x].elapsed_sum1000 + mea[x].elapsed;
-            if (mea[x].elapsed > mea[x].elapsed_high) mea[x].elapsed_high = mea[x].elapsed;
-            if (mea[x].elapsed < mea[x].elapsed_low) mea[x].elapsed_low = mea[x].elapsed;
+      // Wait for samples from workers
+      read(sample_fd, &n, sizeof(n));
+      current_time=time(NULL);
+      x = atomic_load_explicit(&replay_done, memory_order_acquire);
+      for (y = 0; y < num_workers; y++)
+         shard_drain(&workers[y].shard);
+      if (trace_out != NULL){
+         fflush(trace_out);
+         overhead_write(OV_LOG, trace_pending);
+         trace_pending = 0;
+         }
+
+      // Publish, view console & do html output
+      shm_publish();
+      overhead_update();
+      view_console();
+      html_output();
+      if (x) goodbye(replay_summary());
+   } /* while */
+
+   return 0;
+   } /* main */
+
+// Apply sample from a worker to statistics & logs (main thread only)
+void process_sample(struct sample* smp){
+   int x, t, n;
+   int64_t log_start;
+
+   ov_cycles++;
+   x = smp->api;
+   t = smp->target;
+   online = smp->online;
+   mea[x].station = smp->station;
+   mea[x].interval_ns = smp->interval_ns;
+   mea[x].missed = smp->missed;
+   budget_view = smp->budget;
+
+   if (smp->online == -1) mea[x].elapsed = 0; // No data from socket
+   if (smp->online != 0){
+      rollup_add(x, current_time, -1);
+      target.errors[t]++;
+      target.last_rc[t] = 0;
+      spark_add(x, -1);
+      if (atoi(tracing) == 1) trace_write(smp, 0, 0);
+      return;
+      }
+
+   // Target statistics
+   target.requests[t]++;
+   target.last_rc[t] = smp->http_ret;
+   target.last_ms[t] = smp->elapsed;
+   target.ttfb_ms[t] = smp->first_byte;
+   if (smp->tcp.rtt > 0) target.rtt_ms[t] = smp->tcp.rtt;
+   target.wire_sum[t] = target.wire_sum[t] + smp->wire_bytes;
+   target.body_sum[t] = target.body_sum[t] + smp->body_bytes;
+   target.sum_ms[t] = target.sum_ms[t] + smp->elapsed;
+   if (smp->elapsed < target.min_ms[t]) target.min_ms[t] = smp->elapsed;
+   if (smp->elapsed > target.max_ms[t]) target.max_ms[t] = smp->elapsed;
+   if (smp->http_ret != 200 && smp->http_ret != 304) target.errors[t]++;
+   rollup_add(x, current_time, smp->http_ret == 200 || smp->http_ret == 304 ? smp->elapsed : -1);
+
+   mea[x].elapsed = smp->elapsed;
+   mea[x].last_returncode = smp->returncode;
+   if (smp->http_ret == 200 || smp->http_ret == 304) mea[x].requests++;
+   if (smp->http_ret == 200) http_resp[x].ms_200 = http_resp[x].ms_200 + smp->elapsed;
+   else if (smp->http_ret == 304){
+      http_resp[x].http_304++;
+      http_resp[x].ms_304 = http_resp[x].ms_304 + smp->elapsed;
+      }
+   else if (smp->http_ret == 204) http_resp[x].http_204++;
+   else http_resp[x].http_other++;
+   if (smp->observation[0] != 0) strcpy(observation[x].data, smp->observation);
+   for (n = 0; n < smp->num_values; n++)
+      if (!isnan(smp->value[n])){
+         obs.value[group[x].obs + smp->station + n] = smp->value[n];
+         obs.observed[group[x].obs + smp->station + n] = smp->observed[n];
+         obs.updated[group[x].obs + smp->station + n] = current_time;
+         ts_add(group[x].obs + smp->station + n, smp->observed[n] != 0 ? smp->observed[n] : current_time, smp->value[n]);
+         }
+   if (smp->trans_date[0] != 0) strcpy(trans_dato, smp->trans_date);
+   log_start = raw_ns();
+   write_translog(trans_dato, x, smp->http_ret, smp->trans_id, smp->elapsed, &smp->tcp);
+   if (atoi(tracing) == 1) trace_write(smp, log_start, raw_ns());
+
+   mea[x].elapsed_sum10 = mea[x].elapsed_sum10 + mea[x].elapsed;
+   mea[x].elapsed_sum100 = mea[x].elapsed_sum100 + mea[x].elapsed;
+   mea[x].elapsed_sum1000 = mea[x].elapsed_sum1000 + mea[x].elapsed;
+   if (mea[x].elapsed > mea[x].elapsed_high) mea[x].elapsed_high = mea[x].elapsed;
+   if (mea[x].elapsed < mea[x].elapsed_low) mea[x].elapsed_low = mea[x].elapsed;
+   spark_add(x, mea[x].elapsed);
+
+   // Server time - time to first byte less one round trip
+   if (smp->tcp.rtt > 0){
+      mea[x].tcp = smp->tcp;
+      mea[x].server = smp->first_byte > smp->tcp.rtt ? smp->first_byte - smp->tcp.rtt : 0;
+      spark_put(&server_spark[x], mea[x].server);
+      }
+
+   // Calculate
+   calc_stats(x);
+   } /* process_sample */
+
+// Slot for next sample in ring - NULL if ring is full
+struct sample* shard_slot(struct shard* sh){
+   unsigned long head, tail;
+
+   head = atomic_load_explicit(&sh->head, memory_order_relaxed);
+   tail = atomic_load_explicit(&sh->tail, memory_order_acquire);
+   if (head - tail >= RING_SIZE) return NULL;
+   return &sh->ring[head % RING_SIZE];
+   } /* shard_slot */
+
+// Publish sample written to shard_slot()
+void shard_push(struct shard* sh){
+   atomic_fetch_add_explicit(&sh->head, 1, memory_order_release);
+   } /* shard_push */
+
+// Apply all published samples in ring - returns number of samples
+int shard_drain(struct shard* sh){
+   unsigned long head, tail;
+   int n;
+
+   n = 0;
+   tail = atomic_load_explicit(&sh->tail, memory_order_relaxed);
+   head = atomic_load_explicit(&sh->head, memory_order_acquire);
+   while (tail != head){
+      process_sample(&sh->ring[tail % RING_SIZE]);
+      tail++;
+      n++;
+      atomic_store_explicit(&sh->tail, tail, memory_order_release);
+      }
+   return n;
+   } /* shard_drain */
+
+// Start [WORKERS] probe threads. Group n is handled by worker n % [WORKERS]
+void workers_start(){
+   pthread_attr_t attr;
+   int x, y;
+
+   pthread_attr_init(&attr);
+   if (num_probe_cpus > 0){
+      lowjitter_start();
+      pthread_attr_setstacksize(&attr, WORKER_STACK);
+      }
+   pthread_barrier_init(&workers_ready, NULL, num_workers + 1);
+   sample_fd = eventfd(0, 0);
+   workers = calloc(num_workers, sizeof(struct worker));
+   arena_init(num_workers);
+   for (x = 0; x < num_workers; x++){
+      workers[x].id = x;
+      workers[x].arena = &arenas[x];
+      workers[x].cpu = num_probe_cpus > 0 ? probe_cpus[x % num_probe_cpus] : -1;
+      workers[x].timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+      for (y = 0; y < MAX_GATEWAYS; y++)
+         workers[x].conn[y].gateway = y;
+      if (workers[x].timer_fd < 0 || sample_fd < 0){
+         write_syslog("Could not create timerfd - terminating", 3);
+         goodbye(3);
+         }
+      workers[x].tok = json_tokener_new();
+      workers[x].streams = calloc(MAX_STREAMS, sizeof(struct h2_stream));
+      if (strlen(capture) > 0) workers[x].cap = malloc(sizeof(struct capture_buf));
+      atomic_init(&workers[x].shard.head, 0);
+      atomic_init(&workers[x].shard.tail, 0);
+      atomic_init(&workers[x].shard.dropped, 0);
+      if (pthread_create(&workers[x].thread, &attr, worker_main, &workers[x]) != 0){
+         write_syslog("Could not start worker thread - terminating", 3);
+         goodbye(3);
+         }
+      }
+
+   pthread_attr_destroy(&attr);
+
+   // Timing floor is measured before the first deadline is set. Memory is locked when arenas, buffers
+   // & stacks exist and are faulted in
+   pthread_barrier_wait(&workers_ready);
+   if (num_probe_cpus > 0) lowjitter_lock();
+   jitter_report();
+   sched_init();
+   pthread_barrier_wait(&workers_ready);
+   } /* workers_start */
+
+// Low-jitter mode: freed memory stays with the process. The main thread (console, html & logs) leaves
+// the probe CPUs - workers inherit its mask and then pin themselves
+void lowjitter_start(){
+   cpu_set_t set;
+   int x;
+
+   mallopt(M_TRIM_THRESHOLD, -1);
+   mallopt(M_MMAP_MAX, 0);
+   sched_getaffinity(0, sizeof(set), &set);
+   for (x = 0; x < num_probe_cpus; x++)
+      CPU_CLR(probe_cpus[x], &set);
+   if (CPU_COUNT(&set) == 0 || pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+      write_syslog("No CPU left for the main thread - it shares CPU with the workers", 2);
+   } /* lowjitter_start */
+
+// Lock memory of the running probe. Memory mapped later is only locked without a RLIMIT_MEMLOCK limit (or as
+// root) - with a limit a later malloc or thread would fail when the limit is reached
+void lowjitter_lock(){
+   struct rlimit rl;
+   int flags;
+
+   flags = MCL_CURRENT;
+   if (getrlimit(RLIMIT_MEMLOCK, &rl) == 0 && (rl.rlim_cur == RLIM_INFINITY || geteuid() == 0))
+      flags = MCL_CURRENT | MCL_FUTURE;
+   else
+      write_syslog("RLIMIT_MEMLOCK is limited - memory mapped after start is not locked", 2);
+   if (mlockall(flags) != 0)
+      write_syslog("Could not lock memory (mlockall) - check RLIMIT_MEMLOCK", 2);
+   } /* lowjitter_lock */
+
+// Pin worker to its CPU, SCHED_FIFO if configured & fault in buffers and stack before the first probe
+void lowjitter_worker(struct worker* w){
+   cpu_set_t set;
+   struct sched_param sp;
+   char stack[PREFAULT_STACK];
+   char syslog_str[80];
+
+   CPU_ZERO(&set);
+   CPU_SET(w->cpu, &set);
+   if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0){
+      snprintf(syslog_str, sizeof(syslog_str), "Worker %i could not be pinned to CPU %i", w->id, w->cpu);
+      write_syslog(syslog_str, 2);
+      }
+   if (atoi(sched_fifo) > 0){
+      sp.sched_priority = atoi(sched_fifo);
+      if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp) != 0){
+         snprintf(syslog_str, sizeof(syslog_str), "Worker %i could not run SCHED_FIFO - needs CAP_SYS_NICE", w->id);
+         write_syslog(syslog_str, 2);
+         }
+      }
+
+   memset(stack, 0, sizeof(stack));
+   __asm__ volatile("" : : "r"(stack) : "memory");	// Keep the memset
+   memset(w->body, 0, sizeof(w->body));
+   memset(w->pipe, 0, sizeof(w->pipe));
+   memset(w->pipe_req, 0, sizeof(w->pipe_req));
+   memset(w->shard.ring, 0, sizeof(w->shard.ring));
+   if (w->cap != NULL) memset(w->cap, 0, sizeof(struct capture_buf));
+   if (w->arena->base != NULL) memset(w->arena->base, 0, w->arena->size);
+   } /* lowjitter_worker */
+
+// Timing floor: wake-up latency of the worker's timer & longest interruption of a busy loop on its CPU
+void jitter_measure(struct worker* w){
+   int64_t lat[JITTER_WAKEUPS], deadline, t, prev, end;
+   uint64_t expirations;
+   struct itimerspec its;
+   int x, y;
+
+   memset(&its, 0, sizeof(its));
+   deadline = mono_ns();
+   for (x = 0; x < JITTER_WAKEUPS; x++){
+      deadline = deadline + 1000000;
+      its.it_value.tv_sec = deadline / 1000000000LL;
+      its.it_value.tv_nsec = deadline % 1000000000LL;
+      timerfd_settime(w->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+      while (read(w->timer_fd, &expirations, sizeof(expirations)) < 0)
+         ;
+      lat[x] = mono_ns() - deadline;
+      }
+
+   // Insertion sort - few values
+   for (x = 1; x < JITTER_WAKEUPS; x++){
+      t = lat[x];
+      for (y = x; y > 0 && lat[y - 1] > t; y--)
+         lat[y] = lat[y - 1];
+      lat[y] = t;
+      }
+   w->jitter.wake_p50 = lat[JITTER_WAKEUPS / 2];
+   w->jitter.wake_p99 = lat[JITTER_WAKEUPS * 99 / 100];
+   w->jitter.wake_max = lat[JITTER_WAKEUPS - 1];
+
+   w->jitter.gap_max = 0;
+   w->jitter.gaps = 0;
+   prev = raw_ns();
+   end = prev + JITTER_LOOP_NS;
+   while (prev < end){
+      t = raw_ns();
+      if (t - prev > w->jitter.gap_max) w->jitter.gap_max = t - prev;
+      if (t - prev > JITTER_GAP_NS) w->jitter.gaps++;
+      prev = t;
+      }
+   } /* jitter_measure */
+
+// Timing floor of each worker to the log - jitter_floor is the worst
+void jitter_report(){
+   char syslog_str[200], cpu[20];
+   struct jitter_record* j;
+   int x;
+
+   for (x = 0; x < num_workers; x++){
+      j = &workers[x].jitter;
+      if (workers[x].cpu >= 0) snprintf(cpu, sizeof(cpu), "CPU %i", workers[x].cpu);
+      else strcpy(cpu, "not pinned");
+      snprintf(syslog_str, sizeof(syslog_str), "Timing floor worker %i (%s): wake-up p50/p99/max %.1f/%.1f/%.1f usec, loop gap max %.1f usec, %li gaps above %i usec",
+         x, cpu, j->wake_p50 / 1e3, j->wake_p99 / 1e3, j->wake_max / 1e3, j->gap_max / 1e3, j->gaps, JITTER_GAP_NS / 1000);
+      write_syslog(syslog_str, 0);
+      if (j->wake_p50 > jitter_floor.wake_p50) jitter_floor.wake_p50 = j->wake_p50;
+      if (j->wake_p99 > jitter_floor.wake_p99) jitter_floor.wake_p99 = j->wake_p99;
+      if (j->wake_max > jitter_floor.wake_max) jitter_floor.wake_max = j->wake_max;
+      if (j->gap_max > jitter_floor.gap_max) jitter_floor.gap_max = j->gap_max;
+      if (j->gaps > jitter_floor.gaps) jitter_floor.gaps = j->gaps;
+      }
+   } /* jitter_report */
+
+// Probe worker: wait for deadline, request API and publish sample
+void* worker_main(void* arg){
+   struct worker* w;
+   struct sample* smp;
+   struct sample dropped;
+   uint64_t one;
+   int x, y, n, depth, ng, count;
+   int due[MAX_GROUPS], first[MAX_GROUPS + 1];
+   int64_t now;
+
+   w = (struct worker*)arg;
+   arena_own = w->arena;
+   if (w->cpu >= 0) lowjitter_worker(w);
+   jitter_measure(w);
+   pthread_barrier_wait(&workers_ready);	// Main thread sets the schedule
+   pthread_barrier_wait(&workers_ready);
+   one = 1;
+   while (1){
+      x = sched_wait(w);
+
+      // Memory of the previous probe - the tokenizers let go of it first
+      json_tokener_reset(w->tok);
+      for (n = 0; n < MAX_STREAMS; n++)
+         if (w->streams[n].tok != NULL) json_tokener_reset(w->streams[n].tok);
+      arena_reset(w->arena);
+
+      // HTTP/2: all groups of the worker on the same gateway that are due go out as streams on one connection.
+      // [PIPELINE] n gives n stations of each group. Falls back to HTTP/1.1 if the gateway does not offer h2
+      if (atoi(http2) == 1){
+         now = mono_ns();
+         ng = 0;
+         count = 0;
+         for (y = w->id; y < num_groups; y = y + num_workers){
+            if (group[y].gateway != group[x].gateway || (y != x && sched[y].fire_ns > now + H2_COALESCE_NS)) continue;
+            depth = atoi(pipeline) < group[y].count ? atoi(pipeline) : group[y].count;
+            if (count + depth > MAX_STREAMS) continue;
+            for (n = 0; n < depth; n++)
+               sample_init(&w->pipe[count + n], y, group[y].first + (sched[y].station + n) % group[y].count);
+            due[ng] = y;
+            first[ng++] = count;
+            count = count + depth;
+            }
+         if (api_h2(w, group[x].gateway, count) < 0)
+            for (n = 0; n < count; n++)
+               w->pipe[n].online = api_request(w, w->pipe[n].target, &w->pipe[n]);
+
+         first[ng] = count;
+         for (y = 0; y < ng; y++){
+            sched_next(due[y], &w->pipe[first[y + 1] - 1], first[y + 1] - first[y]);
+            for (n = first[y]; n < first[y + 1]; n++){
+               smp = shard_slot(&w->shard);
+               if (smp == NULL){
+                  atomic_fetch_add_explicit(&w->shard.dropped, 1, memory_order_relaxed);
+                  continue;
+                  }
+               memcpy(smp, &w->pipe[n], sizeof(struct sample));
+               smp->budget = w->pipe[first[y + 1] - 1].budget;
+               smp->interval_ns = sched[due[y]].interval_ns;
+               smp->missed = sched[due[y]].missed;
+               shard_push(&w->shard);
+               }
             }
-         } /* for */
-
-      // Calculate
-      if (online == 0){
-         if (g10 == 10) {
-            for (x = 0; x <= 3; x++){
-               mea[x].elapsed_gns10 = mea[x].elapsed_sum10 / 10;
-               mea[x].elapsed_sum10 = 0;
-
-               if (x == 0) snprintf(syslog_txt,79,"metObs avg10= %8.2f", mea[x].elapsed_gns10);
-               if (x == 1) snprintf(syslog_txt,79,"oceanObs avg10= %8.2f", mea[x].elapsed_gns10);
-               if (x == 2) snprintf(syslog_txt,79,"lightObs avg10= %8.2f", mea[x].elapsed_gns10);
-               if (x == 3) snprintf(syslog_txt,79,"climateObs avg10= %8.2f", mea[x].elapsed_gns10);
-               if (mea[x].elapsed_gns10 <= atoi(th[x].trs_warning))
-                  write_syslog(syslog_txt, 1);
-               else if (mea[x].elapsed_gns10 > atoi(th[x].trs_warning) && mea[x].elapsed_gns10 < atoi(th[x].trs_error))
-                  write_syslog(syslog_txt, 2);
-               else if (mea[x].elapsed_gns10 > atoi(th[x].trs_error))
-                  write_syslog(syslog_txt, 3);
-               if (x == 0) write_statlog("m10",trans_dato, mea[x].elapsed_gns10, mea[x].elapsed_low, mea[x].elapsed_high);
-               if (x == 1) write_statlog("o10",trans_dato, mea[x].elapsed_gns10, mea[x].elapsed_low, mea[x].elapsed_high);
-               if (x == 2) write_statlog("l10",trans_dato, mea[x].elapsed_gns10, mea[x].elapsed_low, mea[x].elapsed_high);
-               if (x == 3) write_statlog("c10",trans_dato, mea[x].elapsed_gns10, mea[x].elapsed_low, mea[x].elapsed_high);
-               } /* for */
-            g10 = 0;
-         } /* == 10 */
-
-         if (g100 == 100) {
-            for (x = 0; x <= 3; x++){
-               mea[x].elapsed_gns100 = mea[x].elapsed_sum100 / 100;
-               mea[x].elapsed_sum100 = 0;
-               if (x == 0) write_statlog("m100",trans_dato, mea[x].elapsed_gns100, mea[x].elapsed_low, mea[x].elapsed_high);
-               if (x == 1) write_statlog("o100",trans_dato, mea[x].elapsed_gns100, mea[x].elapsed_low, mea[x].elapsed_high);
-               if (x == 2) write_statlog("l100",trans_dato, mea[x].elapsed_gns100, mea[x].elapsed_low, mea[x].elapsed_high);
-               if (x == 3) write_statlog("c100",trans_dato, mea[x].elapsed_gns100, mea[x].elapsed_low, mea[x].elapsed_high);
-               } /* for */
-            g100 = 0;
-            } /* == 100 */
-
-         if (g1000 == 1000) {
-            for (x = 0; x <= 3; x++){
-               mea[x].elapsed_gns1000 = mea[x].elapsed_sum1000 / 1000;
-               mea[x].elapsed_sum1000 = 0;
-               if (x == 0) write_statlog("m1000",trans_dato, mea[x].elapsed_gns1000, mea[x].elapsed_low, mea[x].elapsed_high);
-               if (x == 1) write_statlog("o1000",trans_dato, mea[x].elapsed_gns1000, mea[x].elapsed_low, mea[x].elapsed_high);
-               if (x == 2) write_statlog("l1000",trans_dato, mea[x].elapsed_gns1000, mea[x].elapsed_low, mea[x].elapsed_high);
-               if (x == 3) write_statlog("c1000",trans_dato, mea[x].elapsed_gns1000, mea[x].elapsed_low, mea[x].elapsed_high);
-
-               // Reset low/high
-               mea[x].elapsed_low=1000;
-               mea[x].elapsed_high=0;
+         write(sample_fd, &one, sizeof(one));
+         continue;
+         }
+
+      // Pipelining: next [PIPELINE] stations of group in one round trip
+      if (atoi(pipeline) > 1 && group[x].count > 1){
+         depth = atoi(pipeline) < group[x].count ? atoi(pipeline) : group[x].count;
+         api_pipeline(w, x, depth);
+         sched_next(x, &w->pipe[depth - 1], depth);
+         for (n = 0; n < depth; n++){
+            smp = shard_slot(&w->shard);
+            if (smp == NULL){
+               atomic_fetch_add_explicit(&w->shard.dropped, 1, memory_order_relaxed);
+               continue;
                }
-            g1000 = 0;
+            memcpy(smp, &w->pipe[n], sizeof(struct sample));
+            smp->budget = w->pipe[depth - 1].budget;
+            smp->interval_ns = sched[x].interval_ns;
+            smp->missed = sched[x].missed;
+            shard_push(&w->shard);
+            }
+         write(sample_fd, &one, sizeof(one));
+         continue;
+         }
 
-            } /* == 1000 */
+      smp = shard_slot(&w->shard);
+      if (smp == NULL){
+         atomic_fetch_add_explicit(&w->shard.dropped, 1, memory_order_relaxed);
+         smp = &dropped;
+         }
 
-         g10++;
-         g100++;
-         g1000++;
-      } /* if online=0 */
-      current_time=time(NULL);
+      sample_init(smp, x, group[x].first + sched[x].station);
+      smp->online = api_request(w, smp->target, smp);
+      sched_next(x, smp, 1);
+      smp->interval_ns = sched[x].interval_ns;
+      smp->missed = sched[x].missed;
 
-      // View console & do html output
-      view_console();
-      html_output();
+      if (smp != &dropped){
+         shard_push(&w->shard);
+         write(sample_fd, &one, sizeof(one));
+         }
+      }
+   return NULL;
+   } /* worker_main */
+
+// Average for each 10, 100, 1000 requests to API
+void calc_stats(int api){
+   char syslog_txt[80], stat_code[60];
+   int a;
+
+   a = group[api].api;
+
+   if (mea[api].g10 == 10) {
+      mea[api].elapsed_gns10 = mea[api].elapsed_sum10 / 10;
+      mea[api].elapsed_sum10 = 0;
+
+      snprintf(syslog_txt,79,"%s avg10= %8.2f", group[api].name, mea[api].elapsed_gns10);
+      if (mea[api].elapsed_gns10 <= atoi(th[a].trs_warning))
+         write_syslog(syslog_txt, 1);
+      else if (mea[api].elapsed_gns10 > atoi(th[a].trs_warning) && mea[api].elapsed_gns10 < atoi(th[a].trs_error))
+         write_syslog(syslog_txt, 2);
+      else if (mea[api].elapsed_gns10 > atoi(th[a].trs_error))
+         write_syslog(syslog_txt, 3);
+      stat_name(stat_code, api, 10);
+      write_statlog(stat_code, trans_dato, mea[api].elapsed_gns10, mea[api].elapsed_low, mea[api].elapsed_high);
+      mea[api].g10 = 0;
+      } /* == 10 */
+
+   if (mea[api].g100 == 100) {
+      mea[api].elapsed_gns100 = mea[api].elapsed_sum100 / 100;
+      mea[api].elapsed_sum100 = 0;
+      stat_name(stat_code, api, 100);
+      write_statlog(stat_code, trans_dato, mea[api].elapsed_gns100, mea[api].elapsed_low, mea[api].elapsed_high);
+      mea[api].g100 = 0;
+      } /* == 100 */
+
+   if (mea[api].g1000 == 1000) {
+      mea[api].elapsed_gns1000 = mea[api].elapsed_sum1000 / 1000;
+      mea[api].elapsed_sum1000 = 0;
+      stat_name(stat_code, api, 1000);
+      write_statlog(stat_code, trans_dato, mea[api].elapsed_gns1000, mea[api].elapsed_low, mea[api].elapsed_high);
+
+      // Reset low/high
+      mea[api].elapsed_low=1000;
+      mea[api].elapsed_high=0;
+      mea[api].g1000 = 0;
+      } /* == 1000 */
+
+   mea[api].g10++;
+   mea[api].g100++;
+   mea[api].g1000++;
+   } /* calc_stats */
+
+// Statistics code eg. "m10" - "m10@staging" for further gateways
+void stat_name(char* stat_code, int api, int n){
+   if (gateway[group[api].gateway].name[0] == 0)
+      snprintf(stat_code, 60, "%c%i", endpoint[group[api].api].code, n);
+   else
+      snprintf(stat_code, 60, "%c%i@%s", endpoint[group[api].api].code, n, gateway[group[api].gateway].name);
+   } /* stat_name */
+
+// Load generation: open-loop requests at [LOAD_RATES] over [LOAD_CONNECTIONS] connections.
+// Request n is scheduled at start + n / rate, and latency is measured from that time - not from
+// when a connection became free - so queueing behind slow responses is not hidden (coordinated omission)
+int load_run(){
+   SSL_CTX* lctx;
+   struct load_conn* conn;
+   FILE* out;
+   char name[40], rates[80];
+   char* rate;
+   int x, api, nconn, duration;
+
+   // Group of [LOAD_API] on [IPHOST]
+   api = -1;
+   for (x = 0; x < num_groups; x++)
+      if (group[x].gateway == 0 && strcmp(load_api, endpoint[group[x].api].name) == 0) api = x;
+   nconn = atoi(load_connections);
+   duration = atoi(load_step_duration);
+   if (api < 0 || nconn < 1 || nconn > 1000 || duration < 1 || strlen(load_rates) == 0){
+      printf("DMIAPI: -load needs [LOAD_API], [LOAD_CONNECTIONS] (1-1000), [LOAD_RATES] and [LOAD_STEP_DURATION] - terminating\n");
+      write_syslog("Missing load parameters - terminating", 3);
+      return 3;
+      }
 
-      stations_count++;
-      if (stations_count == 17) stations_count=0;
+   lctx = SSL_CTX_new(SSLv23_client_method());
+   SSL_CTX_set_options(lctx, SSL_OP_NO_SSLv2);
+   conn = calloc(nconn, sizeof(struct load_conn));
+   for (x = 0; x < nconn; x++)
+      if (load_connect(lctx, &conn[x]) == 0){
+         printf("DMIAPI: Could not connect to %s - terminating\n", iphost);
+         return 3;
+         }
 
-      sleep(atoi(freq));
-   } /* while */
+   time(&file_current_time);
+   today = localtime(&file_current_time);
+   snprintf(name, 40, "%0d-%0d-%0d_dmiapi.load", today->tm_year+1900, today->tm_mon+1, today->tm_mday);
+   out = fopen(name, "a+");
+   if (out == NULL){
+      printf("DMIAPI: Could not open %s - terminating\n", name);
+      write_syslog("Could not open load result file - terminating", 3);
+      return 3;
+      }
+   write_syslog("Load generation started", 0);
+
+   strcpy(rates, load_rates);
+   rate = strtok(rates, ",");
+   while (rate != NULL){
+      if (atof(rate) > 0) load_step(lctx, conn, nconn, api, atof(rate), duration, out);
+      rate = strtok(NULL, ",");
+      }
 
+   fclose(out);
+   for (x = 0; x < nconn; x++){
+      if (conn[x].ssl != NULL) SSL_free(conn[x].ssl);
+      if (conn[x].fd > 0) close(conn[x].fd);
+      }
+   free(conn);
+   SSL_CTX_free(lctx);
+   write_syslog("Load generation ended", 0);
    return 0;
-   } /* main */
+   } /* load_run */
+
+// Run one rate step and write histograms
+int load_step(SSL_CTX* lctx, struct load_conn* conn, int nconn, int api, double rate, int duration, FILE* out){
+   struct histogram* corrected;
+   struct histogram* service;
+   struct pollfd* pfd;
+   struct timespec timeout;
+   int64_t start, now, next, wait;
+   long total, k, completed, errors;
+   int x, n, rc, idle, live;
+   char timestamp[40];
+
+   corrected = calloc(1, sizeof(struct histogram));
+   service = calloc(1, sizeof(struct histogram));
+   pfd = calloc(nconn, sizeof(struct pollfd));
+
+   // Reopen closed connections before the step - SSL_connect blocks and would delay scheduled requests
+   for (x = 0; x < nconn; x++)
+      if (conn[x].ssl == NULL) load_connect(lctx, &conn[x]);
+
+   total = (long)(rate * duration);
+   k = completed = errors = 0;
+   start = mono_ns() + 10000000LL;
+
+   while (completed + errors < total){
+      now = mono_ns();
+
+      // Drain limit: stop 30 s after the last scheduled request
+      if (now > start + (int64_t)duration * 1000000000LL + 30000000000LL) break;
+
+      // Start due requests on idle connections
+      for (x = 0; x < nconn && k < total; x++){
+         next = start + (int64_t)(k * 1e9 / rate);
+         if (next > now) break;
+         if (conn[x].busy || conn[x].ssl == NULL) continue;
+         conn[x].req = &target.req[group[api].first + k % group[api].count];
+         conn[x].req_off = 0;
+         conn[x].intended_ns = next;
+         conn[x].sent_ns = now;
+         conn[x].busy = 1;
+         conn[x].want = POLLOUT;
+         http_parser_init(&conn[x].hp, NULL, 0);
+         k++;
+         }
 
-// Get and interpret data
-int api_request(char* api, char* station_id){
-   int x, y, z, read_block, http_ok, rc, rc2;
-   int api_type = 0; // 0=metObs,1=oceanObs,2=lightObs,3=climateObs
-   int http_ret;
-   long int length, length_sofar, header_length, ssl_error;
-   
-   char sendtoserver[512] = {0};
-   char server_reply[MAX_BUF] = {0};
-   char server_reply2[MAX_BUF] = {0};
-   char trans_data[MAX_BUF] = {0};
-   char trans_data2[MAX_BUF] = {0};;
-   
-   char http_ret_code[5] = {0};
-   char syslog_str[80] = {0};
+      // Wait for i/o or next scheduled request
+      n = 0;
+      idle = live = 0;
+      for (x = 0; x < nconn; x++){
+         if (conn[x].ssl == NULL) continue;
+         live++;
+         if (!conn[x].busy){
+            idle = 1;
+            continue;
+            }
+         pfd[n].fd = conn[x].fd;
+         pfd[n].events = conn[x].want;
+         pfd[n].revents = 0;
+         n++;
+         }
 
-   // Create socket
-   online = init_com();
-   if (TCPIPDEBUG) write_syslog("Efter init_com",5);
-
-   sendtoserver[0]=0;
-   if (strcmp(api,"metObsAPI") == 0){ 
-      api_type=0;
-      strcpy(sendtoserver,"GET /v2/metObs/collections/observation/items?period=latest&parameterId=temp_dry");
-      strcat(sendtoserver,"&api-key=");
-      strcat(sendtoserver,key_metobs);
-      strcat(sendtoserver,"&stationId=");
-      strcat(sendtoserver,station_id);
-      strcat(sendtoserver," HTTP/1.1\r\nHost:dmigw.govcloud.dk\r\nAccept: application/json\r\n\r\n");
-      }
-   if (strcmp(api,"oceanObsAPI") == 0){
-      api_type=1;
-      strcpy(sendtoserver,"GET /v2/oceanObs/collections/observation/items?parameterId=sealev_dvr&period=latest&api-key=");
-      strcat(sendtoserver,key_oceanobs);
-      strcat(sendtoserver,"&stationId=");
-      strcat(sendtoserver,station_id);
-      strcat(sendtoserver," HTTP/1.1\r\nHost:dmigw.govcloud.dk\r\nAccept: application/json\r\n\r\n");
-      }
-   if (strcmp(api,"lightObsAPI") == 0){
-      api_type=2;
-      strcpy(sendtoserver,"GET /v2/lightningdata/collections/observation/items?");
-      strcat(sendtoserver,"&period=latest&api-key=");
-      strcat(sendtoserver,key_lightobs);
-      strcat(sendtoserver," HTTP/1.1\r\nHost:dmigw.govcloud.dk\r\nAccept: application/json\r\n\r\n");
-      }
-   if (strcmp(api,"climateObsAPI") == 0){
-      api_type=3;
-      strcpy(sendtoserver,"GET /v2/climateData/collections/stationValue/items?");
-      strcat(sendtoserver,"&parameterId=mean_temp&limit=1&stationId=");
-      strcat(sendtoserver,station_id);
-      strcat(sendtoserver,"&api-key=");
-      strcat(sendtoserver,key_climateobs);
-      strcat(sendtoserver," HTTP/1.1\r\nHost:dmigw.govcloud.dk\r\nAccept: application/json\r\n\r\n");
-      }
-
-   gettimeofday(&t0, 0); // Measure t0
-
-   // Send data to server
-   if (HTTPLOGGING) http_log("[TCPIP Send]%s[EOS]\n", sendtoserver);
-   rc = SSL_write(ssl, sendtoserver, strlen(sendtoserver));
-   if (rc == 0){
-      snprintf(syslog_str, 600, "SSLwrite rc=0");
-      http_log("[api_meta]", syslog_str);
-      close_com();
-      return 2;
+      // No open connection left in this step: due requests fail
+      if (live == 0){
+         idle = 1;
+         now = mono_ns();
+         while (k < total && start + (int64_t)(k * 1e9 / rate) <= now){
+            errors++;
+            k++;
+            }
+         if (k == total) continue;
+         }
+      wait = 100000000LL;
+      if (k < total && idle){
+         wait = start + (int64_t)(k * 1e9 / rate) - mono_ns();
+         if (wait < 0) wait = 0;
+         }
+      timeout.tv_sec = wait / 1000000000LL;
+      timeout.tv_nsec = wait % 1000000000LL;
+      ppoll(pfd, n, &timeout, NULL);
+
+      // Service connections - SSL may hold decrypted data, so all busy connections are tried
+      for (x = 0; x < nconn; x++){
+         if (!conn[x].busy) continue;
+         rc = load_service(&conn[x]);
+         if (rc == 0) continue;
+         now = mono_ns();
+         conn[x].busy = 0;
+         if (rc > 0 && conn[x].hp.status == 200){
+            hist_add(corrected, (now - conn[x].intended_ns) / 1000);
+            hist_add(service, (now - conn[x].sent_ns) / 1000);
+            completed++;
+            }
+         else
+            errors++;
+
+         // Connection closed by server or broken
+         if (rc != 1){
+            SSL_free(conn[x].ssl);
+            close(conn[x].fd);
+            conn[x].ssl = NULL;
+            conn[x].fd = 0;
+            }
+         }
+      } /* while */
+
+   // Requests not sent or not answered at the drain limit are errors
+   if (completed + errors < total) errors = total - completed;
+
+   // Report
+   time(&file_current_time);
+   strftime(timestamp, 40, "%d %b %Y %H:%M:%S GMT", gmtime(&file_current_time));
+   fprintf(out, "%s,%s,rate=%.1f,conn=%i,sent=%li,ok=%li,errors=%li,achieved=%.1f\n", timestamp, group[api].name, rate, nconn, k, completed, errors,
+      (double)completed / ((mono_ns() - start) / 1e9));
+   fprintf(out, "  corrected (ms) p50=%.2f p90=%.2f p99=%.2f p99.9=%.2f max=%.2f\n", hist_percentile(corrected, 50) / 1e3,
+      hist_percentile(corrected, 90) / 1e3, hist_percentile(corrected, 99) / 1e3, hist_percentile(corrected, 99.9) / 1e3, corrected->max / 1e3);
+   fprintf(out, "  service   (ms) p50=%.2f p90=%.2f p99=%.2f p99.9=%.2f max=%.2f\n", hist_percentile(service, 50) / 1e3,
+      hist_percentile(service, 90) / 1e3, hist_percentile(service, 99) / 1e3, hist_percentile(service, 99.9) / 1e3, service->max / 1e3);
+   fprintf(out, "  histogram corrected: [bucket ms] count\n");
+   for (x = 0; x < HIST_BUCKETS; x++)
+      if (corrected->count[x] > 0) fprintf(out, "  %10.3f %li\n", hist_value(x) / 1e3, corrected->count[x]);
+   fflush(out);
+
+   printf("%s rate=%6.1f/s ok=%li errors=%li  p50=%.2f p99=%.2f p99.9=%.2f max=%.2f ms (service p99=%.2f ms)\n", group[api].name, rate, completed, errors,
+      hist_percentile(corrected, 50) / 1e3, hist_percentile(corrected, 99) / 1e3, hist_percentile(corrected, 99.9) / 1e3, corrected->max / 1e3,
+      hist_percentile(service, 99) / 1e3);
+
+   // Connections with outstanding responses are not reused in next step
+   for (x = 0; x < nconn; x++)
+      if (conn[x].busy && conn[x].ssl != NULL){
+         SSL_free(conn[x].ssl);
+         close(conn[x].fd);
+         conn[x].ssl = NULL;
+         conn[x].fd = 0;
+         conn[x].busy = 0;
+         }
+
+   free(corrected);
+   free(service);
+   free(pfd);
+   return 0;
+   } /* load_step */
+
+// Open keep-alive connection for load generation
+int load_connect(SSL_CTX* lctx, struct load_conn* c){
+   c->fd = create_socket(gateway[0].url, NULL, NULL);
+   if (c->fd == 0) return 0;
+   c->ssl = SSL_new(lctx);
+   SSL_set_fd(c->ssl, c->fd);
+   if (SSL_connect(c->ssl) != 1){
+      SSL_free(c->ssl);
+      close(c->fd);
+      c->ssl = NULL;
+      c->fd = 0;
+      return 0;
+      }
+   fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+   c->busy = 0;
+   return 1;
+   } /* load_connect */
+
+// Progress request on connection - returns 0 if in progress, 1 when response is read,
+// 2 when response is read and connection is closed by server, -1 on error
+int load_service(struct load_conn* c){
+   char buf[16384];
+   int rc, err;
+
+   while (c->req_off < c->req->iov_len){
+      rc = SSL_write(c->ssl, (char*)c->req->iov_base + c->req_off, c->req->iov_len - c->req_off);
+      if (rc <= 0){
+         err = SSL_get_error(c->ssl, rc);
+         if (err == SSL_ERROR_WANT_WRITE) { c->want = POLLOUT; return 0; }
+         if (err == SSL_ERROR_WANT_READ) { c->want = POLLIN; return 0; }
+         return -1;
+         }
+      c->req_off = c->req_off + rc;
       }
 
-   // Read from server
-   server_reply2[0] = 0;
-   rc2 = 2048; //First packetsize
-   read_block = 0;
    do {
-      server_reply[0] = 0;
-      if (read_block == 0){ // First packet - get length from header
-          rc = SSL_read(ssl, server_reply, rc2);
-          if (rc >= 0)
-             server_reply[rc] = 0;
-          else {
-             server_reply[0] = 0;
-             break;
-             }
-          strcat(server_reply2, server_reply);
-          length = get_length(server_reply);
-
-          if (HTTPLOGGING) {
-             snprintf(syslog_str, 600, "[Length]%i[bytes]", length);
-             http_log("[api_meta]", syslog_str);
-             }
-
-          if (length == 0 || length >= MAX_BUF-2){ // Message > MAX_BUF
-             server_reply[0] = 0;
-             break;
-             }
-
-          // Length of header
-          header_length = 0;
-          y = 0;
-          while (y < strlen(server_reply)){
-             if (server_reply[y] == 0x0d && server_reply[y + 1] == 0x0a &&
-                server_reply[y + 2] == 0x0d && server_reply[y + 3] == 0x0a){
-                header_length = y;
-                break;
-                }
-             y++;
-             }
-   
-          read_block = 1; // Next chunk
-         // Does end of packet contain a 0? (=end of transmission)
-         x = strlen(server_reply);
-         if (server_reply[x - 5] == '0')
-            break;
-          }
-      else {
-         server_reply[0] = 0;
-         rc = SSL_read(ssl, server_reply, 2048);
-         if (rc > 0)
-            server_reply[rc] = 0;
-         else{
-            server_reply[0] = 0;
+      rc = SSL_read(c->ssl, buf, sizeof(buf));
+      if (rc <= 0){
+         err = SSL_get_error(c->ssl, rc);
+         if (err == SSL_ERROR_WANT_READ) { c->want = POLLIN; return 0; }
+         if (err == SSL_ERROR_WANT_WRITE) { c->want = POLLOUT; return 0; }
+         if (c->hp.state == HP_BODY_EOF) return 2;
+         return -1;
+         }
+      http_parse(&c->hp, buf, rc);
+      } while (c->hp.state != HP_DONE && c->hp.state != HP_ERROR);
+
+   if (c->hp.state == HP_ERROR) return -1;
+   if (http_header(&c->hp, "connection", buf, 80) && strcasecmp(buf, "close") == 0) return 2;
+   return 1;
+   } /* load_service */
+
+// Bulk download (-bulk): [BULK_FROM]..[BULK_TO] is split in time ranges of [BULK_PARTITION] hours.
+// [BULK_CONNECTIONS] threads take one range at a time and follow its "next" links page by page.
+// A page is parsed while received, and its features are written as NDJSON to one file for each
+// range. After each page the file size & next link are appended to the state file, so a restart
+// continues where it stopped - a range with next link "-" is complete
+int bulk_run(){
+   pthread_t* threads;
+   struct tm tm;
+   FILE* f;
+   char line[1200], next[1024];
+   int64_t start, now;
+   long offset, features, wire, prev;
+   int x, n, nconn, hours, done, started;
+   time_t from, to;
+
+   api_bulk = -1;
+   for (x = 0; x < num_apis; x++)
+      if (strcmp(bulk_api, endpoint[x].name) == 0) api_bulk = x;
+   nconn = strlen(bulk_connections) > 0 ? atoi(bulk_connections) : 4;
+   hours = strlen(bulk_partition) > 0 ? atoi(bulk_partition) : 24;
+   memset(&tm, 0, sizeof(tm));
+   from = strptime(bulk_from, "%Y-%m-%dT%H:%M:%S", &tm) != NULL ? timegm(&tm) : 0;
+   memset(&tm, 0, sizeof(tm));
+   to = strptime(bulk_to, "%Y-%m-%dT%H:%M:%S", &tm) != NULL ? timegm(&tm) : 0;
+   if (api_bulk < 0 || strlen(bulk_path) == 0 || nconn < 1 || nconn > 64 || hours < 1 ||
+      (strstr(bulk_path, "{DATETIME}") != NULL && (from == 0 || to <= from))){
+      printf("DMIAPI: -bulk needs [BULK_API], [BULK_PATH], [BULK_FROM] < [BULK_TO] (eg. 2024-01-01T00:00:00Z), [BULK_PARTITION] >= 1 and [BULK_CONNECTIONS] (1-64) - terminating\n");
+      write_syslog("Missing bulk parameters - terminating", 3);
+      return 3;
+      }
+   if (strlen(bulk_dir) == 0) strcpy(bulk_dir, ".");
+   strcpy(http2, "0"); // Pages are read one by one on each connection
+
+   // Time ranges - one range if the query has no {DATETIME}
+   bulk.count = strstr(bulk_path, "{DATETIME}") != NULL ? (to - from + hours * 3600 - 1) / (hours * 3600) : 1;
+   bulk.range = calloc(bulk.count, sizeof(struct bulk_range));
+   for (x = 0; x < bulk.count; x++){
+      bulk.range[x].from = from + (time_t)x * hours * 3600;
+      bulk.range[x].to = bulk.range[x].from + hours * 3600;
+      if (bulk.range[x].to > to) bulk.range[x].to = to;
+      }
+
+   // Resume - latest line of each range in state file
+   snprintf(line, sizeof(line), "%s/%s.bulk", bulk_dir, endpoint[api_bulk].name);
+   f = fopen(line, "r");
+   while (f != NULL && fgets(line, sizeof(line), f) != NULL)
+      if (sscanf(line, "%i %li %li %1023s", &n, &offset, &features, next) == 4 && n >= 0 && n < bulk.count){
+         bulk.range[n].offset = offset;
+         bulk.range[n].features = features;
+         free(bulk.range[n].next); // Earlier line of the range
+         bulk.range[n].next = strcmp(next, "-") == 0 ? NULL : strdup(next);
+         bulk.range[n].done = strcmp(next, "-") == 0;
+         bulk.range[n].resume = 1;
+         }
+   if (f != NULL) fclose(f);
+   snprintf(line, sizeof(line), "%s/%s.bulk", bulk_dir, endpoint[api_bulk].name);
+   bulk.state = fopen(line, "a");
+   if (bulk.state == NULL){
+      printf("DMIAPI: Could not open %s - terminating\n", line);
+      return 3;
+      }
+   for (x = 0, done = 0; x < bulk.count; x++)
+      if (bulk.range[x].done) done++;
+   write_syslog("Bulk download started", 0);
+   printf("%s: %i time ranges, %i already done, %i connections\n", endpoint[api_bulk].name, bulk.count, done, nconn);
+
+   // Progress waits for the threads that started
+   threads = calloc(nconn, sizeof(pthread_t));
+   for (x = 0, started = 0; x < nconn; x++)
+      if (pthread_create(&threads[started], NULL, bulk_main, NULL) == 0) started++;
+   if (started == 0){
+      printf("DMIAPI: Could not start bulk threads - terminating\n");
+      write_syslog("Could not start bulk threads - terminating", 3);
+      return 3;
+      }
+   if (started < nconn) write_syslog("Bulk: not all connections could start a thread", 2);
+
+   // Progress every second
+   start = mono_ns();
+   prev = 0;
+   while (atomic_load(&bulk.finished) < started){
+      sleep(1);
+      now = mono_ns();
+      wire = atomic_load(&bulk.wire);
+      printf("%s: %i/%i ranges, %li pages, %li features, %.1f MB, %.2f MB/s, %.0f features/s\n", endpoint[api_bulk].name,
+         (int)atomic_load(&bulk.ranges_done) + done, bulk.count, atomic_load(&bulk.pages), atomic_load(&bulk.features),
+         wire / 1e6, (wire - prev) / 1e6, atomic_load(&bulk.features) / ((now - start) / 1e9));
+      prev = wire;
+      }
+   for (x = 0; x < started; x++)
+      pthread_join(threads[x], NULL);
+
+   now = mono_ns();
+   snprintf(line, sizeof(line), "Bulk download ended: %li features, %.1f MB (%.1f MB decoded) in %.1f s, %.2f MB/s, %.0f features/s, %li errors",
+      atomic_load(&bulk.features), atomic_load(&bulk.wire) / 1e6, atomic_load(&bulk.body) / 1e6, (now - start) / 1e9,
+      atomic_load(&bulk.wire) / 1e6 / ((now - start) / 1e9), atomic_load(&bulk.features) / ((now - start) / 1e9), atomic_load(&bulk.errors));
+   printf("%s\n", line);
+   write_syslog(line, atomic_load(&bulk.errors) > 0 ? 2 : 0);
+   fclose(bulk.state);
+   free(threads);
+   return atomic_load(&bulk.errors) > 0 ? 1 : 0;
+   } /* bulk_run */
+
+// Bulk thread - own connection & parser, takes the next time range until all are taken
+void* bulk_main(void* arg){
+   struct conn_record conn;
+   struct http_parser* hp;
+   struct json_tokener* tok;
+   struct bulk_range* r;
+   struct json_object *features, *links, *link, *rel;
+   FILE* out;
+   char name[600], path[1024], request[REQ_SIZE], server_reply[16384];
+   char from_str[24], to_str[24];
+   const char* href;
+   int x, i, n, rc, len, attempt, reused;
+   long count;
+   struct tm tm;
+
+   memset(&conn, 0, sizeof(conn));
+   hp = calloc(1, sizeof(struct http_parser));
+   tok = json_tokener_new();
+
+   while ((x = atomic_fetch_add(&bulk.taken, 1)) < bulk.count){
+      r = &bulk.range[x];
+      if (r->done) continue;
+
+      strftime(from_str, sizeof(from_str), "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&r->from, &tm));
+      strftime(to_str, sizeof(to_str), "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&r->to, &tm));
+      snprintf(name, sizeof(name), "%s/%s_%.13s.ndjson", bulk_dir, endpoint[api_bulk].name, from_str);
+      out = fopen(name, r->resume ? "r+" : "w");
+      if (out == NULL) out = fopen(name, "w");
+      if (out == NULL){
+         snprintf(path, sizeof(path), "Bulk: could not open %s", name);
+         write_syslog(path, 2);
+         atomic_fetch_add(&bulk.errors, 1);
+         continue;
+         }
+      // Drop a page written after the latest state line
+      if (r->resume){
+         ftruncate(fileno(out), r->offset);
+         fseek(out, r->offset, SEEK_SET);
+         }
+
+      // First page from [BULK_PATH] - then the next links
+      if (r->next != NULL)
+         snprintf(path, sizeof(path), "%s", r->next);
+      else
+         bulk_path_build(path, sizeof(path), from_str, to_str);
+
+      while (path[0] != 0){
+         len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost:%s\r\nAccept: application/geo+json\r\n%s\r\n", path,
+            gateway[0].httphost, atoi(compression) == 1 ? "Accept-Encoding: gzip, br\r\n" : "");
+
+         // Page - a kept-alive connection may have been closed by the gateway, and a failed page is tried 3 times
+         // with 1 and 2 s between the attempts
+         for (attempt = 0; attempt < 3; attempt++){
+            if (attempt > 0) sleep(attempt);
+            reused = conn.ssl != NULL;
+            http_parser_init(hp, NULL, 0);
+            if (!reused && init_com(&conn) != 1) continue;
+            json_tokener_reset(tok);
+            hp->tok = tok;
+            rc = SSL_write(conn.ssl, request, len);
+            while (rc > 0 && hp->state != HP_DONE && hp->state != HP_ERROR){
+               rc = SSL_read(conn.ssl, server_reply, sizeof(server_reply));
+               if (rc > 0) http_parse(hp, server_reply, rc);
+               }
+            if (hp->state == HP_BODY_EOF) hp->state = HP_DONE;
+            if (hp->state != HP_DONE || (http_header(hp, "connection", server_reply, 80) && strcasecmp(server_reply, "close") == 0))
+               close_com(&conn);
+            atomic_fetch_add(&bulk.wire, hp->wire_len);
+            atomic_fetch_add(&bulk.body, hp->body_len);
+            if (hp->state == HP_DONE && hp->status == 200 && hp->json != NULL) break;
+            if (hp->json != NULL) json_object_put(hp->json);
+            hp->json = NULL;
+            if (reused && hp->wire_len == 0) attempt--; // Closed keep-alive connection
+            }
+         if (attempt == 3){
+            snprintf(server_reply, 80, "Bulk: %s %.13s failed (http %i)", endpoint[api_bulk].name, from_str, hp->status);
+            write_syslog(server_reply, 2);
+            atomic_fetch_add(&bulk.errors, 1);
             break;
             }
 
-         length = get_length(server_reply);
+         // Features as NDJSON
+         count = 0;
+         features = json_path(hp->json, "features");
+         n = features != NULL ? json_object_array_length(features) : 0;
+         for (i = 0; i < n; i++){
+            fputs(json_object_to_json_string_ext(json_object_array_get_idx(features, i), JSON_C_TO_STRING_PLAIN), out);
+            fputc('\n', out);
+            count++;
+            }
+         fflush(out);
+
+         // OGC API next link - absolute URL or path
+         path[0] = 0;
+         links = json_path(hp->json, "links");
+         for (i = 0; n > 0 && links != NULL && i < json_object_array_length(links); i++){
+            link = json_object_array_get_idx(links, i);
+            if (json_object_object_get_ex(link, "rel", &rel) && strcmp(json_object_get_string(rel), "next") == 0 &&
+               (href = json_object_get_string(json_path(link, "href"))) != NULL){
+               if (strncmp(href, "https://", 8) == 0 || strncmp(href, "http://", 7) == 0)
+                  href = strchr(strstr(href, "://") + 3, '/');
+               if (href != NULL) snprintf(path, sizeof(path), "%s", href);
+               }
+            }
+         json_object_put(hp->json);
+         hp->json = NULL;
+
+         r->features = r->features + count;
+         atomic_fetch_add(&bulk.features, count);
+         atomic_fetch_add(&bulk.pages, 1);
+         pthread_mutex_lock(&bulk.lock);
+         fprintf(bulk.state, "%i %li %li %s\n", (int)(r - bulk.range), ftell(out), r->features, path[0] != 0 ? path : "-");
+         fflush(bulk.state);
+         pthread_mutex_unlock(&bulk.lock);
+         }
+      if (path[0] == 0) atomic_fetch_add(&bulk.ranges_done, 1);
+      fclose(out);
+      }
 
-         if ((strlen(server_reply2) + strlen(server_reply)) > MAX_BUF-2){
-            snprintf(syslog_str,79,"Object to big - skipped"); // Message > MAX_BUF
-            write_syslog(syslog_str, 2);
-            close_com();
-            return 3;
+   close_com(&conn);
+   json_tokener_free(tok);
+   free(hp);
+   atomic_fetch_add(&bulk.finished, 1);
+   return NULL;
+   } /* bulk_main */
+
+// First page of a time range - {KEY} & {DATETIME} (from/to) in [BULK_PATH] are replaced
+void bulk_path_build(char* path, int size, char* from, char* to){
+   char* t;
+   int len;
+
+   len = 0;
+   for (t = bulk_path; *t != 0 && len < size - 100; ){
+      if (strncmp(t, "{KEY}", 5) == 0){
+         len += snprintf(path + len, size - len, "%s", endpoint[api_bulk].key);
+         t = t + 5;
+         }
+      else if (strncmp(t, "{DATETIME}", 10) == 0){
+         len += snprintf(path + len, size - len, "%s/%s", from, to);
+         t = t + 10;
+         }
+      else
+         path[len++] = *t++;
+      }
+   path[len] = 0;
+   } /* bulk_path_build */
+
+// Get and interpret data - result is returned in smp
+int api_request(struct worker* w, int t, struct sample* smp){
+   int rc, attempt, reused;
+   long ssl_error;
+   struct stamp t0, t1, t_first;
+   struct http_parser* hp;
+   struct conn_record* conn;
+   char server_reply[16384];
+   char req[REQ_SIZE];
+   char value[80] = {0};
+   char syslog_str[80] = {0};
+   int len;
+
+   memset(&t1, 0, sizeof(t1));
+   memset(&t_first, 0, sizeof(t_first));
+   hp = &w->hp;
+   len = request_get(t, req);
+   conn = &w->conn[target.gateway[t]];
+
+   // A kept-alive connection may have been closed by the gateway - then try once more on a new connection
+   for (attempt = 0; attempt < 2; attempt++){
+      // Create socket
+      reused = conn->ssl != NULL;
+      if (!reused && init_com(conn) != 1){
+         trace_conn(conn, smp);
+         return 1;
+         }
+      if (TCPIPDEBUG) write_syslog("Efter init_com",5);
+
+      stamp_send(conn, &t0); // Measure t0
+
+      // Send data to server
+      if (HTTPLOGGING) http_log("[TCPIP Send]%s[EOS]\n", req);
+      rc = SSL_write(conn->ssl, req, len);
+      if (rc <= 0){
+         close_com(conn);
+         if (reused) continue;
+         snprintf(syslog_str, 79, "SSLwrite rc=%i", rc);
+         http_log("[api_meta]", syslog_str);
+         return 2;
+         }
+      trace_send(conn, smp, 1, &t0);
+      capture_begin(w, smp, 1, &t0);
+
+      // Read from server until response is complete. A batch response is parsed while it is received
+      http_parser_init(hp, w->body, MAX_BODY);
+      if (target.station[t] == TARGET_BATCH){
+         json_tokener_reset(w->tok);
+         hp->tok = w->tok;
+         }
+      do {
+         rc = SSL_read(conn->ssl, server_reply, sizeof(server_reply));
+         if (rc <= 0) break;
+         capture_read(w, server_reply, rc);
+         if (hp->wire_len == 0) stamp_recv(conn, &t_first);
+         http_parse(hp, server_reply, rc);
+         } while (hp->state != HP_DONE && hp->state != HP_ERROR);
+      stamp_recv(conn, &t1); // Measure t1
+      if (rc <= 0 && hp->wire_len == 0 && reused){
+         close_com(conn);
+         continue;
+         }
+      if (hp->json != NULL && hp->state != HP_DONE && hp->state != HP_BODY_EOF){
+         json_object_put(hp->json);
+         hp->json = NULL;
+         }
+      break;
+      }
+   if (rc < 0){
+      switch(ssl_error = SSL_get_error(conn->ssl, rc)){
+         case SSL_ERROR_NONE:
+            if (TCPIPDEBUG) write_syslog("SSL_ERROR_NONE", 1);
+            break;
+         case SSL_ERROR_WANT_READ:
+            if (TCPIPDEBUG) write_syslog("SSL_WANT_READ", 2);
+            break;
+         case SSL_ERROR_ZERO_RETURN:
+            if (TCPIPDEBUG) write_syslog("SSL_ZERO_RETURN", 2);
+            break;
+         case SSL_ERROR_SYSCALL:
+            if (TCPIPDEBUG) write_syslog("SSL_ERROR_SYSCALL", 3);
+            break;
+         case SSL_ERROR_WANT_WRITE:
+            if (TCPIPDEBUG) write_syslog("SSL_ERROR_WANT_WRITE", 2);
+            break;
+         default:
+            if (TCPIPDEBUG) write_syslog("UNKNOWN SSL_get_error", 3);
+         }
+      }
+   if (hp->state == HP_BODY_EOF) hp->state = HP_DONE; // Body ended by close
+
+   capture_end(w);
+   tcp_read(conn, smp);
+
+   // Keep connection only if response was read completely
+   if (atoi(keepalive) == 0 || conn->ssl == NULL || hp->state != HP_DONE ||
+      (http_header(hp, "connection", value, sizeof(value)) && strcasecmp(value, "close") == 0))
+      close_com(conn);
+   if (HTTPLOGGING) http_log("[HTML Received]%s[EOS]", hp->header);
+
+   smp->elapsed_ns = stamp_ns(&t0, &t1);
+   smp->elapsed = smp->elapsed_ns / 1e6;
+   if (hp->wire_len > 0){
+      smp->first_byte_ns = stamp_ns(&t0, &t_first);
+      smp->first_byte = smp->first_byte_ns / 1e6;
+      }
+   return api_response(hp, t, smp);
+   } /* api_request */
+
+// Sample for request to target t of group api
+void sample_init(struct sample* smp, int api, int t){
+   smp->api = api;
+   smp->target = t;
+   smp->station = target.station[t] == TARGET_BATCH ? 0 : target.station[t];
+   smp->online = 0;
+   smp->http_ret = 0;
+   smp->returncode = 999;
+   smp->elapsed = 0;
+   smp->first_byte = 0;
+   smp->elapsed_ns = 0;
+   smp->first_byte_ns = 0;
+   memset(&smp->tcp, 0, sizeof(smp->tcp));
+   memset(&smp->trace, 0, sizeof(smp->trace));
+   smp->wire_bytes = 0;
+   smp->body_bytes = 0;
+   smp->trans_date[0] = 0;
+   smp->observation[0] = 0;
+   strcpy(smp->trans_id, "No Transactioncode");
+   smp->num_values = 0;
+   smp->budget = 0;
+   } /* sample_init */
+
+// Pipelined requests to group api: requests for the next depth stations are written back to back
+// in one write on one connection, and the responses are read in order. First byte & completion of
+// each response are measured from the write. Samples are returned in w->pipe
+int api_pipeline(struct worker* w, int api, int depth){
+   struct conn_record* conn;
+   struct http_parser* hp;
+   struct stamp t0, t_read, t_first;
+   char server_reply[16384];
+   char syslog_str[80] = {0};
+   int n, t, rc, len, off, attempt, reused;
+
+   hp = &w->hp;
+   conn = &w->conn[group[api].gateway];
+   len = 0;
+   for (n = 0; n < depth; n++){
+      t = group[api].first + (sched[api].station + n) % group[api].count;
+      sample_init(&w->pipe[n], api, t);
+      w->pipe[n].online = -1; // No response
+      len = len + request_get(t, w->pipe_req + len);
+      }
+
+   // A kept-alive connection may have been closed by the gateway - then try once more on a new connection
+   n = 0;
+   for (attempt = 0; attempt < 2; attempt++){
+      reused = conn->ssl != NULL;
+      if (!reused && init_com(conn) != 1){
+         for (n = 0; n < depth; n++) w->pipe[n].online = 1;
+         trace_conn(conn, &w->pipe[0]);
+         return 0;
+         }
+
+      stamp_send(conn, &t0);
+      rc = SSL_write(conn->ssl, w->pipe_req, len);
+      if (rc <= 0){
+         close_com(conn);
+         if (reused) continue;
+         for (n = 0; n < depth; n++) w->pipe[n].online = 2;
+         return 0;
+         }
+      trace_send(conn, w->pipe, depth, &t0);
+      capture_begin(w, w->pipe, depth, &t0);
+
+      // Responses in order. Bytes after the end of one response belong to the next
+      http_parser_init(hp, w->body, MAX_BODY);
+      while (n < depth){
+         rc = SSL_read(conn->ssl, server_reply, sizeof(server_reply));
+         stamp_recv(conn, &t_read);
+         if (rc > 0) capture_read(w, server_reply, rc);
+         if (rc <= 0){
+            // Body ended by close
+            if (hp->state == HP_BODY_EOF){
+               hp->state = HP_DONE;
+               sample_time(&w->pipe[n], &t0, &t_first, &t_read);
+               w->pipe[n].online = api_response(hp, w->pipe[n].target, &w->pipe[n]);
+               n++;
+               }
+            break;
+            }
+         off = 0;
+         while (off < rc && n < depth){
+            if (hp->wire_len == 0) t_first = t_read;
+            off = off + http_parse(hp, server_reply + off, rc - off);
+            if (hp->state == HP_DONE || hp->state == HP_ERROR){
+               sample_time(&w->pipe[n], &t0, &t_first, &t_read);
+               w->pipe[n].online = api_response(hp, w->pipe[n].target, &w->pipe[n]);
+               n++;
+               if (hp->state == HP_ERROR) break;
+               http_parser_init(hp, w->body, MAX_BODY);
+               }
             }
+         if (hp->state == HP_ERROR) break;
+         }
+      if (n == 0 && hp->wire_len == 0 && reused){
+         close_com(conn);
+         continue;
+         }
+      break;
+      }
 
-         // Where does data start? 
-         x = 0;
-         while (x < strlen(server_reply)){
-           if (server_reply[x] == 0x0d && server_reply[x + 1] == 0x0a){ 
-              y = x;
-              break;
-              }
-            x++;
-            } /* while */
-
-         // Copy from offset
-         x = x + 2;
-         y = 0;
-         z = strlen(server_reply2) - 2;
-         while (server_reply[y + x] != 0){
-            server_reply2[z] = server_reply[y + x]; 
-            server_reply2[z + 1] = 0;
-            y++;
-            z++;
+   // Gateway did not answer all requests - connection can not be used any more
+   if (n < depth){
+      snprintf(syslog_str, 79, "%s pipeline: %i of %i responses", group[api].name, n, depth);
+      write_syslog(syslog_str, 2);
+      }
+   capture_end(w);
+   for (t = 0; t < n; t++)
+      tcp_read(conn, &w->pipe[t]);
+   if (n < depth || atoi(keepalive) == 0 || hp->state == HP_ERROR) close_com(conn);
+   return n;
+   } /* api_pipeline */
+
+// HTTP/2: samples w->pipe[0..count-1] are requested as streams on one connection to gateway gw.
+// Each stream is timed from the write of the requests to its first frame & to its end.
+// Returns -1 if the gateway did not negotiate h2 - then the caller uses HTTP/1.1
+int api_h2(struct worker* w, int gw, int count){
+   struct conn_record* conn;
+   struct h2_stream* st;
+   struct stamp t0;
+   nghttp2_nv nv[8];
+   char server_reply[16384];
+   char syslog_str[80] = {0};
+   char *path, *end;
+   int n, t, rc, attempt, reused, open, received, num_nv;
+
+   conn = &w->conn[gw];
+   for (attempt = 0; attempt < 2; attempt++){
+      reused = conn->ssl != NULL;
+      if (!reused && init_com(conn) != 1){
+         for (n = 0; n < count; n++) w->pipe[n].online = 1;
+         trace_conn(conn, &w->pipe[0]);
+         return 0;
+         }
+      if (conn->h2 == NULL) return -1;
+
+      // Streams - path is taken from the prebuilt request
+      for (n = 0; n < count; n++){
+         st = &w->streams[n];
+         t = w->pipe[n].target;
+         if (st->body == NULL) st->body = malloc(MAX_BODY);
+         if (st->tok == NULL) st->tok = json_tokener_new();
+         http_parser_init(&st->hp, st->body, MAX_BODY);
+         if (target.station[t] == TARGET_BATCH){
+            json_tokener_reset(st->tok);
+            st->hp.tok = st->tok;
             }
+         st->done = 0;
+         path = (char*)target.req[t].iov_base + 4;
+         end = strstr(path, " HTTP/1.1");
+         nv[0] = (nghttp2_nv){(uint8_t*)":method", (uint8_t*)"GET", 7, 3, NGHTTP2_NV_FLAG_NONE};
+         nv[1] = (nghttp2_nv){(uint8_t*)":scheme", (uint8_t*)"https", 7, 5, NGHTTP2_NV_FLAG_NONE};
+         nv[2] = (nghttp2_nv){(uint8_t*)":authority", (uint8_t*)gateway[gw].httphost, 10, strlen(gateway[gw].httphost), NGHTTP2_NV_FLAG_NONE};
+         nv[3] = (nghttp2_nv){(uint8_t*)":path", (uint8_t*)path, 5, end - path, NGHTTP2_NV_FLAG_NONE};
+         nv[4] = (nghttp2_nv){(uint8_t*)"accept", (uint8_t*)"application/json", 6, 16, NGHTTP2_NV_FLAG_NONE};
+         num_nv = 5;
+         if (atoi(compression) == 1)
+            nv[num_nv++] = (nghttp2_nv){(uint8_t*)"accept-encoding", (uint8_t*)"gzip, br", 15, 8, NGHTTP2_NV_FLAG_NONE};
+         if (cond[t] != NULL && cond[t]->etag[0] != 0)
+            nv[num_nv++] = (nghttp2_nv){(uint8_t*)"if-none-match", (uint8_t*)cond[t]->etag, 13, strlen(cond[t]->etag), NGHTTP2_NV_FLAG_NONE};
+         if (cond[t] != NULL && cond[t]->last_modified[0] != 0)
+            nv[num_nv++] = (nghttp2_nv){(uint8_t*)"if-modified-since", (uint8_t*)cond[t]->last_modified, 17, strlen(cond[t]->last_modified), NGHTTP2_NV_FLAG_NONE};
+         st->id = nghttp2_submit_request(conn->h2, NULL, nv, num_nv, NULL, st);
+         if (st->id < 0) st->done = -1;
+         }
 
-         // Does end of packet contain a 0? (=end of transmission)
-         x = strlen(server_reply);
-         if (server_reply[x - 5] == '0')
+      // All HEADERS frames in one write
+      stamp_send(conn, &t0);
+      rc = nghttp2_session_send(conn->h2);
+      trace_send(conn, w->pipe, count, &t0);
+
+      // Read until all streams are closed
+      open = count;
+      received = 0;
+      while (rc == 0 && open > 0 && nghttp2_session_want_read(conn->h2)){
+         rc = SSL_read(conn->ssl, server_reply, sizeof(server_reply));
+         stamp_recv(conn, &conn->h2_read);
+         if (rc <= 0){
+            rc = -1;
             break;
+            }
+         received = received + rc;
+         if (nghttp2_session_mem_recv(conn->h2, (uint8_t*)server_reply, rc) < 0 || nghttp2_session_send(conn->h2) != 0){
+            rc = -1;
+            break;
+            }
+         rc = 0;
+         for (open = 0, n = 0; n < count; n++)
+            if (w->streams[n].done == 0) open++;
+         }
 
-         if (length == 0){
-             break; // All is read
-             }
+      // Connection closed by gateway before anything was read - once more on a new connection
+      if (received == 0 && reused && attempt == 0){
+         close_com(conn);
+         continue;
+         }
+      break;
+      }
 
-         } /* else */
-      } while (rc > 0);
-      if (rc < 0){
-         switch(ssl_error = SSL_get_error(ssl, rc)){
-            case SSL_ERROR_NONE:
-               if (TCPIPDEBUG) write_syslog("SSL_ERROR_NONE", 1);
-               break;
-            case SSL_ERROR_WANT_READ:
-               if (TCPIPDEBUG) write_syslog("SSL_WANT_READ", 2);
-               break;
-            case SSL_ERROR_ZERO_RETURN:
-               if (TCPIPDEBUG) write_syslog("SSL_ZERO_RETURN", 2);
-               break;
-            case SSL_ERROR_SYSCALL:
-               if (TCPIPDEBUG) write_syslog("SSL_ERROR_SYSCALL", 3);
-               break;
-            case SSL_ERROR_WANT_WRITE:
-               if (TCPIPDEBUG) write_syslog("SSL_ERROR_WANT_WRITE", 2);
-               break;
-            default:
-               if (TCPIPDEBUG) write_syslog("UNKNOWN SSL_get_error", 3);
+   for (n = 0; n < count; n++){
+      st = &w->streams[n];
+      if (st->done == 1){
+         sample_time(&w->pipe[n], &t0, &st->t_first, &st->t_done);
+         w->pipe[n].online = api_response(&st->hp, w->pipe[n].target, &w->pipe[n]);
+         }
+      else {
+         w->pipe[n].online = -1;
+         if (st->hp.json != NULL) json_object_put(st->hp.json);
          }
       }
-   gettimeofday(&t1, 0); // Measure t1
 
-   strcpy(server_reply, server_reply2);
-   close_com();
-   if (HTTPLOGGING) http_log("[HTML Received]%s[EOS]", server_reply);
+   if (open > 0){
+      snprintf(syslog_str, 79, "HTTP/2: %i of %i streams not completed", open, count);
+      write_syslog(syslog_str, 2);
+      }
+   for (n = 0; n < count; n++)
+      tcp_read(conn, &w->pipe[n]);
+   if (rc != 0 || open > 0 || atoi(keepalive) == 0) close_com(conn);
+   return 0;
+   } /* api_h2 */
+
+// Interpret response in hp - result is returned in smp
+int api_response(struct http_parser* hp, int t, struct sample* smp){
+   int http_ret, api_type;
+   char syslog_str[80] = {0};
 
-   mea[api_type].elapsed = timedifference_msec(t0, t1);
+   smp->trace.decode = raw_ns();
+   api_type = target.api[t];
 
-   if (strlen(server_reply) <= 50){ /* No data from socket */
-      mea[api_type].elapsed = 0;
-      snprintf(syslog_str,79,"Error: Returncode: Only %i bytes recieved from API %i", strlen(server_reply), api_type);
+   if (hp->state == HP_HEADER){ /* No data from socket */
+      if (hp->json != NULL) json_object_put(hp->json);
+      hp->json = NULL;
+      snprintf(syslog_str,79,"Error: Returncode: Only %li bytes recieved from API %i", hp->wire_len, api_type);
       write_syslog(syslog_str,2);
       return -1;
       }
-   
-   // Decode HTTP-returncode
-   http_ok = 99;
-   http_ret = 999;
-   if (strlen(server_reply) > 12){
-      http_ret_code[0] = server_reply[9];
-      http_ret_code[1] = server_reply[10];
-      http_ret_code[2] = server_reply[11];
-      http_ret_code[3] = 0;
-      http_ret =  atoi(http_ret_code);
-      } 
-   else {
-      snprintf(syslog_str,79,"Error: Less than %i bytes recieved from API %i", strlen(server_reply), api_type);
+
+   smp->wire_bytes = hp->wire_len;
+   smp->body_bytes = hp->body_len;
+   if (hp->state == HP_ERROR && hp->status == 200){
+      snprintf(syslog_str,79,"Error: Response from API %i could not be decoded", api_type);
       write_syslog(syslog_str,2);
-      return -2;
       }
 
+   if (hp->overflow){
+      snprintf(syslog_str,79,"Object to big - skipped"); // Message > MAX_BODY
+      write_syslog(syslog_str, 2);
+      return 3;
+      }
+
+   // Decode HTTP-returncode
+   http_ret = hp->status;
+   if (http_ret < 100 || http_ret > 999) http_ret = 999;
+   smp->http_ret = http_ret;
+
    snprintf(syslog_str,79,"HTTP %i recieved from API %i", http_ret, api_type);
 
    switch(http_ret) {
      case 200:		// Ok
-        mea[api_type].requests++;
-	mea[api_type].last_returncode = 200;
+	smp->returncode = 200;
+        break;
+     case 304:		// Not modified - cached observation is reused
+	smp->returncode = 200;
         break;
      case 204:		// No content
-        http_resp[api_type].http_204++;
-        strcpy(observation[api_type].data,"No data (http 204)");
-	mea[api_type].last_returncode = 204;
+        strcpy(smp->observation,"No data (http 204)");
+	smp->returncode = 204;
         write_syslog(syslog_str,2);
         break;
      case 400:		// Bad request
-        http_resp[api_type].http_other++;
-	mea[api_type].last_returncode = 400;
-        strcpy(observation[api_type].data,"Bad request (http 400)");
+	smp->returncode = 400;
+        strcpy(smp->observation,"Bad request (http 400)");
         write_syslog(syslog_str,2);
         break;
      case 401:		// Unauthorized
-        http_resp[api_type].http_other++;
-	mea[api_type].last_returncode = 401;
-        strcpy(observation[api_type].data,"Unauthorized (http 401)");
+	smp->returncode = 401;
+        strcpy(smp->observation,"Unauthorized (http 401)");
         write_syslog(syslog_str,2);
         break;
      case 404:		// Not found
-        http_resp[api_type].http_other++;
-	mea[api_type].last_returncode = 404;
-        strcpy(observation[api_type].data,"Not found (http 404)");
+	smp->returncode = 404;
+        strcpy(smp->observation,"Not found (http 404)");
         write_syslog(syslog_str,2);
         break;
      case 408:		// Request timeout
-        http_resp[api_type].http_other++;
-	mea[api_type].last_returncode = 408;
-        strcpy(observation[api_type].data,"Request timeout(http 408)");
+	smp->returncode = 408;
+        strcpy(smp->observation,"Request timeout(http 408)");
         write_syslog(syslog_str,2);
         break;
      case 999:		// Unexpected data from server
-        http_resp[api_type].http_other++;
-	mea[api_type].last_returncode = 999;
-        strcpy(observation[api_type].data,"Unexpected data from server");
+	smp->returncode = 999;
+        strcpy(smp->observation,"Unexpected data from server");
         write_syslog(syslog_str,2);
         break;
      default:		// All other http-codes
-        http_resp[api_type].http_other++;
-	mea[api_type].last_returncode = 999;
-        strcpy(observation[api_type].data,"Unexpected http-returncode ");
+	smp->returncode = 999;
+        strcpy(smp->observation,"Unexpected http-returncode ");
         write_syslog(syslog_str,2);
      } /* switch */
 
-   // Decode API-transactioncode
-   strcpy(trans_data2,"No Transactioncode");
-   if (http_ret == 200 ) { 		// returkode = 200 
-      // Decode transactioncode
-     if (strstr(server_reply, "x-gravitee-transaction-id:") != NULL)  strcpy(trans_data, strstr(server_reply, "x-gravitee-transaction-id:"));
-      if (strlen(trans_data) > 0){
-         x = y = 0;
-         while (trans_data[x] != ':' && x < strlen(trans_data))
-            x++;
-         x=x+2; 
-         while(trans_data[x] != 10 && x < strlen(trans_data)){   
-            trans_data2[y] = trans_data[x];
-            y++;
-            x++;
-            }
-            trans_data2[y - 1]=0;
-         } /* if */
-      }  
-
-   // Decode API-transactiondate
-   if (http_ret == 200 || http_ret == 204 ) {   // Assume only ret.code 200 & 2034 gives timestamp
-   strcpy(trans_dato,"01 Jan 1970 00:00:00 GMT");
-   if (strstr(server_reply,"date:") != NULL) strcpy(trans_data,strstr(server_reply,"date:"));
-   if (strlen(trans_data) > 0){
-      x=y=0;
-      while (trans_data[x] != ':' && x < 1999) x++;
-      x=x+7; // Remove dayname & ','
-      while(trans_data[x] != 10 && x < 1999){
-         trans_dato[y]=trans_data[x];
-         y++;
-         x++;
-         }
-         trans_dato[y-1]=0;
-         } /* if */
-      } /* if */
-      
-   write_translog(trans_dato, api_type, http_ret, trans_data2, timedifference_msec(t0, t1));
-   decode_data(api_type, server_reply);
+   api_meta(hp, smp);
+
+   if (http_ret == 200 && target.station[t] == TARGET_BATCH)
+      decode_batch(api_type, hp->json, smp);
+   else if (http_ret == 200)
+      decode_data(api_type, hp->body, smp);
+   if (hp->json != NULL) json_object_put(hp->json);
+   hp->json = NULL;
+   if (atoi(conditional) == 1) cond_update(hp, t, smp);
+   smp->trace.decoded = raw_ns();
    return 0;
-   
-   } /* api_request */
+   } /* api_response */
 
-int decode_data(int api, char* server_reply){
-   int x, y, i, j, k;
-   char data_temp[80] = {0};
-   char data_temp2[80] = {0};
-   char data[2000] = {0};
-   char json_str[5000] = {0};
-   json_bool json_rc = FALSE, json_rc2 = FALSE;
+// Gravitee transaction id & date of response
+void api_meta(struct http_parser* hp, struct sample* smp){
+   char value[80] = {0};
+   char* p;
 
-   // JSON variables
-   struct json_object *root, *temp, *temp2, *features, *properties, *value, *amp, *observed;
+   // Decode API-transactioncode
+   if ((smp->http_ret == 200 || smp->http_ret == 304) && http_header(hp, "x-gravitee-transaction-id", value, sizeof(value)))
+      strcpy(smp->trans_id, value);
+
+   // Decode API-transactiondate - remove dayname & ','
+   if (smp->http_ret == 200 || smp->http_ret == 204 || smp->http_ret == 304){   // Assume only ret.code 200, 204 & 304 gives timestamp
+      strcpy(smp->trans_date, "01 Jan 1970 00:00:00 GMT");
+      if (http_header(hp, "date", value, sizeof(value))){
+         p = strchr(value, ',');
+         snprintf(smp->trans_date, sizeof(smp->trans_date), "%s", p != NULL ? p + 2 : value);
+         }
+      }
+   } /* api_meta */
+
+// Conditional requests: keep validators & decoded result of a 200 - a 304 gets the cached result
+void cond_update(struct http_parser* hp, int t, struct sample* smp){
+   struct cond_record* c;
+   char etag[80], last_modified[40];
+   int n;
+
+   c = cond[t];
+   if (hp->status == 304 && c != NULL){
+      strcpy(smp->observation, c->observation);
+      smp->num_values = c->num_values;
+      for (n = 0; n < c->num_values; n++){
+         smp->value[n] = c->value[n];
+         smp->observed[n] = c->observed[n];
+         }
+      return;
+      }
+   if (hp->status != 200) return;
+
+   etag[0] = 0;
+   last_modified[0] = 0;
+   http_header(hp, "etag", etag, sizeof(etag));
+   http_header(hp, "last-modified", last_modified, sizeof(last_modified));
+   if (c == NULL){
+      if (etag[0] == 0 && last_modified[0] == 0) return;
+      c = cond[t] = calloc(1, sizeof(struct cond_record));
+      if (c == NULL) return;
+      }
+   strcpy(c->etag, etag);
+   strcpy(c->last_modified, last_modified);
+   strcpy(c->observation, smp->observation);
+   c->num_values = smp->num_values;
+   for (n = 0; n < smp->num_values; n++){
+      c->value[n] = smp->value[n];
+      c->observed[n] = smp->observed[n];
+      }
+   } /* cond_update */
+
+// Copy request for target t to req (REQ_SIZE) with validators of latest response - returns length
+int request_get(int t, char* req){
+   int len;
+
+   len = target.req[t].iov_len;
+   memcpy(req, target.req[t].iov_base, len);
+   if (cond[t] == NULL) return len;
+
+   len = len - 2; // Before empty line
+   if (cond[t]->etag[0] != 0)
+      len += snprintf(req + len, REQ_SIZE - len, "If-None-Match: %s\r\n", cond[t]->etag);
+   if (cond[t]->last_modified[0] != 0)
+      len += snprintf(req + len, REQ_SIZE - len, "If-Modified-Since: %s\r\n", cond[t]->last_modified);
+   len += snprintf(req + len, REQ_SIZE - len, "\r\n");
+   return len;
+   } /* request_get */
 
-   strcpy(data_temp, "No value");
+// Decode observation from JSON body
+int decode_data(int api, char* body, struct sample* smp){
+   struct json_object *root, *value, *observed;
+   char value_str[40];
 
    // Isolate json-string
-   if (strstr(server_reply, "{") != NULL && (strlen(server_reply) < 5000)) strcpy(json_str,strstr(server_reply, "{"));
-   else {
-      json_str[0] = 0; //ensure that we dont parse if JSON-object not present
+   if (strstr(body, "{") == NULL)
       return 2; // no data
-      }
 
-   // Does end of packet contain a 0? (=end of transmission)
-   x = strlen(server_reply);
-   if (server_reply[x - 5] == '0')
-      server_reply[x - 5] = 0;
+   arena_cur = arena_own;
+   root = json_tokener_parse(strstr(body, "{"));
+
+   smp->num_values = 1;
+   smp->value[0] = NAN;
+   smp->observed[0] = 0;
+   value = json_path(root, endpoint[api].json_value);
+   if (value == NULL)
+      strcpy(value_str, "No data");
+   else if (json_object_is_type(value, json_type_double) || json_object_is_type(value, json_type_int)){
+      smp->value[0] = json_object_get_double(value);
+      snprintf(value_str, 40, "%2.1f", smp->value[0]);
+      }
+   else
+      snprintf(value_str, 40, "%s", json_object_get_string(value));
 
-   root = json_tokener_parse(json_str);
+   // Value with time eg. lightObs: "-12.5 Ampere, t = 2021-..."
+   if (endpoint[api].json_time[0] != 0){
+      observed = json_path(root, endpoint[api].json_time);
+      smp->observed[0] = json_time(observed);
+      snprintf(smp->observation, 45, "%s %s, t = %s", value_str, endpoint[api].unit, observed != NULL ? json_object_get_string(observed) : "No time data");
+      }
+   else
+      snprintf(smp->observation, 45, "%s", value_str);
 
-   // Decode data-string - metObs/oceanObs/climateObs
-   if (api == 0 || api == 1 || api == 3){
-      json_rc = json_object_object_get_ex(root, "features", &features);
+   json_object_put(root);
+   arena_cur = NULL;
+   return 0;
+   } /* decode_data */
 
-      if (json_rc == TRUE){
-         temp = json_object_array_get_idx(features, 0);
-         json_rc2 = json_object_object_get_ex(temp, "properties", &properties);
+// Decode batch response: latest value of each station in the list. The features are found from
+// [xxx_JSON] - eg. features.0.properties.value is array "features" & value "properties.value"
+int decode_batch(int api, struct json_object* root, struct sample* smp){
+   struct json_object *features, *item, *value, *id;
+   char array_path[80], *item_path, *p;
+   int x, n, found;
+   time_t t;
+
+   smp->num_values = endpoint[api].num_stations;
+   for (n = 0; n < smp->num_values; n++){
+      smp->value[n] = NAN;
+      smp->observed[n] = 0;
+      }
+   if (root == NULL){
+      strcpy(smp->observation, "No data");
+      return 2;
+      }
 
-         if (json_rc2 == TRUE) {
-            json_rc = json_object_object_get_ex(properties, "value", &value);
-            if (json_rc == TRUE)
-                  sprintf(observation[api].data, "%2.1f", json_object_get_double(value));
-               else 
-                  strcpy(observation[api].data, "No data");
-            }
+   // Split path at array index
+   snprintf(array_path, 80, "%s", endpoint[api].json_value);
+   item_path = "";
+   for (p = array_path; *p != 0; p++)
+      if ((p == array_path || p[-1] == '.') && isdigit(*p)){
+         if (p > array_path) p[-1] = 0; else array_path[0] = 0;
+         item_path = strchr(p, '.') != NULL ? strchr(p, '.') + 1 : "";
+         break;
          }
-      } /* if api=0,1,3 */
-
-   /* Decode lightObs */
-   if (api == 2){
-      json_rc = json_object_object_get_ex(root, "features", &features);
+   features = array_path[0] != 0 ? json_path(root, array_path) : root;
+   if (features == NULL || !json_object_is_type(features, json_type_array)){
+      strcpy(smp->observation, "No data");
+      return 2;
+      }
 
-      if (json_rc == TRUE){
-         temp = json_object_array_get_idx(features, 0);
-         json_rc2 = json_object_object_get_ex(temp, "properties", &properties);
+   // Newest value for each station in list
+   found = 0;
+   for (x = 0; x < json_object_array_length(features); x++){
+      item = json_object_array_get_idx(features, x);
+      id = json_path(item, endpoint[api].batch_station);
+      value = json_path(item, item_path);
+      if (id == NULL || value == NULL) continue;
+      for (n = 0; n < endpoint[api].num_stations; n++)
+         if (strcmp(endpoint[api].station[n], json_object_get_string(id)) == 0) break;
+      if (n == endpoint[api].num_stations) continue;
+
+      t = json_time(json_path(item, endpoint[api].batch_time));
+      if (isnan(smp->value[n])) found++;
+      else if (t <= smp->observed[n]) continue;
+      smp->value[n] = json_object_get_double(value);
+      smp->observed[n] = t;
+      }
 
-         if (json_rc2 == TRUE) {
-            json_rc = json_object_object_get_ex(properties, "amp", &amp);
-            if (json_rc == TRUE){
-               sprintf(observation[api].data, "%2.1f", json_object_get_double(amp));
-               strcat(observation[api].data, " Ampere, t = ");
-               }
-            else {
-               strcpy(observation[api].data, "No amp data");
-               }
-            json_rc = json_object_object_get_ex(properties, "observed", &observed);
-            if (json_rc == TRUE){
-               strcat(observation[api].data, json_object_get_string(observed));
-               }
-            else {
-               strcpy(observation[api].data, "No time data");
-               }
-            }
+   snprintf(smp->observation, 45, "%i / %i stations in one request", found, endpoint[api].num_stations);
+   return 0;
+   } /* decode_batch */
+
+// Time from ISO 8601 string eg. 2021-01-01T00:00:00Z - 0 if missing
+time_t json_time(struct json_object* obj){
+   struct tm tm;
+
+   if (obj == NULL) return 0;
+   memset(&tm, 0, sizeof(tm));
+   if (strptime(json_object_get_string(obj), "%Y-%m-%dT%H:%M:%S", &tm) == NULL) return 0;
+   return timegm(&tm);
+   } /* json_time */
+
+// Find value in JSON-object from path eg. features.0.properties.value - NULL if not found
+struct json_object* json_path(struct json_object* root, char* path){
+   char path_copy[80];
+   char *name, *save;
+   struct json_object *obj;
+
+   // Longer paths than the config fields hold are not truncated into another path
+   if (strlen(path) >= sizeof(path_copy)) return NULL;
+   strcpy(path_copy, path);
+   obj = root;
+   name = strtok_r(path_copy, ".", &save);
+   while (name != NULL && obj != NULL){
+      if (isdigit((unsigned char)name[0])){
+         if (!json_object_is_type(obj, json_type_array)) return NULL;
+         obj = json_object_array_get_idx(obj, atoi(name));
          }
-      } /* if api==2 */
-   json_rc = json_object_put(root);
-   } /* decode_data */
+      else if (!json_object_object_get_ex(obj, name, &obj))
+         return NULL;
+      name = strtok_r(NULL, ".", &save);
+      }
+   return obj;
+   } /* json_path */
 
 // View console
 void view_console(){
-   int x;
+   int x, row, a;
+   long dropped;
 
    getrusage(RUSAGE_SELF,&r_usage);
    strcpy(screen[0].line,"");
-   snprintf(screen[1].line, 130, "DMI API response monitor [%s]   : Latest com.rc:[%i] Mem:[%ld]", VERSION, online, r_usage.ru_maxrss);
-   snprintf(screen[2].line, 130, "System start time                 : %s", start_c_time_string);
+   dropped = 0;
+   for (x = 0; x < num_workers; x++)
+      dropped = dropped + atomic_load_explicit(&workers[x].shard.dropped, memory_order_relaxed);
+   snprintf(screen[1].line, 130, "DMI API response monitor [%s]   : Latest com.rc:[%i] Mem:[%ld] Workers:[%i] Dropped:[%li]", VERSION, online, r_usage.ru_maxrss, num_workers, dropped);
+   snprintf(screen[2].line, 130, "System start time                 : %s   Timing floor p99/max (usec): %.1f / %.1f",
+      start_c_time_string, jitter_floor.wake_p99 / 1e3, jitter_floor.wake_max / 1e3);
    snprintf(screen[3].line, 130, "Latest measurement                : %s", ctime(&current_time));
-   strcpy(screen[4].line, "MetObsAPI");
-   snprintf(screen[5].line, 130, "Latest datapoint                  : %6s C (temp 2m) @ %s", observation[0].data, stations_liste[stations_count].navn);
-   snprintf(screen[6].line, 130, "Resp.time latest trans.    (msec) : %8.2f", mea[0].elapsed);
-   snprintf(screen[7].line, 130, "Resp.time low/high         (msec) : %8.2f / %8.2f", mea[0].elapsed_low, mea[0].elapsed_high);
-   snprintf(screen[8].line, 130, "Resp.time avg. 10/100/1000 (msec) : %8.2f / %8.2f / %8.2f", mea[0].elapsed_gns10, mea[0].elapsed_gns100, mea[0].elapsed_gns1000);
-   snprintf(screen[9].line, 130, "# req./ret=204/ret=other          : %8i / %8i / %8i", mea[0].requests, http_resp[0].http_204, http_resp[0].http_other);
-   strcpy(screen[10].line," ");
-   strcpy(screen[11].line,"oceanObsAPI");
-   snprintf(screen[12].line, 130, "Latest datapoint                  : %6s cm (sealevel DVR) @ %s", observation[1].data, kyst_stations_liste[stations_count].navn);
-   snprintf(screen[13].line, 130, "Resp.time latest.trans     (msec) : %8.2f", mea[1].elapsed);
-   snprintf(screen[14].line, 130, "Rest.time low/high         (msec) : %8.2f / %8.2f", mea[1].elapsed_low,mea[1].elapsed_high);
-   snprintf(screen[15].line, 130, "Resp.time avg. 10/100/1000 (msec) : %8.2f / %8.2f / %8.2f", mea[1].elapsed_gns10, mea[1].elapsed_gns100, mea[1].elapsed_gns1000);
-   snprintf(screen[16].line, 130, "# req./ret=204/ret=other          : %8i / %8i / %8i", mea[1].requests, http_resp[1].http_204, http_resp[1].http_other);
-   strcpy(screen[17].line," ");
-   strcpy(screen[18].line, "lightningObsApi");
-   snprintf(screen[19].line, 130, "Latest datapoint                  : %s", observation[2].data);
-   snprintf(screen[20].line, 130, "Resp.time latest trans     (msec) : %8.2f", mea[2].elapsed);
-   snprintf(screen[21].line, 130, "Resp.time low/high         (msec) : %8.2f / %8.2f", mea[2].elapsed_low, mea[2].elapsed_high);
-   snprintf(screen[22].line, 130, "Resp.time avg. 10/100/1000 (msec) : %8.2f / %8.2f / %8.2f", mea[2].elapsed_gns10, mea[2].elapsed_gns100, mea[2].elapsed_gns1000);
-   snprintf(screen[23].line, 130, "# req./ret=204/ret=other          : %8i / %8i / %8i", mea[2].requests, http_resp[2].http_204, http_resp[2].http_other);
-   strcpy(screen[24].line," ");
-   strcpy(screen[25].line, "climateObsApi");
-   snprintf(screen[26].line, 130, "Latest datapoint                  : %6s C (mean temp) @ %s", observation[3].data, stations_liste[stations_count].navn);
-   snprintf(screen[27].line, 130, "Resp.time latest trans.    (msec) : %8.2f", mea[3].elapsed);
-   snprintf(screen[28].line, 130, "Resp.time low/high         (msec) : %8.2f / %8.2f", mea[3].elapsed_low, mea[3].elapsed_high);
-   snprintf(screen[29].line, 130, "Resp.time avg. 10/100/1000 (msec) : %8.2f / %8.2f / %8.2f", mea[3].elapsed_gns10, mea[3].elapsed_gns100, mea[3].elapsed_gns1000);
-   snprintf(screen[30].line, 130, "# req./ret=204/ret=other          : %8i / %8i / %8i", mea[3].requests, http_resp[3].http_204, http_resp[3].http_other);
-   strcpy(screen[31].line," ");
-
-   // View
+   screen[3].line[strlen(screen[3].line) - 1] = 0;
+
+   for (x = 0; x < num_groups; x++){
+      row = 4 + x * 7;
+      a = group[x].api;
+      snprintf(screen[row].line, 130, "%sAPI", group[x].name);
+      if (endpoint[a].json_time[0] != 0 || target.station[group[x].first] == TARGET_BATCH)
+         snprintf(screen[row + 1].line, 130, "Latest datapoint                  : %.93s", observation[x].data);
+      else if (endpoint[a].num_stations > 0)
+         snprintf(screen[row + 1].line, 130, "Latest datapoint                  : %6.20s %.39s @ %.25s", observation[x].data, endpoint[a].unit, station_name(a, mea[x].station));
+      else
+         snprintf(screen[row + 1].line, 130, "Latest datapoint                  : %6.40s %.39s", observation[x].data, endpoint[a].unit);
+      snprintf(screen[row + 2].line, 130, "Resp.time latest trans.    (msec) : %8.2f", mea[x].elapsed);
+      snprintf(screen[row + 3].line, 130, "Resp.time low/high         (msec) : %8.2f / %8.2f", mea[x].elapsed_low, mea[x].elapsed_high);
+      snprintf(screen[row + 4].line, 130, "Resp.time avg. 10/100/1000 (msec) : %8.2f / %8.2f / %8.2f", mea[x].elapsed_gns10, mea[x].elapsed_gns100, mea[x].elapsed_gns1000);
+      snprintf(screen[row + 5].line, 130, "# req./ret=304/ret=204/ret=other  : %8i / %8i / %8i / %8i", mea[x].requests, http_resp[x].http_304, http_resp[x].http_204, http_resp[x].http_other);
+      snprintf(screen[row + 6].line, 130, "Interval (s)/missed deadlines     : %8.1f / %8li", mea[x].interval_ns / 1e9, mea[x].missed);
+      }
+   console_rows = 4 + num_groups * 7 + 3;
+   if (atoi(adaptive) == 1)
+      snprintf(screen[console_rows - 3].line, 130, "Adaptive budget (requests)        : %8.1f", budget_view);
+   else
+      strcpy(screen[console_rows - 3].line, " ");
+   snprintf(screen[console_rows - 2].line, 130, "Cycle CPU usr/sys (usec)/allocs   : %8.1f / %8.1f / %8.1f   ctx.sw. vol/invol: %5.2f / %5.2f",
+      overhead_cycle(ov_now.utime, ov_prev.utime) * 1e6, overhead_cycle(ov_now.stime, ov_prev.stime) * 1e6,
+      overhead_cycle(ov_now.allocs, ov_prev.allocs), overhead_cycle(ov_now.nvcsw, ov_prev.nvcsw), overhead_cycle(ov_now.nivcsw, ov_prev.nivcsw));
+   snprintf(screen[console_rows - 1].line, 130, "Cycle syscalls (bytes written)    : net %.1f (%.0f)  log %.1f (%.0f)  html %.1f (%.0f)  con. %.1f (%.0f)  data %.1f (%.0f)",
+      overhead_cycle(ov_now.syscalls[OV_NET], ov_prev.syscalls[OV_NET]), overhead_cycle(ov_now.bytes[OV_NET], ov_prev.bytes[OV_NET]),
+      overhead_cycle(ov_now.syscalls[OV_LOG], ov_prev.syscalls[OV_LOG]), overhead_cycle(ov_now.bytes[OV_LOG], ov_prev.bytes[OV_LOG]),
+      overhead_cycle(ov_now.syscalls[OV_HTML], ov_prev.syscalls[OV_HTML]), overhead_cycle(ov_now.bytes[OV_HTML], ov_prev.bytes[OV_HTML]),
+      overhead_cycle(ov_now.syscalls[OV_CONSOLE], ov_prev.syscalls[OV_CONSOLE]), overhead_cycle(ov_now.bytes[OV_CONSOLE], ov_prev.bytes[OV_CONSOLE]),
+      overhead_cycle(ov_now.syscalls[OV_DATA], ov_prev.syscalls[OV_DATA]), overhead_cycle(ov_now.bytes[OV_DATA], ov_prev.bytes[OV_DATA]));
+
+   // View - only changed cells are sent to tty
    if (atoi(silent) == 1){
-      printf("\e[1;1H\e[2J"); // Clear screen
-      for (x=0;x<=31;x++)
-        printf("%s\n",screen[x].line);
+      for (x = 0; x < console_rows; x++)
+         con_text(x, screen[x].line);
+      for (x = 0; x < num_groups; x++){
+         con_color(4 + x * 7, 0, strlen(screen[4 + x * 7].line), threshold_level(x, mea[x].elapsed_gns10));
+         con_color(6 + x * 7, 36, 8, threshold_level(x, mea[x].elapsed));
+         con_color(7 + x * 7, 36, 8, threshold_level(x, mea[x].elapsed_low));
+         con_color(7 + x * 7, 47, 8, threshold_level(x, mea[x].elapsed_high));
+         con_color(8 + x * 7, 36, 8, threshold_level(x, mea[x].elapsed_gns10));
+         con_color(8 + x * 7, 47, 8, threshold_level(x, mea[x].elapsed_gns100));
+         con_color(8 + x * 7, 58, 8, threshold_level(x, mea[x].elapsed_gns1000));
+         con_color(9 + x * 7, 0, 67, mea[x].last_returncode == 200 ? TTY_GREEN : TTY_RED);
+         con_spark(6 + x * 7, 48, x);
+         }
+      con_flush();
       } /* if */
    } /* view_console */
 
 // Write html-page with console-output
 void html_output(){
-   int x;
+   int x, y, n, a;
+   char* color;
+   char observed[30];
+   char sparkline[SPARK_LEN * 3 + 1];
+   struct tm tm;
+   struct ts_range range;
+   struct rollup_slot* rs;
+   char low[20], high[20];
+   static time_t series_written;
 
    compute_colors();
 
@@ -824,40 +2895,1492 @@ void html_output(){
    for (x = 0; x <= 3; x++)
       fprintf(http_out, "%s<br>", screen[x].line);
 
-   fprintf(http_out, "<h2><b>%smetObsAPI%s</b></h2>", mea[0].elapsed_gns10_html_color, HTML_END);
-   fprintf(http_out, "Latest datapoint                  : %6s C (temp 2m) @ %s<br>", observation[0].data, stations_liste[stations_count].navn);
-   fprintf(http_out, "Resp.time latest trans.    (msec) : [%s%8.2f%s]<br>", mea[0].elapsed_html_color, mea[0].elapsed, HTML_END);
-   fprintf(http_out, "Resp.time low/high         (msec) : [%s%8.2f%s] / [%s%8.2f%s]<br>", mea[0].elapsed_low_html_color, mea[0].elapsed_low, HTML_END, mea[0].elapsed_high_html_color, mea[0].elapsed_high, HTML_END);
-   fprintf(http_out, "Resp.time avg. 10/100/1000 (msec) : [%s%8.2f%s] / [%s%8.2f%s] / [%s%8.2f%s]<br>", mea[0].elapsed_gns10_html_color, mea[0].elapsed_gns10, HTML_END, mea[0].elapsed_gns100_html_color, mea[0].elapsed_gns100, HTML_END, mea[0].elapsed_gns1000_html_color, mea[0].elapsed_gns1000, HTML_END);
-   fprintf(http_out, "%s# req./ret=204/ret=other          : %8i / %8i / %8i%s", mea[0].last_returncode_html_color, mea[0].requests, http_resp[0].http_204, http_resp[0].http_other, HTML_END);
-
-   fprintf(http_out, "<br><h2><b>%sOceanObsAPI%s</b></h2>", mea[1].elapsed_gns10_html_color, HTML_END);
-   fprintf(http_out, "Latest datapoint                  : %6s cm (sealevel DVR) @ %s<br>", observation[1].data, kyst_stations_liste[stations_count].navn);
-   fprintf(http_out, "Resp.time latest trans.    (msec) : [%s%8.2f%s]<br>", mea[1].elapsed_html_color, mea[1].elapsed, HTML_END);
-   fprintf(http_out, "Resp.time low/high         (msec) : [%s%8.2f%s] / [%s%8.2f%s]<br>", mea[1].elapsed_low_html_color, mea[1].elapsed_low, HTML_END, mea[1].elapsed_high_html_color, mea[1].elapsed_high, HTML_END);
-   fprintf(http_out, "Resp.time avg. 10/100/1000 (msec) : [%s%8.2f%s] / [%s%8.2f%s] / [%s%8.2f%s]<br>", mea[1].elapsed_gns10_html_color, mea[1].elapsed_gns10, HTML_END, mea[1].elapsed_gns100_html_color, mea[1].elapsed_gns100, HTML_END, mea[1].elapsed_gns1000_html_color, mea[1].elapsed_gns1000, HTML_END);
-   fprintf(http_out, "%s# req./ret=204/ret=other          : %8i / %8i / %8i%s", mea[1].last_returncode_html_color,mea[1].requests, http_resp[1].http_204, http_resp[1].http_other, HTML_END);
-
-   fprintf(http_out, "<br><h2><b>%sLightningObsAPI%s</b></h2>", mea[2].elapsed_gns10_html_color, HTML_END);
-   fprintf(http_out, "Latest datapoint                  : %s<br>", observation[2].data);
-   fprintf(http_out, "Resp.time latest trans.    (msec) : [%s%8.2f%s]<br>", mea[2].elapsed_html_color, mea[2].elapsed, HTML_END);
-   fprintf(http_out, "Resp.time low/high         (msec) : [%s%8.2f%s] / [%s%8.2f%s]<br>", mea[2].elapsed_low_html_color, mea[2].elapsed_low, HTML_END, mea[2].elapsed_high_html_color, mea[2].elapsed_high, HTML_END);
-   fprintf(http_out, "Resp.time avg. 10/100/1000 (msec) : [%s%8.2f%s] / [%s%8.2f%s] / [%s%8.2f%s]<br>", mea[2].elapsed_gns10_html_color, mea[2].elapsed_gns10, HTML_END, mea[2].elapsed_gns100_html_color, mea[2].elapsed_gns100, HTML_END, mea[2].elapsed_gns1000_html_color, mea[2].elapsed_gns1000, HTML_END);
-   fprintf(http_out, "%s# req./ret=204/ret=other          : %8i / %8i / %8i%s", mea[2].last_returncode_html_color, mea[2].requests, http_resp[2].http_204, http_resp[2].http_other, HTML_END);
-
-   fprintf(http_out, "<br><h2><b>%sClimateObsAPI%s</b></h2>", mea[3].elapsed_gns10_html_color, HTML_END);
-   fprintf(http_out, "Latest datapoint                  : %6s C (mean temp) @ %s<br>", observation[3].data, stations_liste[stations_count].navn);
-   fprintf(http_out, "Resp.time latest trans.    (msec) : [%s%8.2f%s]<br>", mea[3].elapsed_html_color, mea[3].elapsed, HTML_END);
-   fprintf(http_out, "Resp.time low/high         (msec) : [%s%8.2f%s] / [%s%8.2f%s]<br>", mea[3].elapsed_low_html_color, mea[3].elapsed_low, HTML_END, mea[3].elapsed_high_html_color, mea[3].elapsed_high, HTML_END);
-   fprintf(http_out, "Resp.time avg. 10/100/1000 (msec) : [%s%8.2f%s] / [%s%8.2f%s] / [%s%8.2f%s]<br>", mea[3].elapsed_gns10_html_color, mea[3].elapsed_gns10, HTML_END, mea[3].elapsed_gns100_html_color, mea[3].elapsed_gns100, HTML_END, mea[3].elapsed_gns1000_html_color, mea[3].elapsed_gns1000, HTML_END);
-   fprintf(http_out, "%s# req./ret=204/ret=other          : %8i / %8i / %8i%s", mea[3].last_returncode_html_color, mea[3].requests, http_resp[3].http_204, http_resp[3].http_other, HTML_END);
+   for (x = 0; x < num_groups; x++){
+      fprintf(http_out, "%s<h2><b>%s%sAPI%s</b></h2>", x > 0 ? "<br>" : "", mea[x].elapsed_gns10_html_color, group[x].name, HTML_END);
+      fprintf(http_out, "%s<br>", screen[5 + x * 7].line);
+      fprintf(http_out, "Resp.time latest trans.    (msec) : [%s%8.2f%s]<br>", mea[x].elapsed_html_color, mea[x].elapsed, HTML_END);
+      fprintf(http_out, "Resp.time low/high         (msec) : [%s%8.2f%s] / [%s%8.2f%s]<br>", mea[x].elapsed_low_html_color, mea[x].elapsed_low, HTML_END, mea[x].elapsed_high_html_color, mea[x].elapsed_high, HTML_END);
+      fprintf(http_out, "Resp.time avg. 10/100/1000 (msec) : [%s%8.2f%s] / [%s%8.2f%s] / [%s%8.2f%s]<br>", mea[x].elapsed_gns10_html_color, mea[x].elapsed_gns10, HTML_END, mea[x].elapsed_gns100_html_color, mea[x].elapsed_gns100, HTML_END, mea[x].elapsed_gns1000_html_color, mea[x].elapsed_gns1000, HTML_END);
+      fprintf(http_out, "Resp.time avg. 200/304     (msec) : [%8.2f] / [%8.2f]<br>",
+         mea[x].requests > http_resp[x].http_304 ? http_resp[x].ms_200 / (mea[x].requests - http_resp[x].http_304) : 0,
+         http_resp[x].http_304 > 0 ? http_resp[x].ms_304 / http_resp[x].http_304 : 0);
+      html_spark(sparkline, &server_spark[x]);
+      fprintf(http_out, "RTT / server time latest   (msec) : [%8.2f] / [%8.2f]  %s<br>", mea[x].tcp.rtt, mea[x].server, sparkline);
+      fprintf(http_out, "RTT var./retrans/cwnd/flight      : %8.2f / %8u / %8u / %8u<br>", mea[x].tcp.rttvar, mea[x].tcp.retrans, mea[x].tcp.cwnd, mea[x].tcp.inflight);
+      fprintf(http_out, "%s# req./ret=304/ret=204/ret=other  : %8i / %8i / %8i / %8i%s", mea[x].last_returncode_html_color, mea[x].requests, http_resp[x].http_304, http_resp[x].http_204, http_resp[x].http_other, HTML_END);
+      }
+
+   // Rollups - latest slot of each resolution
+   fprintf(http_out, "<br><h2><b>Rollups</b></h2>");
+   fprintf(http_out, "%-24s %-4s %-20s %8s %8s %8s %8s %8s %8s %8s<br>", "API", "Res.", "From (GMT)", "Count", "Errors", "Avg.", "Low", "High", "p50", "p99");
+   for (x = 0; rollup != NULL && x < num_groups; x++)
+      for (n = 0; n < ROLLUP_RES; n++){
+         rs = rollup_slot(x, n, current_time);
+         if (rs->start != current_time - current_time % rollup_res[n].step || rs->count == 0) continue;
+         strftime(observed, 30, "%Y-%m-%d %H:%M:%S", gmtime_r(&rs->start, &tm));
+         fprintf(http_out, "%-24s %-4s %-20s %8u %8u %8.2f %8.2f %8.2f %8.2f %8.2f<br>", group[x].name, rollup_res[n].name, observed,
+            rs->count, rs->errors, rs->sum / rs->count, rs->min, rs->max, rollup_percentile(rs, 50), rollup_percentile(rs, 99));
+         }
+
+   // Targets
+   fprintf(http_out, "<br><h2><b>Targets</b></h2>");
+   fprintf(http_out, "%-20s %-12s %-16s %8s %8s %5s %8s %8s %8s %8s %8s %8s %8s %9s %9s<br>", "Gateway", "API", "Station", "Requests", "Errors", "Ret", "Latest", "TTFB", "RTT", "Server", "Avg.", "Low", "High", "Wire kB", "Body kB");
+   for (x = 0; x < num_targets; x++){
+      a = target.api[x];
+      if (target.last_rc[x] != 200) color = HTML_RED;
+      else if (target.last_ms[x] < atoi(th[a].trs_warning)) color = HTML_GREEN;
+      else if (target.last_ms[x] < atoi(th[a].trs_error)) color = HTML_YELLOW;
+      else color = HTML_RED;
+      fprintf(http_out, "%-20s %-12s %-16s %8u %8u %5u %s%8.2f%s %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %9.1f %9.1f<br>",
+         gateway[target.gateway[x]].name[0] != 0 ? gateway[target.gateway[x]].name : "-", endpoint[a].name,
+         target.station[x] == TARGET_BATCH ? "All (batch)" : endpoint[a].num_stations > 0 ? station_name(a, target.station[x]) : "-",
+         target.requests[x], target.errors[x], target.last_rc[x],
+         color, target.last_ms[x], HTML_END, target.ttfb_ms[x], target.rtt_ms[x],
+         target.ttfb_ms[x] > target.rtt_ms[x] ? target.ttfb_ms[x] - target.rtt_ms[x] : 0,
+         target.requests[x] > 0 ? target.sum_ms[x] / target.requests[x] : 0,
+         target.requests[x] > 0 ? target.min_ms[x] : 0, target.max_ms[x],
+         target.wire_sum[x] / 1024, target.body_sum[x] / 1024);
+      }
+
+   // Observations - latest value of each station
+   fprintf(http_out, "<br><h2><b>Observations</b></h2>");
+   fprintf(http_out, "%-24s %-16s %10s %-20s %8s %8s %10s %10s<br>", "API", "Station", "Value", "Observed (GMT)", "Age (s)", "Points", "Low 24h", "High 24h");
+   for (x = 0; x < num_groups; x++)
+      for (n = 0; n < group[x].stations; n++){
+         y = group[x].obs + n;
+         if (isnan(obs.value[y])) continue;
+         observed[0] = 0;
+         if (obs.observed[y] != 0) strftime(observed, 30, "%Y-%m-%d %H:%M:%S", gmtime_r(&obs.observed[y], &tm));
+         range.count = 0;
+         ts_query(y, current_time - 24 * 3600, current_time, ts_minmax, &range);
+         strcpy(low, "-");
+         strcpy(high, "-");
+         if (range.count > 0){
+            snprintf(low, sizeof(low), "%.1f", range.min);
+            snprintf(high, sizeof(high), "%.1f", range.max);
+            }
+         fprintf(http_out, "%-24s %-16s %10.1f %-20s %8li %8li %10s %10s<br>", group[x].name, station_name(group[x].api, n), obs.value[y],
+            observed[0] != 0 ? observed : "-", (long)(current_time - obs.updated[y]), ts[y].points, low, high);
+         }
+
+   // Own cost - per cycle in the latest period & in total
+   fprintf(http_out, "<br><h2><b>Overhead</b></h2>");
+   fprintf(http_out, "%-34s %12s %14s<br>", "", "Per cycle", "Total");
+   fprintf(http_out, "%-34s %12.1f %14.3f<br>", "CPU user (usec/cycle | s total)", overhead_cycle(ov_now.utime, ov_prev.utime) * 1e6, ov_now.utime);
+   fprintf(http_out, "%-34s %12.1f %14.3f<br>", "CPU system (usec/cycle | s total)", overhead_cycle(ov_now.stime, ov_prev.stime) * 1e6, ov_now.stime);
+   fprintf(http_out, "%-34s %12.2f %14li<br>", "Context switches voluntary", overhead_cycle(ov_now.nvcsw, ov_prev.nvcsw), ov_now.nvcsw);
+   fprintf(http_out, "%-34s %12.2f %14li<br>", "Context switches involuntary", overhead_cycle(ov_now.nivcsw, ov_prev.nivcsw), ov_now.nivcsw);
+   fprintf(http_out, "%-34s %12.1f %14li<br>", "Allocations", overhead_cycle(ov_now.allocs, ov_prev.allocs), ov_now.allocs);
+   fprintf(http_out, "%-34s %12.2f %14li<br>", "Connections", overhead_cycle(ov_now.connects, ov_prev.connects), ov_now.connects);
+   for (x = 0, n = 0, y = 0; x < num_arenas; x++){
+      if (atomic_load_explicit(&arenas[x].high, memory_order_relaxed) > n) n = atomic_load_explicit(&arenas[x].high, memory_order_relaxed);
+      y = y + atomic_load_explicit(&arenas[x].overflow, memory_order_relaxed);
+      }
+   fprintf(http_out, "%-34s %12s %14i<br>", "Arena high water (kB)", "", n / 1024);
+   fprintf(http_out, "%-34s %12s %14i<br>", "Arena overflows (heap allocations)", "", y);
+   for (x = 0; x < OV_SUBS; x++){
+      snprintf(observed, 30, "Syscalls %s", ov_name[x]);
+      fprintf(http_out, "%-34s %12.1f %14li<br>", observed, overhead_cycle(ov_now.syscalls[x], ov_prev.syscalls[x]), ov_now.syscalls[x]);
+      snprintf(observed, 30, "Bytes written %s", ov_name[x]);
+      fprintf(http_out, "%-34s %12.0f %14li<br>", observed, overhead_cycle(ov_now.bytes[x], ov_prev.bytes[x]), ov_now.bytes[x]);
+      }
+   fprintf(http_out, "%-34s %12.1f %14li<br>", "Read syscalls (kernel)", overhead_cycle(ov_now.syscr, ov_prev.syscr), ov_now.syscr);
+   fprintf(http_out, "%-34s %12.1f %14li<br>", "Write syscalls (kernel)", overhead_cycle(ov_now.syscw, ov_prev.syscw), ov_now.syscw);
+   fprintf(http_out, "%-34s %12s %14li<br>", "Cycles", "", ov_now.cycles);
+   fprintf(http_out, "%-34s %12s %14.1f<br>", "Timing floor wake-up p50 (usec)", "", jitter_floor.wake_p50 / 1e3);
+   fprintf(http_out, "%-34s %12s %14.1f<br>", "Timing floor wake-up p99 (usec)", "", jitter_floor.wake_p99 / 1e3);
+   fprintf(http_out, "%-34s %12s %14.1f<br>", "Timing floor wake-up max (usec)", "", jitter_floor.wake_max / 1e3);
+   fprintf(http_out, "%-34s %12s %14.1f<br>", "Timing floor loop gap max (usec)", "", jitter_floor.gap_max / 1e3);
+
+   // Time series as JSON - once a minute
+   if (current_time - series_written >= 60){
+      ts_json_output();
+      series_written = current_time;
+      }
 
+   overhead_file(OV_HTML, ftell(http_out));
    fclose(http_out);
    } /* html_output */
 
-// Write translog-event
-void write_translog(char* trans_date, int api_id, int http_code, char* trans_id, double trans_tid){
-   char name[40];
+// Time series store - Gorilla compression (Pelkonen et al., VLDB 2015) with 32 bit float values:
+// delta-of-delta of timestamps & XOR of values with the previous point, written as a bit stream
+// in fixed size blocks from a pool of [TS_MEMORY] kB. When the pool is empty the oldest block
+// is spilled to TS_FILE and stays available for queries. The file is indexed again at start
+void ts_init(){
+   struct ts_spill sp;
+   FILE* f;
+   int x;
+
+   ts_pool_size = (strlen(ts_memory) > 0 ? atol(ts_memory) : 4096) * 1024 / sizeof(struct ts_block);
+   if (ts_pool_size < 2 * num_obs) ts_pool_size = 2 * num_obs;
+   ts_pool = calloc(ts_pool_size, sizeof(struct ts_block));
+   ts_free = NULL;
+   for (x = 0; x < ts_pool_size; x++){
+      ts_pool[x].next = ts_free;
+      ts_free = &ts_pool[x];
+      }
+   for (x = 0; x < num_obs; x++)
+      memset(&ts[x], 0, sizeof(ts[x]));
+
+   // Index spilled blocks - blocks of series no longer in configuration are skipped
+   f = fopen(TS_FILE, "rb");
+   while (f != NULL && fread(&sp, offsetof(struct ts_spill, offset), 1, f) == 1){
+      sp.offset = ftell(f);
+      if (!ts_spill_valid(&sp)){
+         write_syslog("Damaged block in " TS_FILE " - later blocks are not indexed", 2);
+         break;
+         }
+      sp.series = ts_find(sp.key);
+      if (sp.series >= 0) ts_spill_add(&sp);
+      if (fseek(f, (sp.bits + 7) / 8, SEEK_CUR) != 0) break;
+      }
+   if (f != NULL) fclose(f);
+   ts_file = fopen(TS_FILE, "ab");
+   } /* ts_init */
+
+// Series of observation slot y - "metObs@staging/06041"
+void ts_key(char* key, int y){
+   int x;
+
+   for (x = 0; x < num_groups - 1 && y >= group[x + 1].obs; x++) ;
+   snprintf(key, 48, "%s/%s", group[x].name, endpoint[group[x].api].num_stations > 0 ? endpoint[group[x].api].station[y - group[x].obs] : "-");
+   } /* ts_key */
+
+// Observation slot of series key - -1 if not found
+int ts_find(char* key){
+   char name[48];
+   int y;
+
+   for (y = 0; y < num_obs; y++){
+      ts_key(name, y);
+      if (strcmp(name, key) == 0) return y;
+      }
+   return -1;
+   } /* ts_find */
+
+// Spilled block fits a block and its points fit its bits - a point after the first is at least 2 bits
+int ts_spill_valid(struct ts_spill* sp){
+   return sp->bits >= 32 && sp->bits <= TS_BLOCK_BYTES * 8 && sp->count >= 1 && sp->count <= 1 + (sp->bits - 32) / 2;
+   } /* ts_spill_valid */
+
+void ts_spill_add(struct ts_spill* sp){
+   if (ts_num_spill == ts_max_spill){
+      ts_max_spill = ts_max_spill == 0 ? 256 : ts_max_spill * 2;
+      ts_spill = realloc(ts_spill, ts_max_spill * sizeof(struct ts_spill));
+      }
+   ts_spill[ts_num_spill++] = *sp;
+   ts[sp->series].spilled++;
+   } /* ts_spill_add */
+
+static void ts_put(struct ts_block* b, uint32_t value, int bits){
+   int x;
+
+   for (x = bits - 1; x >= 0; x--){
+      if (value >> x & 1) b->data[b->bits >> 3] |= 0x80 >> (b->bits & 7);
+      b->bits++;
+      }
+   } /* ts_put */
+
+static uint32_t ts_get(const uint8_t* data, int* pos, int bits){
+   uint32_t value;
+
+   value = 0;
+   while (bits-- > 0){
+      value = value << 1 | (data[*pos >> 3] >> (7 - (*pos & 7)) & 1);
+      (*pos)++;
+      }
+   return value;
+   } /* ts_get */
+
+// Take a block from the pool - the oldest block not being written is spilled if the pool is empty
+static struct ts_block* ts_block_new(int y){
+   struct ts_block *b, *oldest;
+   struct ts_spill sp;
+   int x;
+
+   if (ts_free == NULL){
+      oldest = NULL;
+      for (x = 0; x < ts_pool_size; x++)
+         if (ts[ts_pool[x].series].last != &ts_pool[x] && (oldest == NULL || ts_pool[x].seq < oldest->seq))
+            oldest = &ts_pool[x];
+      if (oldest == NULL) return NULL;
+
+      // Oldest block of a series is its first
+      memset(&sp, 0, sizeof(sp));
+      ts_key(sp.key, oldest->series);
+      sp.count = oldest->count;
+      sp.bits = oldest->bits;
+      sp.t_first = oldest->t_first;
+      sp.t_last = oldest->t_last;
+      if (ts_file != NULL && fwrite(&sp, offsetof(struct ts_spill, offset), 1, ts_file) == 1){
+         sp.offset = ftell(ts_file);
+         fwrite(oldest->data, 1, (oldest->bits + 7) / 8, ts_file);
+         fflush(ts_file);
+         overhead_write(OV_DATA, offsetof(struct ts_spill, offset) + (oldest->bits + 7) / 8);
+         sp.series = oldest->series;
+         ts_spill_add(&sp);
+         }
+      ts[oldest->series].first = oldest->next;
+      oldest->next = ts_free;
+      ts_free = oldest;
+      }
+
+   b = ts_free;
+   ts_free = b->next;
+   memset(b, 0, sizeof(*b));
+   b->series = y;
+   b->seq = ts_seq++;
+   return b;
+   } /* ts_block_new */
+
+// Append point to series y - points not newer than the latest are ignored
+void ts_add(int y, time_t t, float value){
+   struct ts_series* s;
+   struct ts_block* b;
+   uint32_t v, xor;
+   long delta, dod;
+   int lead, trail;
+
+   s = &ts[y];
+   if (s->points > 0 && t <= s->t_last) return;
+   memcpy(&v, &value, 4);
+
+   // New block - first point is written in full. 80 bits is the largest point: 4 + 32 for the timestamp, 2 + 5 + 5 + 32 for the value
+   b = s->last;
+   if (b == NULL || b->bits + 80 > TS_BLOCK_BYTES * 8){
+      b = ts_block_new(y);
+      if (b == NULL) return;
+      if (s->last != NULL) s->last->next = b;
+      else s->first = b;
+      s->last = b;
+      b->t_first = b->t_last = t;
+      ts_put(b, v, 32);
+      b->delta = 0;
+      b->v_prev = v;
+      b->lead = 32;
+      b->count = 1;
+      s->points++;
+      s->t_last = t;
+      return;
+      }
+
+   // Timestamp - delta of delta
+   delta = t - b->t_last;
+   dod = delta - b->delta;
+   if (dod == 0) ts_put(b, 0, 1);
+   else if (dod >= -64 && dod <= 63){ ts_put(b, 2, 2); ts_put(b, dod & 0x7F, 7); }
+   else if (dod >= -256 && dod <= 255){ ts_put(b, 6, 3); ts_put(b, dod & 0x1FF, 9); }
+   else if (dod >= -2048 && dod <= 2047){ ts_put(b, 14, 4); ts_put(b, dod & 0xFFF, 12); }
+   else { ts_put(b, 15, 4); ts_put(b, (uint32_t)dod, 32); }
+
+   // Value - XOR with previous, meaningful bits within previous window if they fit
+   xor = v ^ b->v_prev;
+   if (xor == 0)
+      ts_put(b, 0, 1);
+   else {
+      lead = __builtin_clz(xor);
+      trail = __builtin_ctz(xor);
+      if (b->lead < 32 && lead >= b->lead && trail >= b->trail){
+         ts_put(b, 2, 2);
+         ts_put(b, xor >> b->trail, 32 - b->lead - b->trail);
+         }
+      else {
+         ts_put(b, 3, 2);
+         ts_put(b, lead, 5);
+         ts_put(b, 32 - lead - trail - 1, 5);
+         ts_put(b, xor >> trail, 32 - lead - trail);
+         b->lead = lead;
+         b->trail = trail;
+         }
+      }
+   b->delta = delta;
+   b->t_last = t;
+   b->v_prev = v;
+   b->count++;
+   s->points++;
+   s->t_last = t;
+   } /* ts_add */
+
+// Decode points from..to of a block
+static void ts_decode(const uint8_t* data, int count, time_t t, time_t from, time_t to, void (*fn)(time_t, float, void*), void* arg){
+   uint32_t v, xor;
+   long delta, dod;
+   int pos, n, lead, trail, len;
+   float value;
+
+   pos = 0;
+   v = ts_get(data, &pos, 32);
+   delta = 0;
+   lead = trail = 0;
+   for (n = 0; n < count; n++){
+      if (n > 0){
+         if (ts_get(data, &pos, 1) == 0) dod = 0;
+         else if (ts_get(data, &pos, 1) == 0) dod = ((int32_t)ts_get(data, &pos, 7) << 25) >> 25;
+         else if (ts_get(data, &pos, 1) == 0) dod = ((int32_t)ts_get(data, &pos, 9) << 23) >> 23;
+         else if (ts_get(data, &pos, 1) == 0) dod = ((int32_t)ts_get(data, &pos, 12) << 20) >> 20;
+         else dod = (int32_t)ts_get(data, &pos, 32);
+         delta = delta + dod;
+         t = t + delta;
+
+         if (ts_get(data, &pos, 1) == 1){
+            if (ts_get(data, &pos, 1) == 1){
+               lead = ts_get(data, &pos, 5);
+               len = ts_get(data, &pos, 5) + 1;
+               trail = 32 - lead - len;
+               }
+            xor = ts_get(data, &pos, 32 - lead - trail);
+            v = v ^ (xor << trail);
+            }
+         }
+      if (t > to) return;
+      memcpy(&value, &v, 4);
+      if (t >= from) fn(t, value, arg);
+      }
+   } /* ts_decode */
+
+// Points from..to of series y in time order - spilled blocks are read from TS_FILE
+void ts_query(int y, time_t from, time_t to, void (*fn)(time_t, float, void*), void* arg){
+   struct ts_block* b;
+   uint8_t data[TS_BLOCK_BYTES];
+   FILE* f;
+   int x;
+
+   if (ts[y].spilled > 0 && (f = fopen(TS_FILE, "rb")) != NULL){
+      for (x = 0; x < ts_num_spill; x++){
+         if (ts_spill[x].series != y || ts_spill[x].t_last < from || ts_spill[x].t_first > to || !ts_spill_valid(&ts_spill[x])) continue;
+         if (fseek(f, ts_spill[x].offset, SEEK_SET) == 0 && fread(data, 1, (ts_spill[x].bits + 7) / 8, f) == (ts_spill[x].bits + 7) / 8)
+            ts_decode(data, ts_spill[x].count, ts_spill[x].t_first, from, to, fn, arg);
+         }
+      fclose(f);
+      }
+   for (b = ts[y].first; b != NULL; b = b->next)
+      if (b->t_last >= from && b->t_first <= to)
+         ts_decode(b->data, b->count, b->t_first, from, to, fn, arg);
+   } /* ts_query */
+
+// Range query callbacks - arg is a struct ts_range
+void ts_minmax(time_t t, float value, void* arg){
+   struct ts_range* r = arg;
+
+   if (r->count == 0 || value < r->min) r->min = value;
+   if (r->count == 0 || value > r->max) r->max = value;
+   r->count++;
+   } /* ts_minmax */
+
+void ts_json(time_t t, float value, void* arg){
+   struct ts_range* r = arg;
+
+   fprintf(r->f, "%s[%li,%.2f]", r->count++ > 0 ? "," : "", (long)t, value);
+   } /* ts_json */
+
+// series.json next to index.html - points of the latest TS_JSON_HOURS hours of each series
+void ts_json_output(){
+   struct ts_range r;
+   FILE* f;
+   char key[48];
+   int x, y;
+
+   f = fopen("series.json", "w");
+   if (f == NULL) return;
+   fprintf(f, "{\"from\":%li,\"to\":%li,\"series\":[", (long)(current_time - TS_JSON_HOURS * 3600), (long)current_time);
+   for (x = 0, y = 0; y < num_obs; y++){
+      if (ts[y].points == 0) continue;
+      ts_key(key, y);
+      fprintf(f, "%s\n{\"series\":\"%s\",\"points\":[", x++ > 0 ? "," : "", key);
+      r.count = 0;
+      r.f = f;
+      ts_query(y, current_time - TS_JSON_HOURS * 3600, current_time, ts_json, &r);
+      fprintf(f, "]}");
+      }
+   fprintf(f, "\n]}\n");
+   overhead_file(OV_HTML, ftell(f));
+   fclose(f);
+   } /* ts_json_output */
+
+// Rollups - round robin archives for each group at 1m/5m/1h/1d in ROLLUP_FILE (mmap). Every sample is
+// added to the slot of its time in each archive, and a slot is cleared when its time comes round again.
+// The file is kept if it has the same groups, so history survives a restart
+int rollup_init(){
+   struct stat st;
+   size_t size;
+   int fd, x, same;
+
+   size = sizeof(struct rollup_header) + (size_t)num_groups * ROLLUP_ROWS * sizeof(struct rollup_slot);
+   fd = open(ROLLUP_FILE, O_RDWR | O_CREAT, 0644);
+   if (fd < 0) return 0;
+
+   // Same layout?
+   same = 0;
+   if (fstat(fd, &st) == 0 && st.st_size == size){
+      rollup = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (rollup == MAP_FAILED) rollup = NULL;
+      same = rollup != NULL && rollup_same();
+      if (!same && rollup != NULL) munmap(rollup, size);
+      }
+   if (!same){
+      if (ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0){
+         close(fd);
+         return 0;
+         }
+      rollup = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (rollup == MAP_FAILED){
+         rollup = NULL;
+         close(fd);
+         return 0;
+         }
+      memcpy(rollup->magic, ROLLUP_MAGIC, 8);
+      rollup->num_groups = num_groups;
+      for (x = 0; x < num_groups; x++)
+         snprintf(rollup->group[x], sizeof(rollup->group[x]), "%s", group[x].name);
+      }
+   close(fd);
+   return 1;
+   } /* rollup_init */
+
+// Mapped file has the groups of the configuration
+int rollup_same(){
+   int x;
+
+   if (memcmp(rollup->magic, ROLLUP_MAGIC, 8) != 0 || rollup->num_groups != num_groups) return 0;
+   for (x = 0; x < num_groups; x++)
+      if (strncmp(rollup->group[x], group[x].name, sizeof(rollup->group[x])) != 0) return 0;
+   return 1;
+   } /* rollup_same */
+
+// Read only mapping for -report - the file of a running probe is never changed. 0 = missing, -1 = other layout
+int rollup_open(){
+   struct stat st;
+   size_t size;
+   int fd;
+
+   size = sizeof(struct rollup_header) + (size_t)num_groups * ROLLUP_ROWS * sizeof(struct rollup_slot);
+   fd = open(ROLLUP_FILE, O_RDONLY);
+   if (fd < 0) return 0;
+   if (fstat(fd, &st) != 0 || st.st_size != size){
+      close(fd);
+      return -1;
+      }
+   rollup = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (rollup == MAP_FAILED){
+      rollup = NULL;
+      return 0;
+      }
+   if (!rollup_same()){
+      munmap(rollup, size);
+      rollup = NULL;
+      return -1;
+      }
+   return 1;
+   } /* rollup_open */
+
+// Slot of time t in archive r of group g
+struct rollup_slot* rollup_slot(int g, int r, time_t t){
+   return &rollup->slot[(size_t)g * ROLLUP_ROWS + rollup_res[r].first + (t / rollup_res[r].step) % rollup_res[r].rows];
+   } /* rollup_slot */
+
+// Add response time (ms) at time t - error if ms < 0
+void rollup_add(int g, time_t t, float ms){
+   struct rollup_slot* s;
+   int r, b;
+
+   if (rollup == NULL) return;
+   b = ms > 0 ? (int)(2 * log2(ms * 10)) + 1 : 0;
+   if (b < 0) b = 0;
+   if (b >= ROLLUP_BUCKETS) b = ROLLUP_BUCKETS - 1;
+   for (r = 0; r < ROLLUP_RES; r++){
+      s = rollup_slot(g, r, t);
+      if (s->start != t - t % rollup_res[r].step){
+         memset(s, 0, sizeof(*s));
+         s->start = t - t % rollup_res[r].step;
+         }
+      if (ms < 0){
+         s->errors++;
+         continue;
+         }
+      if (s->count == 0 || ms < s->min) s->min = ms;
+      if (s->count == 0 || ms > s->max) s->max = ms;
+      s->count++;
+      s->sum = s->sum + ms;
+      s->hist[b]++;
+      }
+   } /* rollup_add */
+
+// Percentile (ms) of slot - upper bound of bucket, ~41% resolution
+float rollup_percentile(struct rollup_slot* s, double p){
+   uint32_t n;
+   int b;
+
+   for (n = 0, b = 0; b < ROLLUP_BUCKETS; b++){
+      n = n + s->hist[b];
+      if (n >= p / 100 * s->count) break;
+      }
+   if (b == ROLLUP_BUCKETS) b--;
+   return b == 0 ? 0.1 : pow(2, b / 2.0) / 10;
+   } /* rollup_percentile */
+
+// Slots of archive r of group g from..to - one call for each step with data
+void rollup_query(int g, int r, time_t from, time_t to, void (*fn)(int, struct rollup_slot*, void*), void* arg){
+   struct rollup_slot* s;
+   time_t t;
+
+   if (rollup == NULL) return;
+   from = from - from % rollup_res[r].step;
+   if (to - from >= (time_t)rollup_res[r].step * rollup_res[r].rows) from = to - to % rollup_res[r].step - (time_t)rollup_res[r].step * (rollup_res[r].rows - 1);
+   for (t = from; t <= to; t = t + rollup_res[r].step){
+      s = rollup_slot(g, r, t);
+      if (s->start == t && (s->count > 0 || s->errors > 0)) fn(g, s, arg);
+      }
+   } /* rollup_query */
+
+static void rollup_csv(int g, struct rollup_slot* s, void* arg){
+   char timestamp[40];
+
+   strftime(timestamp, 40, "%Y-%m-%d %H:%M:%S", gmtime(&s->start));
+   printf("%s,%s,%u,%u,%.2f,%.2f,%.2f,%.2f,%.2f\n", timestamp, group[g].name, s->count, s->errors, s->count > 0 ? s->sum / s->count : 0,
+      s->min, s->max, rollup_percentile(s, 50), rollup_percentile(s, 99));
+   } /* rollup_csv */
+
+// -report 1m|5m|1h|1d - archive as CSV on stdout
+int rollup_report(char* res){
+   int g, r, rc;
+
+   for (r = 0; r < ROLLUP_RES && strcmp(res, rollup_res[r].name) != 0; r++) ;
+   if (r == ROLLUP_RES){
+      printf("DMIAPI: -report needs 1m, 5m, 1h or 1d - terminating\n");
+      return 3;
+      }
+   rc = rollup_open();
+   if (rc == 0){
+      printf("DMIAPI: Could not open %s - terminating\n", ROLLUP_FILE);
+      return 3;
+      }
+   if (rc < 0){
+      printf("DMIAPI: %s does not have the groups of the configuration - terminating\n", ROLLUP_FILE);
+      return 3;
+      }
+   printf("time,group,count,errors,avg,min,max,p50,p99\n");
+   for (g = 0; g < num_groups; g++)
+      rollup_query(g, r, time(NULL) - (time_t)rollup_res[r].step * rollup_res[r].rows, time(NULL), rollup_csv, NULL);
+   return 0;
+   } /* rollup_report */
+
+// Allocations are counted for overhead & -bench - every allocation of the process passes here.
+// Allocations in an active arena are not counted, they do not reach the heap
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+
+void* malloc(size_t size){
+   void* p;
+
+   if (arena_cur != NULL && (p = arena_alloc(arena_cur, size)) != NULL) return p;
+   atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+   return __libc_malloc(size);
+   } /* malloc */
+
+void* calloc(size_t n, size_t size){
+   void* p;
+
+   // n * size wraps - libc's calloc fails it
+   if (arena_cur != NULL && (size == 0 || n <= SIZE_MAX / size) && (p = arena_alloc(arena_cur, n * size)) != NULL)
+      return memset(p, 0, n * size);
+   atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+   return __libc_calloc(n, size);
+   } /* calloc */
+
+// A block in an arena is moved to a new block - in place if it is the latest
+void* realloc(void* ptr, size_t size){
+   struct arena* a;
+   size_t old;
+   void* p;
+
+   if ((char*)ptr >= arena_lo && (char*)ptr < arena_hi){
+      old = *(size_t*)((char*)ptr - 16);
+      a = arena_cur;
+      if (a != NULL && (char*)ptr + ((old + 15) & ~15) == a->base + a->used && a->used + ((size + 15) & ~15) - ((old + 15) & ~15) <= a->size){
+         a->used = a->used + ((size + 15) & ~15) - ((old + 15) & ~15);
+         *(size_t*)((char*)ptr - 16) = size;
+         if ((long)a->used > atomic_load_explicit(&a->high, memory_order_relaxed)) atomic_store_explicit(&a->high, a->used, memory_order_relaxed);
+         return ptr;
+         }
+      if ((p = malloc(size)) != NULL) memcpy(p, ptr, old < size ? old : size);
+      return p;
+      }
+   atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+   return __libc_realloc(ptr, size);
+   } /* realloc */
+
+void free(void* ptr){
+   if ((char*)ptr >= arena_lo && (char*)ptr < arena_hi) return;
+   __libc_free(ptr);
+   } /* free */
+
+// n arenas of [ARENA] kB in one region - before the threads using them are started
+void arena_init(int n){
+   size_t size;
+   int x;
+
+   size = (strlen(arena_size) > 0 ? atol(arena_size) : 4096) * 1024;
+   arenas = calloc(n, sizeof(struct arena));
+   arena_lo = malloc(n * size);
+   if (arena_lo == NULL){
+      write_syslog("Could not allocate arenas - JSON is parsed on the heap", 2);
+      return;
+      }
+   arena_hi = arena_lo + n * size;
+   num_arenas = n;
+   for (x = 0; x < n; x++){
+      arenas[x].base = arena_lo + x * size;
+      arenas[x].size = size;
+      arenas[x].used = 0;
+      atomic_init(&arenas[x].high, 0);
+      atomic_init(&arenas[x].overflow, 0);
+      }
+   } /* arena_init */
+
+// Block of size bytes with the size in front - NULL if the arena is full
+void* arena_alloc(struct arena* a, size_t size){
+   char* p;
+   size_t n;
+
+   if (a->base == NULL) return NULL;
+   n = 16 + ((size + 15) & ~15);
+   if (a->used + n > a->size){
+      atomic_fetch_add_explicit(&a->overflow, 1, memory_order_relaxed);
+      return NULL;
+      }
+   p = a->base + a->used;
+   *(size_t*)p = size;
+   a->used = a->used + n;
+   if ((long)a->used > atomic_load_explicit(&a->high, memory_order_relaxed)) atomic_store_explicit(&a->high, a->used, memory_order_relaxed);
+   return p + 16;
+   } /* arena_alloc */
+
+// All blocks are released - nothing may point into the arena any more
+void arena_reset(struct arena* a){
+   if (a != NULL) a->used = 0;
+   } /* arena_reset */
+
+// Block from the free list of its size class, or from the heap
+void* pool_alloc(size_t size){
+   struct pool_head* h;
+   int c;
+
+   for (c = 0; c < POOL_CLASSES && (size_t)(64 << c) < size; c++);
+   if (c < POOL_CLASSES && pool_free_list[c] != NULL){
+      h = pool_free_list[c];
+      pool_free_list[c] = *(void**)(h + 1);
+      pool_free_count[c]--;
+      }
+   else {
+      atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+      h = __libc_malloc(sizeof(struct pool_head) + (c < POOL_CLASSES ? (size_t)(64 << c) : size));
+      if (h == NULL) return NULL;
+      }
+   h->class = c < POOL_CLASSES ? c : -1;
+   h->size = size;
+   return h + 1;
+   } /* pool_alloc */
+
+void* pool_realloc(void* ptr, size_t size){
+   struct pool_head* h;
+   void* p;
+
+   if (ptr == NULL) return pool_alloc(size);
+   h = (struct pool_head*)ptr - 1;
+   if (h->class >= 0 && size <= (size_t)(64 << h->class)){
+      h->size = size;
+      return ptr;
+      }
+   if ((p = pool_alloc(size)) == NULL) return NULL;
+   memcpy(p, ptr, h->size < size ? h->size : size);
+   pool_free(ptr);
+   return p;
+   } /* pool_realloc */
+
+// Block is kept on the free list of the freeing thread - up to POOL_KEEP of each class
+void pool_free(void* ptr){
+   struct pool_head* h;
+
+   if (ptr == NULL) return;
+   h = (struct pool_head*)ptr - 1;
+   if (h->class < 0 || pool_free_count[h->class] >= POOL_KEEP){
+      __libc_free(h);
+      return;
+      }
+   *(void**)(h + 1) = pool_free_list[h->class];
+   pool_free_list[h->class] = h;
+   pool_free_count[h->class]++;
+   } /* pool_free */
+
+// Allocators of the libraries
+void* pool_crypto_malloc(size_t size, const char* file, int line){
+   return pool_alloc(size);
+   } /* pool_crypto_malloc */
+
+void* pool_crypto_realloc(void* ptr, size_t size, const char* file, int line){
+   return pool_realloc(ptr, size);
+   } /* pool_crypto_realloc */
+
+void pool_crypto_free(void* ptr, const char* file, int line){
+   pool_free(ptr);
+   } /* pool_crypto_free */
+
+void* pool_h2_malloc(size_t size, void* user_data){
+   return pool_alloc(size);
+   } /* pool_h2_malloc */
+
+void* pool_h2_calloc(size_t n, size_t size, void* user_data){
+   void* p;
+
+   if ((p = pool_alloc(n * size)) != NULL) memset(p, 0, n * size);
+   return p;
+   } /* pool_h2_calloc */
+
+void* pool_h2_realloc(void* ptr, size_t size, void* user_data){
+   return pool_realloc(ptr, size);
+   } /* pool_h2_realloc */
+
+void pool_h2_free(void* ptr, void* user_data){
+   pool_free(ptr);
+   } /* pool_h2_free */
+
+void* pool_br_alloc(void* opaque, size_t size){
+   return pool_alloc(size);
+   } /* pool_br_alloc */
+
+void pool_br_free(void* opaque, void* ptr){
+   pool_free(ptr);
+   } /* pool_br_free */
+
+// -bench: parse, transaction id/date & decode of a corpus of responses. Built in responses (small,
+// large batch, chunked at many sizes, gzip) & raw responses in [BENCH_CORPUS]/*.http. Compared to
+// [BENCH_BASELINE] - returns 1 if ns/op is more than [BENCH_TOLERANCE] % above or allocs/op is higher
+int bench_run(int save){
+   const char* op_name[] = {"parse", "meta", "decode"};
+   const int chunks[] = {1, 7, 64, 700, 4096};
+   char base_name[BENCH_CASES * 3][50], name[50], line[300], path[500];
+   double base_ns[BENCH_CASES * 3], base_allocs[BENCH_CASES * 3];
+   double ns, allocs, mbs, tolerance;
+   int num_base, x, op, b, failed;
+   long len, bytes;
+   char *small, *large;
+   FILE* f;
+   DIR* dir;
+   struct dirent* de;
+
+   if (strlen(bench_baseline) == 0) strcpy(bench_baseline, "dmiapi.bench");
+   tolerance = strlen(bench_tolerance) > 0 ? atof(bench_tolerance) : 20;
+   arena_init(1);
+   arena_own = &arenas[0];
+
+   // Corpus
+   small = bench_body(1, &len);
+   bench_add("small", small, len, 0, 0, 16384, 0);
+   bench_add("small-read1", small, len, 0, 0, 1, 0);
+   bench_add("small-read13", small, len, 0, 0, 13, 0);
+   large = bench_body(340, &len);
+   bench_add("large", large, len, 0, 0, 16384, 1);
+   for (x = 0; x < sizeof(chunks) / sizeof(chunks[0]); x++){
+      snprintf(name, sizeof(name), "large-chunk%i", chunks[x]);
+      bench_add(name, large, len, chunks[x], 0, 1448, 1);
+      }
+   bench_add("large-gzip", large, len, 4096, 1, 1448, 1);
+   if (strlen(bench_corpus) > 0 && (dir = opendir(bench_corpus)) != NULL){
+      while ((de = readdir(dir)) != NULL && num_bench < BENCH_CASES){
+         if (strlen(de->d_name) < 6 || strcmp(de->d_name + strlen(de->d_name) - 5, ".http") != 0) continue;
+         snprintf(path, sizeof(path), "%s/%s", bench_corpus, de->d_name);
+         if ((f = fopen(path, "r")) == NULL) continue;
+         fseek(f, 0, SEEK_END);
+         bytes = ftell(f);
+         fseek(f, 0, SEEK_SET);
+         bench_case[num_bench].data = bytes >= 0 ? malloc(bytes + 1) : NULL;
+         if (bench_case[num_bench].data != NULL && fread(bench_case[num_bench].data, 1, bytes, f) == bytes){
+            bench_case[num_bench].data[bytes] = 0; // strstr below
+            snprintf(bench_case[num_bench].name, 40, "%.*s", (int)strlen(de->d_name) - 5, de->d_name);
+            bench_case[num_bench].len = bytes;
+            bench_case[num_bench].read_size = 16384;
+            bench_case[num_bench].batch = strstr(bench_case[num_bench].data, "\"numberReturned\":1,") == NULL;
+            num_bench++;
+            }
+         else free(bench_case[num_bench].data);
+         fclose(f);
+         }
+      closedir(dir);
+      }
+
+   // Baseline
+   num_base = 0;
+   f = save ? NULL : fopen(bench_baseline, "r");
+   while (f != NULL && num_base < BENCH_CASES * 3 && fgets(line, sizeof(line), f) != NULL)
+      if (sscanf(line, "%49s %lf %lf", base_name[num_base], &base_ns[num_base], &base_allocs[num_base]) == 3) num_base++;
+   if (f != NULL) fclose(f);
+
+   printf("DMIAPI %s -bench, baseline %s, tolerance %.0f %%\n", VERSION, num_base > 0 ? bench_baseline : "none", tolerance);
+   printf("%-24s %-7s %10s %10s %10s %10s\n", "Case", "Path", "ns/op", "MB/s", "allocs/op", "Baseline");
+   f = num_base == 0 ? fopen(bench_baseline, "w") : NULL;
+   failed = 0;
+   for (x = 0; x < num_bench; x++)
+      for (op = 0; op < 3; op++){
+         ns = bench_time(op, &bench_case[x], &allocs);
+         bytes = op == 0 ? bench_case[x].len : op == 1 ? bench_hp.header_len : bench_hp.body_len;
+         mbs = ns > 0 ? bytes / ns * 1e9 / 1e6 : 0;
+         snprintf(name, sizeof(name), "%.39s/%.9s", bench_case[x].name, op_name[op]);
+         for (b = 0; b < num_base && strcmp(base_name[b], name) != 0; b++) ;
+         if (b < num_base){
+            printf("%-24s %-7s %10.0f %10.1f %10.2f %10.0f %s\n", bench_case[x].name, op_name[op], ns, mbs, allocs, base_ns[b],
+               ns > base_ns[b] * (1 + tolerance / 100) || allocs > base_allocs[b] + 0.01 ? "REGRESSION" : "");
+            if (ns > base_ns[b] * (1 + tolerance / 100) || allocs > base_allocs[b] + 0.01) failed = 1;
+            }
+         else
+            printf("%-24s %-7s %10.0f %10.1f %10.2f %10s\n", bench_case[x].name, op_name[op], ns, mbs, allocs, "-");
+         if (f != NULL) fprintf(f, "%s %.1f %.2f\n", name, ns, allocs);
+         }
+   if (f != NULL){
+      fclose(f);
+      printf("Baseline written to %s\n", bench_baseline);
+      }
+   return failed;
+   } /* bench_run */
+
+// Add case to corpus - body framed by Content-Length or in chunks of chunk bytes, optionally gzip'ed
+void bench_add(const char* name, char* body, long body_len, int chunk, int gzip, int read_size, int batch){
+   struct bench_case* bc;
+   z_stream z;
+   char* coded;
+   long len, off, n, size;
+
+   if (num_bench == BENCH_CASES) return;
+   coded = body;
+   if (gzip){
+      coded = malloc(body_len + 1024);
+      memset(&z, 0, sizeof(z));
+      deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+      z.next_in = (Bytef*)body;
+      z.avail_in = body_len;
+      z.next_out = (Bytef*)coded;
+      z.avail_out = body_len + 1024;
+      deflate(&z, Z_FINISH);
+      body_len = z.total_out;
+      deflateEnd(&z);
+      }
+
+   bc = &bench_case[num_bench++];
+   snprintf(bc->name, sizeof(bc->name), "%s", name);
+   bc->read_size = read_size;
+   bc->batch = batch;
+   size = 1024 + body_len + (chunk > 0 ? (body_len / chunk + 1) * 16 : 0);
+   bc->data = malloc(size);
+   len = snprintf(bc->data, size, "HTTP/1.1 200 OK\r\nDate: Sun, 18 Oct 2026 12:00:00 GMT\r\nContent-Type: application/geo+json\r\n"
+      "x-gravitee-transaction-id: 5f0c1e2a-7b3d-4c8e-9a1f-2d3e4f5a6b7c\r\n%s", gzip ? "Content-Encoding: gzip\r\n" : "");
+   if (chunk == 0){
+      len += snprintf(bc->data + len, size - len, "Content-Length: %li\r\n\r\n", body_len);
+      memcpy(bc->data + len, coded, body_len);
+      len = len + body_len;
+      }
+   else {
+      len += snprintf(bc->data + len, size - len, "Transfer-Encoding: chunked\r\n\r\n");
+      for (off = 0; off < body_len; off = off + n){
+         n = body_len - off < chunk ? body_len - off : chunk;
+         len += snprintf(bc->data + len, size - len, "%lx\r\n", n);
+         memcpy(bc->data + len, coded + off, n);
+         len = len + n;
+         memcpy(bc->data + len, "\r\n", 2);
+         len = len + 2;
+         }
+      len += snprintf(bc->data + len, size - len, "0\r\n\r\n");
+      }
+   bc->len = len;
+   if (gzip) free(coded);
+   } /* bench_add */
+
+// GeoJSON like metObs with features for the stations in turn
+char* bench_body(int features, long* len){
+   char* body;
+   long size;
+   int x, n;
+
+   size = 300 + features * 300L;
+   body = malloc(size);
+   n = snprintf(body, size, "{\"type\":\"FeatureCollection\",\"features\":[");
+   for (x = 0; x < features; x++)
+      n += snprintf(body + n, size - n, "%s{\"geometry\":{\"coordinates\":[10.%04i,56.%04i],\"type\":\"Point\"},"
+         "\"id\":\"0a1b2c3d-0000-4000-8000-%012i\",\"type\":\"Feature\",\"properties\":{\"created\":\"2026-10-18T12:00:01Z\","
+         "\"observed\":\"2026-10-18T%02i:%02i:00Z\",\"parameterId\":\"temp_dry\",\"stationId\":\"%s\",\"value\":%.1f}}",
+         x > 0 ? "," : "", x * 37 % 10000, x * 91 % 10000, x, 11 - x / 17 / 6 % 12, 50 - x / 17 % 6 * 10,
+         stations_liste[x % 17].kode, (x * 37 % 250) / 10.0 - 5);
+   n += snprintf(body + n, size - n, "],\"timeStamp\":\"2026-10-18T12:00:01Z\",\"numberReturned\":%i,\"links\":[]}", features);
+   *len = n;
+   return body;
+   } /* bench_body */
+
+// One operation on case: 0 = parse response, 1 = transaction id & date, 2 = decode body
+void bench_op(int op, struct bench_case* bc){
+   long off;
+
+   switch (op){
+      case 0:
+         if (bench_hp.json != NULL) json_object_put(bench_hp.json);
+         json_tokener_reset(bench_tok);
+         arena_reset(arena_own);
+         http_parser_init(&bench_hp, bench_buf, MAX_BODY);
+         if (bc->batch) bench_hp.tok = bench_tok;
+         for (off = 0; off < bc->len && bench_hp.state != HP_DONE && bench_hp.state != HP_ERROR; off = off + bc->read_size)
+            http_parse(&bench_hp, bc->data + off, bc->len - off < bc->read_size ? bc->len - off : bc->read_size);
+         break;
+      case 1:
+         bench_smp.http_ret = bench_hp.status;
+         api_meta(&bench_hp, &bench_smp);
+         break;
+      case 2:
+         if (bc->batch) decode_batch(0, bench_hp.json, &bench_smp);
+         else {
+            decode_data(0, bench_buf, &bench_smp);
+            arena_reset(arena_own);
+            }
+         break;
+      }
+   } /* bench_op */
+
+// ns per op - best of 5 runs of at least 50 ms each. allocs is per op
+double bench_time(int op, struct bench_case* bc, double* allocs){
+   int64_t t0, t;
+   double best;
+   long n, x, a0;
+   int run;
+
+   if (bench_buf == NULL){
+      bench_buf = malloc(MAX_BODY);
+      bench_tok = json_tokener_new();
+      }
+   bench_op(0, bc); // Response of case in bench_hp
+   bench_op(op, bc);
+
+   for (n = 1; n < (1L << 24); n = n * 2){
+      t0 = raw_ns();
+      for (x = 0; x < n; x++) bench_op(op, bc);
+      if (raw_ns() - t0 > 50000000) break;
+      }
+   best = 0;
+   for (run = 0; run < 5; run++){
+      a0 = atomic_load_explicit(&alloc_count, memory_order_relaxed);
+      t0 = raw_ns();
+      for (x = 0; x < n; x++) bench_op(op, bc);
+      t = raw_ns() - t0;
+      *allocs = (double)(atomic_load_explicit(&alloc_count, memory_order_relaxed) - a0) / n;
+      if (run == 0 || (double)t / n < best) best = (double)t / n;
+      }
+   return best;
+   } /* bench_time */
+
+// Start of an exchange on a connection: count requests for samples smp sent at t0
+void capture_begin(struct worker* w, struct sample* smp, int count, struct stamp* t0){
+   struct capture_buf* c;
+   int n;
+
+   c = w->cap;
+   if (c == NULL) return;
+   c->head.sent = real_ns();
+   c->head.len = 0;
+   c->head.count = count;
+   c->head.reads = 0;
+   c->t0 = t0->raw;
+   for (n = 0; n < count; n++){
+      c->target[2 * n] = smp[n].api;
+      c->target[2 * n + 1] = smp[n].target;
+      }
+   } /* capture_begin */
+
+// Bytes of one SSL_read - an exchange longer than CAPTURE_READS reads or CAPTURE_BYTES is cut
+void capture_read(struct worker* w, const char* data, int len){
+   struct capture_buf* c;
+
+   c = w->cap;
+   if (c == NULL || c->head.count == 0 || c->head.reads == CAPTURE_READS || c->head.len + len > CAPTURE_BYTES) return;
+   c->read[c->head.reads].ns = raw_ns() - c->t0;
+   c->read[c->head.reads].len = len;
+   memcpy(c->data + c->head.len, data, len);
+   c->head.reads++;
+   c->head.len = c->head.len + len;
+   } /* capture_read */
+
+// End of exchange - record is appended to [CAPTURE]. Header is written if the file is new
+void capture_end(struct worker* w){
+   struct capture_buf* c;
+   static int failed;
+   uint32_t n;
+
+   c = w->cap;
+   if (c == NULL || c->head.count == 0) return;
+   pthread_mutex_lock(&capture_lock);
+   if (capture_out == NULL && !failed){
+      capture_out = fopen(capture, "ab");
+      if (capture_out == NULL){
+         write_syslog("Could not open [CAPTURE] - no capture", 2);
+         failed = 1;
+         }
+      else {
+         fseek(capture_out, 0, SEEK_END);
+         if (ftell(capture_out) == 0){
+            n = num_targets;
+            fwrite(CAPTURE_MAGIC, 8, 1, capture_out);
+            fwrite(&n, sizeof(n), 1, capture_out);
+            }
+         }
+      }
+   if (capture_out != NULL){
+      fwrite(&c->head, sizeof(c->head), 1, capture_out);
+      fwrite(c->target, sizeof(uint16_t), 2 * c->head.count, capture_out);
+      fwrite(c->read, sizeof(struct capture_read), c->head.reads, capture_out);
+      fwrite(c->data, 1, c->head.len, capture_out);
+      fflush(capture_out);
+      overhead_write(OV_DATA, sizeof(c->head) + sizeof(uint16_t) * 2 * c->head.count + sizeof(struct capture_read) * c->head.reads + c->head.len);
+      }
+   pthread_mutex_unlock(&capture_lock);
+   c->head.count = 0;
+   } /* capture_end */
+
+// -replay: one worker feeds the captured responses to the parser instead of the network
+void replay_start(){
+   char magic[8];
+   uint32_t n;
+
+   replay_in = fopen(replay_file, "rb");
+   if (replay_in == NULL){
+      printf("Could not open %s\n", replay_file);
+      goodbye(3);
+      }
+   if (fread(magic, 8, 1, replay_in) != 1 || memcmp(magic, CAPTURE_MAGIC, 8) != 0 ||
+      fread(&n, sizeof(n), 1, replay_in) != 1){
+      printf("%s is not a capture file\n", replay_file);
+      goodbye(3);
+      }
+   // Check: targets are referred to by index
+   if (n != (uint32_t)num_targets){
+      printf("%s is captured with %u targets - configuration has %i\n", replay_file, n, num_targets);
+      goodbye(3);
+      }
+
+   sample_fd = eventfd(0, 0);
+   num_workers = 1;
+   workers = calloc(num_workers, sizeof(struct worker));
+   workers[0].tok = json_tokener_new();
+   workers[0].cap = malloc(sizeof(struct capture_buf));
+   arena_init(1);
+   workers[0].arena = &arenas[0];
+   atomic_init(&workers[0].shard.head, 0);
+   atomic_init(&workers[0].shard.tail, 0);
+   atomic_init(&workers[0].shard.dropped, 0);
+   if (sample_fd < 0 || pthread_create(&workers[0].thread, NULL, replay_main, &workers[0]) != 0){
+      write_syslog("Could not start replay thread - terminating", 3);
+      goodbye(3);
+      }
+   } /* replay_start */
+
+// Exchanges as fast as possible or with their original spacing ("paced"). Response times are the captured ones
+void* replay_main(void* arg){
+   struct worker* w;
+   struct capture_buf* c;
+   struct http_parser* hp;
+   struct stamp t0, t_first, t_read;
+   struct sample* smp;
+   struct timespec ts;
+   uint64_t one;
+   int64_t start, first_sent, wait;
+   long pos, off;
+   int x, n, count;
+
+   w = (struct worker*)arg;
+   arena_own = w->arena;
+   c = w->cap;
+   hp = &w->hp;
+   one = 1;
+   memset(&t0, 0, sizeof(t0));
+   memset(&t_first, 0, sizeof(t_first));
+   memset(&t_read, 0, sizeof(t_read));
+   first_sent = 0;
+   start = raw_ns();
+   while (fread(&c->head, sizeof(c->head), 1, replay_in) == 1){
+      count = c->head.count;
+      if (count > MAX_STREAMS || c->head.reads > CAPTURE_READS || c->head.len > CAPTURE_BYTES ||
+         fread(c->target, sizeof(uint16_t), 2 * count, replay_in) != (size_t)(2 * count) ||
+         fread(c->read, sizeof(struct capture_read), c->head.reads, replay_in) != c->head.reads ||
+         fread(c->data, 1, c->head.len, replay_in) != c->head.len){
+         write_syslog("Capture file is damaged - replay stopped", 2);
+         break;
+         }
+      for (n = 0; n < count; n++)
+         if (c->target[2 * n] >= num_groups || c->target[2 * n + 1] >= num_targets) break;
+      if (n < count){
+         write_syslog("Capture file is damaged - replay stopped", 2);
+         break;
+         }
+
+      if (first_sent == 0) first_sent = c->head.sent;
+      if (replay_paced){
+         wait = c->head.sent - first_sent - (raw_ns() - start);
+         if (wait > 0){
+            ts.tv_sec = wait / 1000000000LL;
+            ts.tv_nsec = wait % 1000000000LL;
+            nanosleep(&ts, NULL);
+            }
+         }
+
+      // Responses in order as in api_pipeline - the reads are as they came from SSL_read
+      json_tokener_reset(w->tok);
+      arena_reset(w->arena);
+      for (n = 0; n < count; n++){
+         sample_init(&w->pipe[n], c->target[2 * n], c->target[2 * n + 1]);
+         w->pipe[n].online = -1; // No response
+         }
+      n = 0;
+      pos = 0;
+      http_parser_init(hp, w->body, MAX_BODY);
+      if (count > 0 && target.station[w->pipe[0].target] == TARGET_BATCH){
+         json_tokener_reset(w->tok);
+         hp->tok = w->tok;
+         }
+      for (x = 0; x < c->head.reads && n < count; x++){
+         t_read.raw = c->read[x].ns;
+         off = 0;
+         while (off < c->read[x].len && n < count){
+            if (hp->wire_len == 0) t_first = t_read;
+            off = off + http_parse(hp, c->data + pos + off, c->read[x].len - off);
+            if (hp->state == HP_DONE || hp->state == HP_ERROR){
+               sample_time(&w->pipe[n], &t0, &t_first, &t_read);
+               w->pipe[n].online = api_response(hp, w->pipe[n].target, &w->pipe[n]);
+               n++;
+               if (hp->state == HP_ERROR) break;
+               http_parser_init(hp, w->body, MAX_BODY);
+               if (n < count && target.station[w->pipe[n].target] == TARGET_BATCH){
+                  json_tokener_reset(w->tok);
+                  hp->tok = w->tok;
+                  }
+               }
+            }
+         pos = pos + c->read[x].len;
+         if (hp->state == HP_ERROR) break;
+         }
+      // Body ended by close
+      if (n < count && hp->state == HP_BODY_EOF){
+         hp->state = HP_DONE;
+         sample_time(&w->pipe[n], &t0, &t_first, &t_read);
+         w->pipe[n].online = api_response(hp, w->pipe[n].target, &w->pipe[n]);
+         n++;
+         }
+      else if (hp->json != NULL){
+         json_object_put(hp->json);
+         hp->json = NULL;
+         }
+      replay_exchanges++;
+      replay_responses = replay_responses + n;
+      replay_bytes = replay_bytes + c->head.len;
+
+      // Main thread is not dropping samples in a replay - wait for room in ring
+      for (n = 0; n < count; n++){
+         while ((smp = shard_slot(&w->shard)) == NULL){
+            write(sample_fd, &one, sizeof(one));
+            ts.tv_sec = 0;
+            ts.tv_nsec = 1000000;
+            nanosleep(&ts, NULL);
+            }
+         memcpy(smp, &w->pipe[n], sizeof(struct sample));
+         smp->interval_ns = sched[smp->api].interval_ns;
+         smp->missed = 0;
+         shard_push(&w->shard);
+         }
+      write(sample_fd, &one, sizeof(one));
+      }
+   replay_ns = raw_ns() - start;
+   atomic_store_explicit(&replay_done, 1, memory_order_release);
+   write(sample_fd, &one, sizeof(one));
+   return NULL;
+   } /* replay_main */
+
+// Throughput of replay - returncode for goodbye()
+int replay_summary(){
+   double s;
+
+   s = replay_ns > 0 ? replay_ns / 1e9 : 1e-9;
+   printf("\nReplay of %s: %li exchanges, %li responses, %.1f MB in %.3f s - %.0f responses/s, %.1f MB/s\n",
+      replay_file, replay_exchanges, replay_responses, replay_bytes / 1e6, s, replay_responses / s, replay_bytes / 1e6 / s);
+   return 0;
+   } /* replay_summary */
+
+// I/O of subsystem sub - called from all threads
+void overhead_io(int sub, long syscalls, long bytes){
+   atomic_fetch_add_explicit(&ov_io[sub].syscalls, syscalls, memory_order_relaxed);
+   atomic_fetch_add_explicit(&ov_io[sub].bytes, bytes, memory_order_relaxed);
+   } /* overhead_io */
+
+// Bytes written & flushed through stdio - one write syscall for each buffer
+void overhead_write(int sub, long bytes){
+   overhead_io(sub, (bytes + OVERHEAD_BUFFER - 1) / OVERHEAD_BUFFER, bytes);
+   } /* overhead_write */
+
+// File opened, written & closed - openat, fstat & close besides the writes
+void overhead_file(int sub, long bytes){
+   overhead_io(sub, 3 + (bytes + OVERHEAD_BUFFER - 1) / OVERHEAD_BUFFER, bytes);
+   } /* overhead_file */
+
+// BIO callback on probe connections - each read & write of the socket BIO is one syscall
+long overhead_bio(BIO* b, int oper, const char* argp, size_t len, int argi, long argl, int ret, size_t* processed){
+   if (oper == (BIO_CB_WRITE | BIO_CB_RETURN)) overhead_io(OV_NET, 1, ret > 0 ? *processed : 0);
+   if (oper == (BIO_CB_READ | BIO_CB_RETURN)) overhead_io(OV_NET, 1, 0);
+   return ret;
+   } /* overhead_bio */
+
+// Snapshot of own cost every OVERHEAD_NS - figures per cycle are from the latest period
+void overhead_update(){
+   struct rusage ru;
+   FILE* f;
+   char line[80];
+   int64_t now;
+   int x;
+
+   now = raw_ns();
+   if (ov_now.at != 0 && now - ov_now.at < OVERHEAD_NS) return;
+   ov_prev = ov_now;
+   getrusage(RUSAGE_SELF, &ru);
+   ov_now.at = now;
+   ov_now.cycles = ov_cycles;
+   ov_now.utime = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+   ov_now.stime = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+   ov_now.nvcsw = ru.ru_nvcsw;
+   ov_now.nivcsw = ru.ru_nivcsw;
+   ov_now.allocs = atomic_load_explicit(&alloc_count, memory_order_relaxed);
+   ov_now.connects = atomic_load_explicit(&ov_connects, memory_order_relaxed);
+   for (x = 0; x < OV_SUBS; x++){
+      ov_now.syscalls[x] = atomic_load_explicit(&ov_io[x].syscalls, memory_order_relaxed);
+      ov_now.bytes[x] = atomic_load_explicit(&ov_io[x].bytes, memory_order_relaxed);
+      }
+   if ((f = fopen("/proc/self/io", "r")) != NULL){
+      while (fgets(line, sizeof(line), f) != NULL){
+         sscanf(line, "syscr: %li", &ov_now.syscr);
+         sscanf(line, "syscw: %li", &ov_now.syscw);
+         }
+      fclose(f);
+      }
+   if (ov_prev.at != 0) overhead_prom();
+   } /* overhead_update */
+
+// Per cycle between the two latest snapshots - 0 until there are two
+double overhead_cycle(double now, double prev){
+   if (ov_prev.at == 0 || ov_now.cycles == ov_prev.cycles) return 0;
+   return (now - prev) / (ov_now.cycles - ov_prev.cycles);
+   } /* overhead_cycle */
+
+// Counters in Prometheus text format. Written to a temporary file & renamed, so a reader never sees half a file
+void overhead_prom(){
+   FILE* f;
+   int x;
+
+   if ((f = fopen(OVERHEAD_FILE ".tmp", "w")) == NULL) return;
+   fprintf(f, "# HELP dmiapi_cycles_total Samples handled by the probe\n# TYPE dmiapi_cycles_total counter\n");
+   fprintf(f, "dmiapi_cycles_total %li\n", ov_now.cycles);
+   fprintf(f, "# HELP dmiapi_cpu_seconds_total CPU time of the probe\n# TYPE dmiapi_cpu_seconds_total counter\n");
+   fprintf(f, "dmiapi_cpu_seconds_total{mode=\"user\"} %.6f\n", ov_now.utime);
+   fprintf(f, "dmiapi_cpu_seconds_total{mode=\"system\"} %.6f\n", ov_now.stime);
+   fprintf(f, "# HELP dmiapi_context_switches_total Context switches of the probe\n# TYPE dmiapi_context_switches_total counter\n");
+   fprintf(f, "dmiapi_context_switches_total{type=\"voluntary\"} %li\n", ov_now.nvcsw);
+   fprintf(f, "dmiapi_context_switches_total{type=\"involuntary\"} %li\n", ov_now.nivcsw);
+   fprintf(f, "# HELP dmiapi_allocations_total Calls of malloc, calloc & realloc\n# TYPE dmiapi_allocations_total counter\n");
+   fprintf(f, "dmiapi_allocations_total %li\n", ov_now.allocs);
+   fprintf(f, "# HELP dmiapi_connections_total Connections made to gateways\n# TYPE dmiapi_connections_total counter\n");
+   fprintf(f, "dmiapi_connections_total %li\n", ov_now.connects);
+   fprintf(f, "# HELP dmiapi_syscalls_total Syscalls of each subsystem\n# TYPE dmiapi_syscalls_total counter\n");
+   for (x = 0; x < OV_SUBS; x++)
+      fprintf(f, "dmiapi_syscalls_total{subsystem=\"%s\"} %li\n", ov_name[x], ov_now.syscalls[x]);
+   fprintf(f, "# HELP dmiapi_written_bytes_total Bytes written by each subsystem\n# TYPE dmiapi_written_bytes_total counter\n");
+   for (x = 0; x < OV_SUBS; x++)
+      fprintf(f, "dmiapi_written_bytes_total{subsystem=\"%s\"} %li\n", ov_name[x], ov_now.bytes[x]);
+   fprintf(f, "# HELP dmiapi_kernel_syscalls_total Read & write syscalls of the process (/proc/self/io)\n# TYPE dmiapi_kernel_syscalls_total counter\n");
+   fprintf(f, "dmiapi_kernel_syscalls_total{op=\"read\"} %li\n", ov_now.syscr);
+   fprintf(f, "dmiapi_kernel_syscalls_total{op=\"write\"} %li\n", ov_now.syscw);
+   fprintf(f, "# HELP dmiapi_timing_floor_seconds Timer wake-up latency & busy loop gap measured at start\n# TYPE dmiapi_timing_floor_seconds gauge\n");
+   fprintf(f, "dmiapi_timing_floor_seconds{measure=\"wake_p50\"} %.9f\n", jitter_floor.wake_p50 / 1e9);
+   fprintf(f, "dmiapi_timing_floor_seconds{measure=\"wake_p99\"} %.9f\n", jitter_floor.wake_p99 / 1e9);
+   fprintf(f, "dmiapi_timing_floor_seconds{measure=\"wake_max\"} %.9f\n", jitter_floor.wake_max / 1e9);
+   fprintf(f, "dmiapi_timing_floor_seconds{measure=\"loop_gap_max\"} %.9f\n", jitter_floor.gap_max / 1e9);
+   overhead_file(OV_HTML, ftell(f));
+   fclose(f);
+   rename(OVERHEAD_FILE ".tmp", OVERHEAD_FILE);
+   } /* overhead_prom */
+
+// Shared memory segment [SHM] - created empty, groups are filled by shm_publish
+void shm_init(){
+   int fd, pid;
+   void* p;
+
+   // A segment of a probe that did not exit normally is taken over - a running probe keeps its segment
+   fd = shm_open(shm_name, O_CREAT | O_EXCL | O_RDWR, 0644);
+   if (fd < 0 && errno == EEXIST){
+      if ((pid = shm_owner()) != 0){
+         printf("DMIAPI: [SHM] %s is used by the probe with pid %i - terminating\n", shm_name, pid);
+         write_syslog("[SHM] is used by another probe - terminating", 3);
+         goodbye(3);
+         }
+      shm_unlink(shm_name);
+      fd = shm_open(shm_name, O_CREAT | O_EXCL | O_RDWR, 0644);
+      }
+   if (fd < 0 || ftruncate(fd, sizeof(struct shm_segment)) != 0){
+      write_syslog("Could not create [SHM] segment - no live statistics", 2);
+      if (fd >= 0) close(fd);
+      return;
+      }
+   p = mmap(NULL, sizeof(struct shm_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if (p == MAP_FAILED){
+      write_syslog("Could not map [SHM] segment - no live statistics", 2);
+      return;
+      }
+   shm_seg = p;
+   memset(shm_seg, 0, sizeof(struct shm_segment));
+   shm_seg->version = SHM_VERSION;
+   shm_seg->size = sizeof(struct shm_segment);
+   shm_seg->pid = getpid();
+   shm_seg->num_groups = num_groups;
+   atomic_thread_fence(memory_order_release);
+   shm_seg->magic = SHM_MAGIC;		// Last - the layout is valid
+   } /* shm_init */
+
+// Pid of the running probe publishing [SHM] - 0 if the segment is not from a running dmiapi
+int shm_owner(){
+   struct shm_segment* seg;
+   struct stat st;
+   int fd, pid;
+
+   if ((fd = shm_open(shm_name, O_RDONLY, 0)) < 0) return 0;
+   if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct shm_segment)){
+      close(fd);
+      return 0;
+      }
+   seg = mmap(NULL, sizeof(struct shm_segment), PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (seg == MAP_FAILED) return 0;
+   pid = seg->magic == SHM_MAGIC ? seg->pid : 0;
+   munmap(seg, sizeof(struct shm_segment));
+   if (pid > 0 && (kill(pid, 0) == 0 || errno == EPERM)) return pid;
+   return 0;
+   } /* shm_owner */
+
+// Copy of mea[], http_resp[] & observation[] - after the samples of a wake-up are applied
+void shm_publish(){
+   struct shm_group* g;
+   int x;
+
+   if (shm_seg == NULL) return;
+   atomic_fetch_add_explicit(&shm_seg->seq, 1, memory_order_relaxed);
+   atomic_thread_fence(memory_order_release);
+   shm_seg->updated = current_time;
+   shm_seg->cycles = ov_cycles;
+   for (x = 0; x < num_groups; x++){
+      g = &shm_seg->group[x];
+      g->interval_ns = mea[x].interval_ns;
+      g->missed = mea[x].missed;
+      g->ms_200 = http_resp[x].ms_200;
+      g->ms_304 = http_resp[x].ms_304;
+      g->requests = mea[x].requests;
+      g->http_204 = http_resp[x].http_204;
+      g->http_304 = http_resp[x].http_304;
+      g->http_other = http_resp[x].http_other;
+      g->last_returncode = mea[x].last_returncode;
+      g->station = mea[x].station;
+      g->elapsed = mea[x].elapsed;
+      g->elapsed_low = mea[x].elapsed_low;
+      g->elapsed_high = mea[x].elapsed_high;
+      g->elapsed_gns10 = mea[x].elapsed_gns10;
+      g->elapsed_gns100 = mea[x].elapsed_gns100;
+      g->elapsed_gns1000 = mea[x].elapsed_gns1000;
+      g->server = mea[x].server;
+      g->rtt = mea[x].tcp.rtt;
+      snprintf(g->name, sizeof(g->name), "%s", group[x].name);
+      snprintf(g->station_name, sizeof(g->station_name), "%s", station_name(group[x].api, mea[x].station));
+      snprintf(g->observation, sizeof(g->observation), "%.47s", observation[x].data);
+      }
+   atomic_fetch_add_explicit(&shm_seg->seq, 1, memory_order_release);
+   } /* shm_publish */
+
+// -shm: consistent snapshot of a running probe as CSV - the way any local reader does it
+int shm_report(){
+   static struct shm_segment snap;
+   struct shm_segment* seg;
+   struct stat st;
+   unsigned long seq;
+   long retries;
+   int64_t t0, t1;
+   int fd, x;
+   struct shm_group* g;
+
+   if (strlen(shm_name) == 0){
+      printf("DMIAPI: -shm needs [SHM] in configuration - terminating\n");
+      return 3;
+      }
+   fd = shm_open(shm_name, O_RDONLY, 0);
+   if (fd < 0){
+      printf("DMIAPI: No probe publishes %s - terminating\n", shm_name);
+      return 3;
+      }
+   if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct shm_segment)){
+      printf("DMIAPI: %s has another layout - terminating\n", shm_name);
+      close(fd);
+      return 3;
+      }
+   seg = mmap(NULL, sizeof(struct shm_segment), PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (seg == MAP_FAILED){
+      printf("DMIAPI: Could not map %s - terminating\n", shm_name);
+      return 3;
+      }
+
+   // Check: same layout as this dmiapi
+   if (seg->magic != SHM_MAGIC || seg->version != SHM_VERSION || seg->size != sizeof(struct shm_segment)){
+      printf("DMIAPI: %s has another layout (version %u) - terminating\n", shm_name, seg->version);
+      return 3;
+      }
+
+   retries = 0;
+   t0 = raw_ns();
+   while (1){
+      seq = atomic_load_explicit(&seg->seq, memory_order_acquire);
+      if ((seq & 1) == 0){
+         memcpy(&snap, seg, sizeof(snap));
+         atomic_thread_fence(memory_order_acquire);
+         if (atomic_load_explicit(&seg->seq, memory_order_relaxed) == seq) break;
+         }
+
+      // Writer may have stopped in the middle of shm_publish - seq stays odd
+      if (++retries % SHM_RETRIES == 0){
+         if (kill(seg->pid, 0) != 0 && errno == ESRCH){
+            printf("DMIAPI: Probe %i stopped while writing %s - terminating\n", seg->pid, shm_name);
+            return 3;
+            }
+         if (raw_ns() - t0 > SHM_WAIT_NS){
+            printf("DMIAPI: No consistent snapshot of %s within 1 s - terminating\n", shm_name);
+            return 3;
+            }
+         }
+      }
+   t1 = raw_ns();
+
+   printf("# pid %i, updated %li, cycles %li, seq %lu, snapshot %li ns, %li retries\n", snap.pid, (long)snap.updated,
+      (long)snap.cycles, seq, (long)(t1 - t0), retries);
+   printf("group,station,requests,latest,low,high,avg10,avg100,avg1000,server,rtt,rc,http_304,http_204,http_other,interval,missed,observation\n");
+   for (x = 0; x < snap.num_groups && x < MAX_GROUPS; x++){
+      g = &snap.group[x];
+      printf("%s,%s,%i,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%i,%i,%i,%i,%.1f,%li,%s\n", g->name, g->station_name, g->requests,
+         g->elapsed, g->elapsed_low, g->elapsed_high, g->elapsed_gns10, g->elapsed_gns100, g->elapsed_gns1000, g->server, g->rtt,
+         g->last_returncode, g->http_304, g->http_204, g->http_other, g->interval_ns / 1e9, (long)g->missed, g->observation);
+      }
+   return 0;
+   } /* shm_report */
+
+// Write translog-event
+void write_translog(char* trans_date, int api_id, int http_code, char* trans_id, double trans_tid, struct tcp_record* tcp){
+   char name[40];
+   int n;
 
    // One file per day
    time(&file_current_time);
@@ -865,14 +4388,112 @@ void write_translog(char* trans_date, int api_id, int http_code, char* trans_id,
    snprintf(name, 40, "%0d-%0d-%0d_dmiapi.trans", today->tm_year+1900, today->tm_mon+1, today->tm_mday);
 
    translog_out = fopen(name, "a+");
-   fprintf(translog_out,"%10s,%1i,%3i,%s,%8.2f\n",trans_date ,api_id, http_code,trans_id, trans_tid);
+   n = fprintf(translog_out,"%10s,%1i,%3i,%s,%8.2f,%7.2f,%7.2f,%u,%u,%u\n",trans_date ,api_id, http_code,trans_id, trans_tid,
+      tcp->rtt, tcp->rttvar, tcp->retrans, tcp->cwnd, tcp->inflight);
 
    fclose(translog_out);
+   overhead_file(OV_LOG, n);
    } /* write_translog */
 
+// Trace of one request as a line of OTLP-JSON (ResourceSpans). The root span "probe" has the
+// gravitee transaction id, so the client side can be lined up with the spans of the gateway
+void trace_write(struct sample* smp, int64_t log_start, int64_t log_end){
+   static int64_t trace_id;
+   static int64_t seq;
+   static char name[40];
+   char file[40], trans_id[6 * sizeof(smp->trans_id)];
+   struct trace_record* tr;
+   int64_t offset, start, end, first, done;
+   int t;
+
+   // One file per day
+   time(&file_current_time);
+   today = localtime(&file_current_time);
+   snprintf(file, 40, "%0d-%0d-%0d_dmiapi.trace", today->tm_year+1900, today->tm_mon+1, today->tm_mday);
+   if (strcmp(file, name) != 0){
+      if (trace_out != NULL) fclose(trace_out);
+      strcpy(name, file);
+      if ((trace_out = fopen(name, "a")) == NULL)
+         write_syslog("Could not open trace file - no traces", 2);
+      }
+   // No traces until the file of the next day can be opened
+   if (trace_out == NULL) return;
+
+   tr = &smp->trace;
+   start = tr->open != 0 ? tr->open : tr->send;
+   if (start == 0) return;
+   first = tr->send != 0 && smp->first_byte_ns > 0 ? tr->send + smp->first_byte_ns : 0;
+   done = tr->send != 0 && smp->elapsed_ns > 0 ? tr->send + smp->elapsed_ns : 0;
+   end = log_end;
+   if (tr->decoded > end) end = tr->decoded;
+   if (done > end) end = done;
+   if (tr->sent > end) end = tr->sent;
+   if (tr->tls > end) end = tr->tls;
+   if (tr->connect > end) end = tr->connect;
+   if (tr->dns > end) end = tr->dns;
+
+   // Stamps are CLOCK_MONOTONIC_RAW - spans are in unix time
+   offset = real_ns() - raw_ns();
+   if (trace_id == 0) trace_id = real_ns();
+   seq++;
+   t = smp->target;
+   json_escape(trans_id, sizeof(trans_id), smp->trans_id);
+
+   trace_pending = trace_pending + fprintf(trace_out, "{\"resourceSpans\":[{\"resource\":{\"attributes\":[{\"key\":\"service.name\",\"value\":{\"stringValue\":\"dmiapi\"}},"
+      "{\"key\":\"service.version\",\"value\":{\"stringValue\":\"%s\"}}]},\"scopeSpans\":[{\"scope\":{\"name\":\"dmiapi\"},\"spans\":[", VERSION);
+   trace_pending = trace_pending + fprintf(trace_out, "{\"traceId\":\"%016llx%016llx\",\"spanId\":\"%016llx\",\"name\":\"probe\",\"kind\":3,"
+      "\"startTimeUnixNano\":\"%lld\",\"endTimeUnixNano\":\"%lld\",\"attributes\":["
+      "{\"key\":\"gravitee.transaction_id\",\"value\":{\"stringValue\":\"%s\"}},"
+      "{\"key\":\"http.response.status_code\",\"value\":{\"intValue\":\"%i\"}},"
+      "{\"key\":\"server.address\",\"value\":{\"stringValue\":\"%s\"}},"
+      "{\"key\":\"dmiapi.api\",\"value\":{\"stringValue\":\"%s\"}},"
+      "{\"key\":\"dmiapi.station\",\"value\":{\"stringValue\":\"%s\"}}],"
+      "\"status\":{\"code\":%i}}",
+      (long long)trace_id, (long long)seq, (long long)(seq << 4),
+      (long long)(start + offset), (long long)(end + offset),
+      trans_id, smp->http_ret, gateway[target.gateway[t]].url, group[smp->api].name,
+      target.station[t] == TARGET_BATCH ? "batch" : endpoint[target.api[t]].num_stations > 0 ? station_name(target.api[t], target.station[t]) : "-",
+      smp->online == 0 && (smp->http_ret == 200 || smp->http_ret == 304) ? 1 : 2);
+   trace_span(trace_id, seq, 1, "dns", tr->open, tr->dns, offset);
+   trace_span(trace_id, seq, 2, "connect", tr->dns, tr->connect, offset);
+   trace_span(trace_id, seq, 3, "tls", tr->connect, tr->tls, offset);
+   trace_span(trace_id, seq, 4, "send", tr->send, tr->sent, offset);
+   trace_span(trace_id, seq, 5, "ttfb", tr->sent, first, offset);
+   trace_span(trace_id, seq, 6, "body", first, done, offset);
+   trace_span(trace_id, seq, 7, "decode", tr->decode, tr->decoded, offset);
+   trace_span(trace_id, seq, 8, "log", log_start, log_end, offset);
+   trace_pending = trace_pending + fprintf(trace_out, "]}]}]}\n");
+   } /* trace_write */
+
+// Child span of the probe span - left out if the phase is not in the request
+void trace_span(int64_t trace_id, int64_t seq, int id, const char* name, int64_t start, int64_t end, int64_t offset){
+   if (start == 0 || end < start) return;
+   trace_pending = trace_pending + fprintf(trace_out, ",{\"traceId\":\"%016llx%016llx\",\"spanId\":\"%016llx\",\"parentSpanId\":\"%016llx\",\"name\":\"%s\",\"kind\":1,"
+      "\"startTimeUnixNano\":\"%lld\",\"endTimeUnixNano\":\"%lld\"}",
+      (long long)trace_id, (long long)seq, (long long)(seq << 4 | id), (long long)(seq << 4), name,
+      (long long)(start + offset), (long long)(end + offset));
+   } /* trace_span */
+
+// String from a response as a JSON string value - quote, backslash and control characters are escaped
+void json_escape(char* out, int size, const char* in){
+   int n;
+
+   for (n = 0; *in != 0 && n < size - 7; in++)
+      if (*in == '"' || *in == '\\'){
+         out[n++] = '\\';
+         out[n++] = *in;
+         }
+      else if ((unsigned char)*in < 0x20)
+         n = n + sprintf(out + n, "\\u%04x", (unsigned char)*in);
+      else
+         out[n++] = *in;
+   out[n] = 0;
+   } /* json_escape */
+
 // Write statlog-event
 void write_statlog(char* trans_type, char* trans_date, double trans_tid, double low, double high){
    char name[40];
+   int n;
 
    // One file per day
    time(&file_current_time);
@@ -880,36 +4501,45 @@ void write_statlog(char* trans_type, char* trans_date, double trans_tid, double
    snprintf(name, 40, "%0d-%0d-%0d_dmiapi.stat", today->tm_year+1900, today->tm_mon+1, today->tm_mday);
 
    statlog_out = fopen(name, "a+");
-   fprintf(statlog_out,"%10s,%5s,%8.2f,%8.2f,%8.2f\n",trans_date, trans_type, trans_tid, low, high);
+   n = fprintf(statlog_out,"%10s,%5s,%8.2f,%8.2f,%8.2f\n",trans_date, trans_type, trans_tid, low, high);
    fclose(statlog_out);
+   overhead_file(OV_LOG, n);
    } /* write_statlog */
 
 // Write syslog & local syslog-file
+// Called from all threads - no shared variables
 void write_syslog(const char* msg, int pri){
    char name[40], log_time[40];
+   time_t now;
+   struct tm tm_now;
+   FILE *syslog_out;
+   int n;
 
    // Write in application-log
    // One file per day
-   time(&file_current_time);
-   today = localtime(&file_current_time);
-   snprintf(name, 40, "%0d-%0d-%0d_dmiapi.log", today->tm_year+1900, today->tm_mon+1, today->tm_mday);
-   snprintf(log_time, 40, "%02d.%02d.%04d %02d:%02d:%02d", today->tm_mday, today->tm_mon+1,today->tm_year+1900, today->tm_hour, today->tm_min, today->tm_sec);
+   time(&now);
+   localtime_r(&now, &tm_now);
+   snprintf(name, 40, "%0d-%0d-%0d_dmiapi.log", tm_now.tm_year+1900, tm_now.tm_mon+1, tm_now.tm_mday);
+   snprintf(log_time, 40, "%02d.%02d.%04d %02d:%02d:%02d", tm_now.tm_mday, tm_now.tm_mon+1,tm_now.tm_year+1900, tm_now.tm_hour, tm_now.tm_min, tm_now.tm_sec);
 
    syslog_out = fopen(name, "a+");
+   if (syslog_out == NULL) return;
 
+   n = 0;
    if (pri == 0){
-      fprintf(syslog_out,"%s DMIAPI[%i]: (INFO) %s\n",log_time, pri, msg);
+      n = fprintf(syslog_out,"%s DMIAPI[%i]: (INFO) %s\n",log_time, pri, msg);
       }   
    if (pri == 1){
-      fprintf(syslog_out,"%s DMIAPI[%i]: (NOTICE) %s\n",log_time, pri, msg);
+      n = fprintf(syslog_out,"%s DMIAPI[%i]: (NOTICE) %s\n",log_time, pri, msg);
       }
    if (pri == 2){ 
-      fprintf(syslog_out,"%s DMIAPI[%i]: (WARNING) %s\n", log_time, pri, msg);
+      n = fprintf(syslog_out,"%s DMIAPI[%i]: (WARNING) %s\n", log_time, pri, msg);
       }
    if (pri == 3){ 
-      fprintf(syslog_out,"%s DMIAPI[%i]: (ERROR) %s\n", log_time, pri, msg);
+      n = fprintf(syslog_out,"%s DMIAPI[%i]: (ERROR) %s\n", log_time, pri, msg);
       }
    fclose(syslog_out);
+   overhead_file(OV_LOG, n);
 
    // Write in Linux syslog
    openlog("DMIAPI", LOG_PID | LOG_NDELAY | LOG_CONS, LOG_MAIL);
@@ -923,16 +4553,244 @@ void write_syslog(const char* msg, int pri){
    } /* write_syslog */
 
 int goodbye(int status_code){
+   if (shm_seg != NULL) shm_unlink(shm_name);
    fclose(http_debug_file);
-   fclose(config_file);
+   if (config_file != NULL) fclose(config_file);
    write_syslog("Program ended", status_code);
    exit(status_code);
    } /* goodbye */
 
+// Predefined endpoints
+void endpoint_defaults(){
+   int x;
+
+   num_apis = 0;
+   x = endpoint_add("metObs");
+   strcpy(endpoint[x].path, "/v2/metObs/collections/observation/items?period=latest&parameterId=temp_dry&api-key={KEY}&stationId={STATION}");
+   strcpy(endpoint[x].json_value, "features.0.properties.value");
+   strcpy(endpoint[x].unit, "C (temp 2m)");
+   for (endpoint[x].num_stations = 0; endpoint[x].num_stations < sizeof(stations_liste) / sizeof(stations_liste[0]); endpoint[x].num_stations++)
+      strcpy(endpoint[x].station[endpoint[x].num_stations], stations_liste[endpoint[x].num_stations].kode);
+
+   x = endpoint_add("oceanObs");
+   strcpy(endpoint[x].path, "/v2/oceanObs/collections/observation/items?parameterId=sealev_dvr&period=latest&api-key={KEY}&stationId={STATION}");
+   strcpy(endpoint[x].json_value, "features.0.properties.value");
+   strcpy(endpoint[x].unit, "cm (sealevel DVR)");
+   for (endpoint[x].num_stations = 0; endpoint[x].num_stations < sizeof(kyst_stations_liste) / sizeof(kyst_stations_liste[0]); endpoint[x].num_stations++)
+      strcpy(endpoint[x].station[endpoint[x].num_stations], kyst_stations_liste[endpoint[x].num_stations].kode);
+
+   x = endpoint_add("lightObs");
+   strcpy(endpoint[x].path, "/v2/lightningdata/collections/observation/items?&period=latest&api-key={KEY}");
+   strcpy(endpoint[x].json_value, "features.0.properties.amp");
+   strcpy(endpoint[x].json_time, "features.0.properties.observed");
+   strcpy(endpoint[x].unit, "Ampere");
+
+   x = endpoint_add("climateObs");
+   strcpy(endpoint[x].path, "/v2/climateData/collections/stationValue/items?&parameterId=mean_temp&limit=1&stationId={STATION}&api-key={KEY}");
+   strcpy(endpoint[x].json_value, "features.0.properties.value");
+   strcpy(endpoint[x].unit, "C (mean temp)");
+   for (endpoint[x].num_stations = 0; endpoint[x].num_stations < sizeof(stations_liste) / sizeof(stations_liste[0]); endpoint[x].num_stations++)
+      strcpy(endpoint[x].station[endpoint[x].num_stations], stations_liste[endpoint[x].num_stations].kode);
+   } /* endpoint_defaults */
+
+// Add endpoint (or find existing) - returns index
+int endpoint_add(char* name){
+   int x;
+
+   for (x = 0; x < num_apis; x++)
+      if (strcasecmp(endpoint[x].name, name) == 0) return x;
+   if (num_apis == MAX_APIS){
+      printf("DMIAPI: Max. %i API's - terminating\n", MAX_APIS);
+      write_syslog("Too many API's in configurationfile - terminating", 3);
+      goodbye(3);
+      }
+   x = num_apis++;
+   memset(&endpoint[x], 0, sizeof(endpoint[x]));
+   snprintf(endpoint[x].name, 40, "%s", name);
+   endpoint[x].code = tolower(name[0]);
+   strcpy(endpoint[x].batch_station, "properties.stationId");
+   strcpy(endpoint[x].batch_time, "properties.observed");
+   return x;
+   } /* endpoint_add */
+
+// Endpoint parameters [API] & [<NAME>_xxx] - returns 1 if parameter belongs to an endpoint
+int endpoint_param(char* parameter, char* value){
+   int x, len, n;
+   char name[40], *suffix, *station;
+
+   if (strcmp(parameter, "[API]") == 0){
+      endpoint_add(value);
+      return 1;
+      }
+
+   for (x = 0; x < num_apis; x++){
+      len = strlen(endpoint[x].name);
+      for (n = 0; n <= len; n++) name[n] = toupper(endpoint[x].name[n]);
+      if (parameter[0] != '[' || strncmp(parameter + 1, name, len) != 0) continue;
+      suffix = parameter + 1 + len;
+
+      if (strcmp(suffix, "KEY]") == 0 || strcmp(suffix, "_KEY]") == 0) snprintf(endpoint[x].key, 80, "%s", value); else
+      if (strcmp(suffix, "_PATH]") == 0) snprintf(endpoint[x].path, 400, "%s", value); else
+      if (strcmp(suffix, "_JSON]") == 0) snprintf(endpoint[x].json_value, 80, "%s", value); else
+      if (strcmp(suffix, "_JSON_TIME]") == 0) snprintf(endpoint[x].json_time, 80, "%s", value); else
+      if (strcmp(suffix, "_CODE]") == 0) endpoint[x].code = value[0]; else
+      if (strcmp(suffix, "_THRESHOLD_WARNING]") == 0) strcpy(th[x].trs_warning, value); else
+      if (strcmp(suffix, "_THRESHOLD_ERROR]") == 0) strcpy(th[x].trs_error, value); else
+      if (strcmp(suffix, "_FREQ]") == 0) strcpy(endpoint[x].freq, value); else
+      if (strcmp(suffix, "_PHASE]") == 0) strcpy(endpoint[x].phase, value); else
+      if (strcmp(suffix, "_BATCH]") == 0) snprintf(endpoint[x].batch, 400, "%s", value); else
+      if (strcmp(suffix, "_BATCH_STATION]") == 0) snprintf(endpoint[x].batch_station, 80, "%s", value); else
+      if (strcmp(suffix, "_BATCH_TIME]") == 0) snprintf(endpoint[x].batch_time, 80, "%s", value); else
+      if (strcmp(suffix, "_UNIT]") == 0){
+         snprintf(endpoint[x].unit, 40, "%s", value);
+         for (n = 0; endpoint[x].unit[n] != 0; n++)
+            if (endpoint[x].unit[n] == '_') endpoint[x].unit[n] = ' ';
+         }
+      else if (strcmp(suffix, "_STATIONS]") == 0){
+         endpoint[x].num_stations = 0;
+         station = strtok(value, ",");
+         while (station != NULL && endpoint[x].num_stations < MAX_STATIONS){
+            snprintf(endpoint[x].station[endpoint[x].num_stations++], 8, "%s", station);
+            station = strtok(NULL, ",");
+            }
+         }
+      else continue;
+      return 1;
+      }
+   return 0;
+   } /* endpoint_param */
+
+// Further gateways [IPHOST_<NAME>] & [IPHOST_<NAME>_APIS] - returns 1 if parameter belongs to a gateway
+int gateway_param(char* parameter, char* value){
+   int x;
+   char name[40], *p;
+
+   if (strncmp(parameter, "[IPHOST_", 8) != 0) return 0;
+   snprintf(name, 40, "%s", parameter + 8);
+   if ((p = strchr(name, ']')) != NULL) *p = 0;
+   if ((p = strstr(name, "_APIS")) != NULL && p[5] == 0) *p = 0;
+   if (name[0] == 0) return 0;
+
+   // Gateway 0 is [IPHOST]
+   for (x = 1; x < num_gateways; x++)
+      if (strcasecmp(gateway[x].name, name) == 0) break;
+   if (x == num_gateways){
+      if (num_gateways == MAX_GATEWAYS){
+         printf("DMIAPI: Max. %i gateways - terminating\n", MAX_GATEWAYS - 1);
+         write_syslog("Too many gateways in configurationfile - terminating", 3);
+         goodbye(3);
+         }
+      num_gateways++;
+      memset(&gateway[x], 0, sizeof(gateway[x]));
+      for (p = name; *p != 0; p++) *p = tolower(*p);
+      strcpy(gateway[x].name, name);
+      }
+
+   if (strstr(parameter, "_APIS]") != NULL)
+      snprintf(gateway[x].apis, 200, ",%s,", value);
+   else{
+      snprintf(gateway[x].url, 80, "%s", value);
+
+      // Host-header is the hostname of the address
+      if (strstr(value, "://") != NULL) snprintf(gateway[x].httphost, 80, "%s", strstr(value, "://") + 3);
+      if ((p = strchr(gateway[x].httphost, '/')) != NULL) *p = 0;
+      if ((p = strchr(gateway[x].httphost, ':')) != NULL) *p = 0;
+      }
+   return 1;
+   } /* gateway_param */
+
+// Build target registry: one group for each (gateway, API) & one target for each station in group.
+// Each request is built once in its own buffer - SSL_write can not gather, so the buffers are flat
+void target_build(){
+   int g, x, n, count, len, batch;
+   char path[600], request[1024], name[50], *t;
+
+   num_groups = 0;
+   num_targets = 0;
+   num_obs = 0;
+   for (g = 0; g < num_gateways; g++)
+      for (x = 0; x < num_apis; x++){
+         // API's requested on gateway
+         snprintf(name, 50, ",%s,", endpoint[x].name);
+         if (gateway[g].apis[0] != 0 && strcasestr(gateway[g].apis, name) == NULL) continue;
+
+         // Batch: one target for all stations
+         batch = endpoint[x].batch[0] != 0 && endpoint[x].num_stations > 0;
+         count = endpoint[x].num_stations > 0 ? endpoint[x].num_stations : 1;
+         if (num_groups == MAX_GROUPS || num_targets + count > MAX_TARGETS || num_obs + count > MAX_TARGETS){
+            printf("DMIAPI: Max. %i API's on all gateways and %i targets - terminating\n", MAX_GROUPS, MAX_TARGETS);
+            write_syslog("Too many targets in configurationfile - terminating", 3);
+            goodbye(3);
+            }
+         group[num_groups].gateway = g;
+         group[num_groups].api = x;
+         group[num_groups].first = num_targets;
+         group[num_groups].count = batch ? 1 : count;
+         group[num_groups].obs = num_obs;
+         group[num_groups].stations = count;
+         num_obs = num_obs + count;
+         if (gateway[g].name[0] == 0) snprintf(group[num_groups].name, sizeof(group[num_groups].name), "%.39s", endpoint[x].name);
+            else snprintf(group[num_groups].name, sizeof(group[num_groups].name), "%.39s@%.39s", endpoint[x].name, gateway[g].name);
+         num_groups++;
+
+         for (n = 0; n < group[num_groups - 1].count; n++){
+            // Replace {KEY}, {STATION} & {STATIONS}
+            len = 0;
+            for (t = batch ? endpoint[x].batch : endpoint[x].path; *t != 0 && len < sizeof(path) - 100; ){
+               if (strncmp(t, "{KEY}", 5) == 0){
+                  len += snprintf(path + len, sizeof(path) - len, "%s", endpoint[x].key);
+                  t = t + 5;
+                  }
+               else if (strncmp(t, "{STATIONS}", 10) == 0){
+                  for (count = 0; count < endpoint[x].num_stations && len < sizeof(path) - 100; count++)
+                     len += snprintf(path + len, sizeof(path) - len, "%s%s", count > 0 ? "," : "", endpoint[x].station[count]);
+                  t = t + 10;
+                  }
+               else if (strncmp(t, "{STATION}", 9) == 0){
+                  len += snprintf(path + len, sizeof(path) - len, "%s", endpoint[x].num_stations > 0 ? endpoint[x].station[n] : "");
+                  t = t + 9;
+                  }
+               else
+                  path[len++] = *t++;
+               }
+            path[len] = 0;
+
+            len = snprintf(request, 1024, "GET %s HTTP/1.1\r\nHost:%s\r\nAccept: application/json\r\n%s\r\n", path, gateway[g].httphost,
+               atoi(compression) == 1 ? "Accept-Encoding: gzip, br\r\n" : "");
+            target.gateway[num_targets] = g;
+            target.api[num_targets] = x;
+            target.station[num_targets] = batch ? TARGET_BATCH : n;
+            target.req[num_targets].iov_base = strdup(request);
+            target.req[num_targets].iov_len = len;
+            num_targets++;
+            }
+         }
+   } /* target_build */
+
+// Name of station - from list of known stations or the id
+char* station_name(int api, int station){
+   int x;
+   char* id;
+
+   if (endpoint[api].num_stations == 0) return "";
+   id = endpoint[api].station[station];
+   for (x = 0; x < sizeof(stations_liste) / sizeof(stations_liste[0]); x++)
+      if (strcmp(stations_liste[x].kode, id) == 0) return stations_liste[x].navn;
+   for (x = 0; x < sizeof(kyst_stations_liste) / sizeof(kyst_stations_liste[0]); x++)
+      if (strcmp(kyst_stations_liste[x].kode, id) == 0) return kyst_stations_liste[x].navn;
+   return id;
+   } /* station_name */
+
 // Read configuration
 void read_config(char* config_filename){
 char parameter[200], value[200];
 int x,y;
+char *cpu, *save;
+cpu_set_t set;
+
+   endpoint_defaults();
+   strcpy(httphost, "dmigw.govcloud.dk");
+   num_gateways = 1;
 
    config_file=fopen(config_filename, "r");
    if (config_file == NULL){
@@ -946,19 +4804,42 @@ int x,y;
       if (strcmp(parameter, "[IPHOST]") == 0) strcpy(iphost, value); else
       if (strcmp(parameter, "[FREQ]") == 0) strcpy(freq, value); else
       if (strcmp(parameter, "[WWW-PATH]") == 0) strcpy(wwwpath, value); else
-      if (strcmp(parameter, "[METOBSKEY]") == 0) strcpy(key_metobs, value); else
-      if (strcmp(parameter, "[OCEANOBSKEY]") == 0) strcpy(key_oceanobs, value); else
-      if (strcmp(parameter, "[LIGHTOBSKEY]") == 0) strcpy(key_lightobs, value); else
-      if (strcmp(parameter, "[CLIMATEOBSKEY]") == 0) strcpy(key_climateobs, value); else
-      if (strcmp(parameter, "[METOBS_THRESHOLD_WARNING]") == 0) strcpy(th[0].trs_warning, value); else
-      if (strcmp(parameter, "[METOBS_THRESHOLD_ERROR]") == 0) strcpy(th[0].trs_error, value); else
-      if (strcmp(parameter, "[OCEANOBS_THRESHOLD_WARNING]") == 0) strcpy(th[1].trs_warning, value); else
-      if (strcmp(parameter, "[OCEANOBS_THRESHOLD_ERROR]") == 0) strcpy(th[1].trs_error, value); else
-      if (strcmp(parameter, "[LIGHTOBS_THRESHOLD_WARNING]") == 0) strcpy(th[2].trs_warning, value); else
-      if (strcmp(parameter, "[LIGHTOBS_THRESHOLD_ERROR]") == 0) strcpy(th[2].trs_error, value); else
-      if (strcmp(parameter, "[CLIMATEOBS_THRESHOLD_WARNING]") == 0) strcpy(th[3].trs_warning, value); else
-      if (strcmp(parameter, "[CLIMATEOBS_THRESHOLD_ERROR]") == 0) strcpy(th[3].trs_error, value); else
-      if (strcmp(parameter, "[SILENT]") == 0) strcpy(silent, value);
+      if (endpoint_param(parameter, value)) ; else
+      if (gateway_param(parameter, value)) ; else
+      if (strcmp(parameter, "[SILENT]") == 0) strcpy(silent, value); else
+      if (strcmp(parameter, "[JITTER]") == 0) strcpy(jitter, value); else
+      if (strcmp(parameter, "[ADAPTIVE]") == 0) strcpy(adaptive, value); else
+      if (strcmp(parameter, "[ADAPTIVE_MIN_FREQ]") == 0) strcpy(adaptive_min_freq, value); else
+      if (strcmp(parameter, "[BUDGET_PER_HOUR]") == 0) strcpy(budget_per_hour, value); else
+      if (strcmp(parameter, "[LOAD_API]") == 0) strcpy(load_api, value); else
+      if (strcmp(parameter, "[BULK_API]") == 0) strcpy(bulk_api, value); else
+      if (strcmp(parameter, "[CAPTURE]") == 0) snprintf(capture, sizeof(capture), "%s", value); else
+      if (strcmp(parameter, "[BENCH_BASELINE]") == 0) snprintf(bench_baseline, sizeof(bench_baseline), "%s", value); else
+      if (strcmp(parameter, "[BENCH_TOLERANCE]") == 0) strcpy(bench_tolerance, value); else
+      if (strcmp(parameter, "[BENCH_CORPUS]") == 0) snprintf(bench_corpus, sizeof(bench_corpus), "%s", value); else
+      if (strcmp(parameter, "[BULK_PATH]") == 0) snprintf(bulk_path, sizeof(bulk_path), "%s", value); else
+      if (strcmp(parameter, "[BULK_FROM]") == 0) strcpy(bulk_from, value); else
+      if (strcmp(parameter, "[BULK_TO]") == 0) strcpy(bulk_to, value); else
+      if (strcmp(parameter, "[BULK_PARTITION]") == 0) strcpy(bulk_partition, value); else
+      if (strcmp(parameter, "[BULK_CONNECTIONS]") == 0) strcpy(bulk_connections, value); else
+      if (strcmp(parameter, "[BULK_DIR]") == 0) snprintf(bulk_dir, sizeof(bulk_dir), "%s", value); else
+      if (strcmp(parameter, "[LOAD_CONNECTIONS]") == 0) strcpy(load_connections, value); else
+      if (strcmp(parameter, "[LOAD_RATES]") == 0) strcpy(load_rates, value); else
+      if (strcmp(parameter, "[LOAD_STEP_DURATION]") == 0) strcpy(load_step_duration, value); else
+      if (strcmp(parameter, "[WORKERS]") == 0) strcpy(workers_cfg, value); else
+      if (strcmp(parameter, "[KEEPALIVE]") == 0) strcpy(keepalive, value); else
+      if (strcmp(parameter, "[PIPELINE]") == 0) strcpy(pipeline, value); else
+      if (strcmp(parameter, "[HTTP2]") == 0) strcpy(http2, value); else
+      if (strcmp(parameter, "[COMPRESSION]") == 0) strcpy(compression, value); else
+      if (strcmp(parameter, "[CONDITIONAL]") == 0) strcpy(conditional, value); else
+      if (strcmp(parameter, "[TS_MEMORY]") == 0) strcpy(ts_memory, value); else
+      if (strcmp(parameter, "[ARENA]") == 0) strcpy(arena_size, value); else
+      if (strcmp(parameter, "[PROBE_CPU]") == 0) strcpy(probe_cpu, value); else
+      if (strcmp(parameter, "[SCHED_FIFO]") == 0) strcpy(sched_fifo, value); else
+      if (strcmp(parameter, "[SHM]") == 0) strcpy(shm_name, value); else
+      if (strcmp(parameter, "[TIMESTAMPING]") == 0) strcpy(timestamping, value); else
+      if (strcmp(parameter, "[TRACE]") == 0) strcpy(tracing, value); else
+      if (strcmp(parameter, "[HTTPHOST]") == 0) strcpy(httphost, value);
       else {
          write_syslog("Unknown parameter in configurationfile - terminating", 3);
          printf("DMIAPI: Unknown parameter id in configurationfile: [%s]  - terminating", config_filename);
@@ -966,19 +4847,32 @@ int x,y;
       }
    } /* while */
    fclose(config_file);
+   config_file = NULL;
 
    // Check: Parameters contain some value
-   if (strlen(wwwpath) == 0 || strlen(freq) == 0 || strlen(iphost) == 0 || strlen(key_metobs) == 0 || strlen(userid) == 0 ||
-      strlen(key_oceanobs) == 0 || strlen(key_lightobs) == 0 || strlen(key_climateobs) == 0 || 
-      strlen(th[0].trs_warning) == 0 || strlen(th[0].trs_error) == 0 ||
-      strlen(th[1].trs_warning) == 0 || strlen(th[1].trs_error) == 0 || 
-      strlen(th[2].trs_warning) == 0 || strlen(th[2].trs_error) == 0 || 
-      strlen(th[3].trs_warning) == 0 || strlen(th[3].trs_error) == 0 ) {
+   if (strlen(wwwpath) == 0 || strlen(freq) == 0 || strlen(iphost) == 0 || strlen(userid) == 0) {
       printf("DMIAPI: Error in konfigurationfile: Missing parameters - terminating\n");
       write_syslog("Error in configurationfile - terminating", 3);
       goodbye(3);
       }
 
+   // Check: Each endpoint has key, query, JSON-path & thresholds
+   for (x = 0; x < num_apis; x++)
+      if (strlen(endpoint[x].key) == 0 || strlen(endpoint[x].path) == 0 || strlen(endpoint[x].json_value) == 0 ||
+         strlen(th[x].trs_warning) == 0 || strlen(th[x].trs_error) == 0) {
+         printf("DMIAPI: Error in konfigurationfile: Missing parameters for %s - terminating\n", endpoint[x].name);
+         write_syslog("Error in configurationfile - terminating", 3);
+         goodbye(3);
+         }
+
+   // Check: Each further gateway has an address
+   for (x = 1; x < num_gateways; x++)
+      if (strlen(gateway[x].url) == 0 || strlen(gateway[x].httphost) == 0) {
+         printf("DMIAPI: Error in konfigurationfile: Missing or wrong [IPHOST_%s] - terminating\n", gateway[x].name);
+         write_syslog("Error in configurationfile - terminating", 3);
+         goodbye(3);
+         }
+
    // Check: 1 <= [FREQ] < 32768
    if (atoi(freq) <= 1 || atoi(freq) > 32769){
       printf("DMIAPI: [FREQ] must be between 1 and 32768 - terminating\n");
@@ -986,7 +4880,7 @@ int x,y;
       goodbye(3);
       } 
 
-   for (x = 0; x < 4; x++){
+   for (x = 0; x < num_apis; x++){
       // Check: 10 < [THRESHOLD_WARNING] < 10000
       if (atoi(th[x].trs_warning) < 10 || atoi(th[x].trs_warning) > 10000){
          printf("DMIAPI: [THRESHOLD_WARNING] must be between 10 and 10000 - terminating\n");
@@ -1002,6 +4896,157 @@ int x,y;
          } 
       }
 
+   for (x = 0; x < num_apis; x++){
+      // Default: [FREQ]. Without [xxx_PHASE] the groups are spread over the interval
+      if (strlen(endpoint[x].freq) == 0) strcpy(endpoint[x].freq, freq);
+
+      // Check: 1 <= [xxx_FREQ] <= 32768
+      if (atoi(endpoint[x].freq) < 1 || atoi(endpoint[x].freq) > 32768){
+         printf("DMIAPI: [%s_FREQ] must be between 1 and 32768 - terminating\n", endpoint[x].name);
+         write_syslog("[xxx_FREQ] must be between 1 and 32768 - terminating", 3);
+         goodbye(3);
+         }
+
+      // Check: 0 <= [xxx_PHASE] < [xxx_FREQ]
+      if (strlen(endpoint[x].phase) > 0 && (atoi(endpoint[x].phase) < 0 || atoi(endpoint[x].phase) >= atoi(endpoint[x].freq) * 1000)){
+         printf("DMIAPI: [%s_PHASE] must be between 0 and [%s_FREQ] ms - terminating\n", endpoint[x].name, endpoint[x].name);
+         write_syslog("[xxx_PHASE] must be between 0 and [xxx_FREQ] - terminating", 3);
+         goodbye(3);
+         }
+      }
+
+   // Gateway 0 & targets
+   snprintf(gateway[0].url, 80, "%s", iphost);
+   snprintf(gateway[0].httphost, 80, "%s", httphost);
+   target_build();
+
+   // Check: 0 <= [JITTER] < 10000
+   if (strlen(jitter) == 0) strcpy(jitter, "0");
+   if (atoi(jitter) < 0 || atoi(jitter) >= 10000){
+      printf("DMIAPI: [JITTER] must be between 0 and 10000 ms - terminating\n");
+      write_syslog("[JITTER] must be between 0 and 10000 - terminating", 3);
+      goodbye(3);
+      }
+
+   // Check: Adaptive sampling needs min. interval and budget above the base rate
+   if (strlen(adaptive) == 0) strcpy(adaptive, "0");
+   if (strcmp(adaptive, "0") != 0 && strcmp(adaptive, "1") != 0){
+      printf("DMIAPI: [ADAPTIVE] must be 0 or 1 - terminating\n");
+      write_syslog("[ADAPTIVE] must be 0 or 1 - terminating", 3);
+      goodbye(3);
+      }
+   if (atoi(adaptive) == 1){
+      if (atoi(adaptive_min_freq) < 100){
+         printf("DMIAPI: [ADAPTIVE_MIN_FREQ] must be at least 100 ms - terminating\n");
+         write_syslog("[ADAPTIVE_MIN_FREQ] must be at least 100 ms - terminating", 3);
+         goodbye(3);
+         }
+      y = 0;
+      for (x = 0; x < num_groups; x++)
+         y = y + 3600 / atoi(endpoint[group[x].api].freq);
+      if (atoi(budget_per_hour) <= y){
+         printf("DMIAPI: [BUDGET_PER_HOUR] must be above %i (requests/hour at [xxx_FREQ]) - terminating\n", y);
+         write_syslog("[BUDGET_PER_HOUR] below base request rate - terminating", 3);
+         goodbye(3);
+         }
+      }
+
+   // Check: 1 <= [WORKERS] <= number of groups
+   if (strlen(workers_cfg) == 0) strcpy(workers_cfg, "1");
+   num_workers = atoi(workers_cfg);
+   if (num_workers < 1 || num_workers > num_groups){
+      printf("DMIAPI: [WORKERS] must be between 1 and %i - terminating\n", num_groups);
+      write_syslog("[WORKERS] out of range - terminating", 3);
+      goodbye(3);
+      }
+
+   // Check: [KEEPALIVE] must be 0 or 1
+   if (strlen(keepalive) == 0) strcpy(keepalive, "0");
+   if (strcmp(keepalive, "0") != 0 && strcmp(keepalive, "1") != 0){
+      printf("DMIAPI: [KEEPALIVE] must be 0 or 1 - terminating\n");
+      write_syslog("[KEEPALIVE] must be 0 or 1 - terminating", 3);
+      goodbye(3);
+      }
+
+   // Check: 1 <= [PIPELINE] <= MAX_PIPELINE
+   if (strlen(pipeline) == 0) strcpy(pipeline, "1");
+   if (atoi(pipeline) < 1 || atoi(pipeline) > MAX_PIPELINE){
+      printf("DMIAPI: [PIPELINE] must be between 1 and %i - terminating\n", MAX_PIPELINE);
+      write_syslog("[PIPELINE] out of range - terminating", 3);
+      goodbye(3);
+      }
+
+   // Check: [HTTP2] must be 0 or 1
+   if (strlen(http2) == 0) strcpy(http2, "0");
+   if (strcmp(http2, "0") != 0 && strcmp(http2, "1") != 0){
+      printf("DMIAPI: [HTTP2] must be 0 or 1 - terminating\n");
+      write_syslog("[HTTP2] must be 0 or 1 - terminating", 3);
+      goodbye(3);
+      }
+
+   // Check: [COMPRESSION] must be 0 or 1
+   if (strlen(compression) == 0) strcpy(compression, "0");
+   if (strcmp(compression, "0") != 0 && strcmp(compression, "1") != 0){
+      printf("DMIAPI: [COMPRESSION] must be 0 or 1 - terminating\n");
+      write_syslog("[COMPRESSION] must be 0 or 1 - terminating", 3);
+      goodbye(3);
+      }
+
+   // Check: [TIMESTAMPING] must be 0 or 1
+   if (strlen(timestamping) == 0) strcpy(timestamping, "0");
+   if (strcmp(timestamping, "0") != 0 && strcmp(timestamping, "1") != 0){
+      printf("DMIAPI: [TIMESTAMPING] must be 0 or 1 - terminating\n");
+      write_syslog("[TIMESTAMPING] must be 0 or 1 - terminating", 3);
+      goodbye(3);
+      }
+
+   // Check: [TRACE] must be 0 or 1
+   if (strlen(tracing) == 0) strcpy(tracing, "0");
+   if (strcmp(tracing, "0") != 0 && strcmp(tracing, "1") != 0){
+      printf("DMIAPI: [TRACE] must be 0 or 1 - terminating\n");
+      write_syslog("[TRACE] must be 0 or 1 - terminating", 3);
+      goodbye(3);
+      }
+
+   // Check: [CONDITIONAL] must be 0 or 1
+   if (strlen(conditional) == 0) strcpy(conditional, "0");
+   if (strcmp(conditional, "0") != 0 && strcmp(conditional, "1") != 0){
+      printf("DMIAPI: [CONDITIONAL] must be 0 or 1 - terminating\n");
+      write_syslog("[CONDITIONAL] must be 0 or 1 - terminating", 3);
+      goodbye(3);
+      }
+
+   // Check: [PROBE_CPU] is a comma separated list of CPUs the process may run on
+   num_probe_cpus = 0;
+   if (strlen(probe_cpu) > 0){
+      sched_getaffinity(0, sizeof(set), &set);
+      strcpy(value, probe_cpu);
+      for (cpu = strtok_r(value, ",", &save); cpu != NULL; cpu = strtok_r(NULL, ",", &save)){
+         x = atoi(cpu);
+         if (!isdigit((unsigned char)cpu[0]) || x >= CPU_SETSIZE || !CPU_ISSET(x, &set) || num_probe_cpus == MAX_GROUPS){
+            printf("DMIAPI: [PROBE_CPU] must be CPUs available to the process - terminating\n");
+            write_syslog("[PROBE_CPU] must be CPUs available to the process - terminating", 3);
+            goodbye(3);
+            }
+         probe_cpus[num_probe_cpus++] = x;
+         }
+      }
+
+   // Check: 0 <= [SCHED_FIFO] <= 99 - only with [PROBE_CPU]
+   if (strlen(sched_fifo) == 0) strcpy(sched_fifo, "0");
+   if (atoi(sched_fifo) < 0 || atoi(sched_fifo) > 99 || (atoi(sched_fifo) > 0 && num_probe_cpus == 0)){
+      printf("DMIAPI: [SCHED_FIFO] must be between 0 and 99 and needs [PROBE_CPU] - terminating\n");
+      write_syslog("[SCHED_FIFO] out of range or without [PROBE_CPU] - terminating", 3);
+      goodbye(3);
+      }
+
+   // Check: [SHM] is a name like /dmiapi
+   if (strlen(shm_name) > 0 && (shm_name[0] != '/' || strchr(shm_name + 1, '/') != NULL || strlen(shm_name) > 60)){
+      printf("DMIAPI: [SHM] must be a name like /dmiapi - terminating\n");
+      write_syslog("[SHM] must be a name like /dmiapi - terminating", 3);
+      goodbye(3);
+      }
+
    // Check: [SILENT] must be 0 or 1
    if (strcmp(silent,"0") != 0 && strcmp(silent,"1") != 0){
       printf("DMIAPI: [SILENT] must be 0 or 1 - terminating\n");
@@ -1010,169 +5055,592 @@ int x,y;
       }
    } /* read_config */
 
-// Calculate timediff. in ms
-float timedifference_msec(struct timeval t0, struct timeval t1) {
-   return (t1.tv_sec - t0.tv_sec) * 1000.0f + (t1.tv_usec - t0.tv_usec) / 1000.0f;
-   } /* timedifference_msec */
+// Random number 0..n-1 - thread safe
+long random_r_ms(long n){
+   static __thread unsigned int seed = 0;
+
+   if (seed == 0) seed = time(NULL) ^ getpid() ^ (unsigned int)pthread_self();
+   return rand_r(&seed) % n;
+   } /* random_r_ms */
+
+// Monotonic clock in ns
+int64_t mono_ns(){
+   struct timespec ts;
 
-// Create socket
-int create_socket(char url_str[], BIO *out) {
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+   } /* mono_ns */
+
+// Initialize scheduler - deadlines are absolute: start + phase + n * interval
+void sched_init(){
+   int x;
+   int64_t now, phase;
+   struct endpoint_record* e;
+
+   now = mono_ns();
+   for (x = 0; x < num_groups; x++){
+      e = &endpoint[group[x].api];
+      sched[x].interval_ns = (int64_t)atoi(e->freq) * 1000000000LL;
+
+      // First deadlines are spread evenly over the interval, so the gateways do not get all
+      // requests at the same time. With [xxx_PHASE] or [HTTP2] only the gateways are spread,
+      // so the API's of a gateway are due together and can share a HTTP/2 round
+      if (strlen(e->phase) > 0 || atoi(http2) == 1)
+         phase = (int64_t)atoi(e->phase) * 1000000LL + sched[x].interval_ns * group[x].gateway / num_gateways;
+      else
+         phase = sched[x].interval_ns * x / num_groups;
+      sched[x].start_ns = now + phase % sched[x].interval_ns;
+      sched[x].periods = 0;
+      sched[x].missed = 0;
+      sched[x].station = 0;
+      sched[x].fire_ns = sched[x].start_ns;
+      sched[x].base_ns = sched[x].interval_ns;
+      sched[x].budget_limited = 0;
+      }
+
+   // Budget above base rate. Half of it may be spent as burst, the rest refills over the hour,
+   // so no 60 min window gets more than [BUDGET_PER_HOUR] requests
+   budget_capacity = 0;
+   if (atoi(adaptive) == 1){
+      budget_capacity = atoi(budget_per_hour);
+      for (x = 0; x < num_groups; x++)
+         budget_capacity = budget_capacity - 3600.0 / atoi(endpoint[group[x].api].freq);
+      budget_capacity = budget_capacity / 2;
+      }
+   budget_rate = budget_capacity / 3600e9;
+   budget_tokens = budget_capacity;
+   budget_updated_ns = now;
+   } /* sched_init */
+
+// Sleep until the earliest deadline of the worker's API's - returns API to request
+int sched_wait(struct worker* w){
+   int x, next;
+   uint64_t expirations;
+   struct itimerspec its;
+
+   next = w->id;
+   for (x = w->id; x < num_groups; x = x + num_workers)
+      if (sched[x].fire_ns < sched[next].fire_ns) next = x;
+
+   if (sched[next].fire_ns > mono_ns()){
+      memset(&its, 0, sizeof(its));
+      its.it_value.tv_sec = sched[next].fire_ns / 1000000000LL;
+      its.it_value.tv_nsec = sched[next].fire_ns % 1000000000LL;
+      timerfd_settime(w->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+      while (read(w->timer_fd, &expirations, sizeof(expirations)) < 0)
+         ;
+      }
+   return next;
+   } /* sched_wait */
+
+// Advance deadline for API. Deadlines passed while busy are skipped and counted as missed
+void sched_next(int api, struct sample* smp, int stations){
+   int64_t now, deadline, interval;
+   char syslog_str[80];
+   long skipped;
+
+   now = mono_ns();
+   sched[api].periods++;
+   deadline = sched[api].start_ns + sched[api].periods * sched[api].interval_ns;
+
+   // New interval from adaptive controller - grid is re-anchored at the current deadline
+   interval = adapt_interval(api, smp);
+   if (interval != sched[api].interval_ns){
+      sched[api].start_ns = deadline - sched[api].interval_ns;
+      sched[api].periods = 1;
+      sched[api].interval_ns = interval;
+      deadline = sched[api].start_ns + interval;
+      }
+
+   skipped = 0;
+   if (deadline <= now){
+      skipped = (now - deadline) / sched[api].interval_ns + 1;
+      sched[api].periods = sched[api].periods + skipped;
+      deadline = sched[api].start_ns + sched[api].periods * sched[api].interval_ns;
+      sched[api].missed = sched[api].missed + skipped;
+      snprintf(syslog_str, 79, "%s missed %li deadline(s)", group[api].name, skipped);
+      write_syslog(syslog_str, 2);
+      }
+
+   // Jitter is added to the deadline only - the grid itself does not drift
+   sched[api].fire_ns = deadline;
+   if (atoi(jitter) > 0)
+      sched[api].fire_ns = deadline + (int64_t)(random_r_ms(atoi(jitter) * 1000)) * 1000LL;
+
+   // Next station
+   sched[api].station = (sched[api].station + stations) % group[api].count;
+   } /* sched_next */
+
+// Adaptive controller: halve interval while API is degraded (down to [ADAPTIVE_MIN_FREQ]),
+// double it back towards [xxx_FREQ] when healthy. Requests above base rate are paid from the budget
+int64_t adapt_interval(int api, struct sample* smp){
+   int64_t interval, now;
+   double cost;
+   char syslog_str[80];
+
+   smp->budget = 0;
+   if (atoi(adaptive) == 0) return sched[api].base_ns;
+
+   // Refill budget - shared by all workers
+   pthread_mutex_lock(&budget_lock);
+   now = mono_ns();
+   budget_tokens = budget_tokens + (now - budget_updated_ns) * budget_rate;
+   if (budget_tokens > budget_capacity) budget_tokens = budget_capacity;
+   budget_updated_ns = now;
+
+   interval = sched[api].interval_ns;
+   if (smp->online != 0 || smp->returncode != 200 || smp->elapsed > atoi(th[group[api].api].trs_warning)){
+      interval = interval / 2;
+      if (interval < (int64_t)atoi(adaptive_min_freq) * 1000000LL) interval = (int64_t)atoi(adaptive_min_freq) * 1000000LL;
+      }
+   else
+      interval = interval * 2;
+   if (interval > sched[api].base_ns) interval = sched[api].base_ns;
+
+   // A request at a shorter interval costs the fraction of a request it adds above the base rate
+   cost = 1.0 - (double)interval / sched[api].base_ns;
+   if (cost > budget_tokens){
+      interval = sched[api].base_ns;
+      sched[api].budget_limited++;
+      cost = 0;
+      }
+   budget_tokens = budget_tokens - cost;
+   smp->budget = budget_tokens;
+   pthread_mutex_unlock(&budget_lock);
+
+   if (interval < sched[api].base_ns && sched[api].interval_ns == sched[api].base_ns){
+      snprintf(syslog_str, 79, "%s degraded - interval %.1f s", group[api].name, interval / 1e9);
+      write_syslog(syslog_str, 1);
+      }
+   if (interval == sched[api].base_ns && sched[api].interval_ns < sched[api].base_ns){
+      snprintf(syslog_str, 79, "%s healthy - interval %.1f s", group[api].name, interval / 1e9);
+      write_syslog(syslog_str, 1);
+      }
+   return interval;
+   } /* adapt_interval */
+
+// Clock for response times - not stepped or slewed by NTP
+int64_t raw_ns(){
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+   return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+   } /* raw_ns */
+
+// Clock of kernel socket timestamps
+int64_t real_ns(){
+   struct timespec ts;
+
+   clock_gettime(CLOCK_REALTIME, &ts);
+   return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+   } /* real_ns */
+
+void stamp_send(struct conn_record* c, struct stamp* s){
+   s->kernel = c->timestamping ? real_ns() : 0;
+   s->raw = raw_ns();
+   } /* stamp_send */
+
+// After a read - kernel time is of the latest segment read from the socket
+void stamp_recv(struct conn_record* c, struct stamp* s){
+   s->raw = raw_ns();
+   s->kernel = c->timestamping ? c->rx_ns : 0;
+   } /* stamp_recv */
+
+// ns from t0 to t1 - kernel time if both have one and it is within the raw time (a step of the
+// wall clock or a timestamp of an older read is not used)
+int64_t stamp_ns(struct stamp* t0, struct stamp* t1){
+   int64_t raw, kernel;
+
+   raw = t1->raw - t0->raw;
+   if (t0->kernel == 0 || t1->kernel == 0) return raw;
+   kernel = t1->kernel - t0->kernel;
+   return kernel > 0 && kernel <= raw + raw / 1000 ? kernel : raw;
+   } /* stamp_ns */
+
+// TCP_INFO of connection after a request - retransmits are counted from the previous request
+void tcp_read(struct conn_record* c, struct sample* smp){
+   struct tcp_info ti;
+   socklen_t len;
+
+   len = sizeof(ti);
+   if (c->fd <= 0 || getsockopt(c->fd, IPPROTO_TCP, TCP_INFO, &ti, &len) != 0) return;
+   smp->tcp.rtt = ti.tcpi_rtt / 1000.0;
+   smp->tcp.rttvar = ti.tcpi_rttvar / 1000.0;
+   smp->tcp.retrans = ti.tcpi_total_retrans - c->retrans;
+   smp->tcp.cwnd = ti.tcpi_snd_cwnd;
+   smp->tcp.inflight = ti.tcpi_unacked * ti.tcpi_snd_mss;
+   c->retrans = ti.tcpi_total_retrans;
+   } /* tcp_read */
+
+// Phases of a new connection go to the first request sent on it
+void trace_conn(struct conn_record* c, struct sample* smp){
+   if (!c->fresh) return;
+   smp->trace.open = c->t_open;
+   smp->trace.dns = c->t_dns;
+   smp->trace.connect = c->t_connect;
+   smp->trace.tls = c->t_tls;
+   c->fresh = 0;
+   } /* trace_conn */
+
+// Requests smp[0..count-1] written from t0 until now
+void trace_send(struct conn_record* c, struct sample* smp, int count, struct stamp* t0){
+   int64_t now;
+   int n;
+
+   now = raw_ns();
+   trace_conn(c, smp);
+   for (n = 0; n < count; n++){
+      smp[n].trace.send = t0->raw;
+      smp[n].trace.sent = now;
+      }
+   } /* trace_send */
+
+// Response time & time to first byte of sample
+void sample_time(struct sample* smp, struct stamp* t0, struct stamp* t_first, struct stamp* t_done){
+   smp->elapsed_ns = stamp_ns(t0, t_done);
+   smp->first_byte_ns = stamp_ns(t0, t_first);
+   smp->elapsed = smp->elapsed_ns / 1e6;
+   smp->first_byte = smp->first_byte_ns / 1e6;
+   } /* sample_time */
+
+// Socket BIO for TLS with kernel receive timestamps - reads with recvmsg() and keeps the
+// SO_TIMESTAMPING time of the latest read in the connection
+BIO* sock_bio_new(struct conn_record* c){
+   static BIO_METHOD* method;
+   static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+   BIO* b;
+
+   pthread_mutex_lock(&lock);
+   if (method == NULL){
+      method = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_SOURCE_SINK, "dmiapi socket");
+      BIO_meth_set_write(method, sock_bio_write);
+      BIO_meth_set_read(method, sock_bio_read);
+      BIO_meth_set_ctrl(method, sock_bio_ctrl);
+      }
+   pthread_mutex_unlock(&lock);
+   b = BIO_new(method);
+   if (b == NULL) return NULL;
+   BIO_set_data(b, c);
+   BIO_set_init(b, 1);
+   return b;
+   } /* sock_bio_new */
+
+int sock_bio_write(BIO* b, const char* data, int len){
+   struct conn_record* c = BIO_get_data(b);
+   int rc;
+
+   BIO_clear_retry_flags(b);
+   rc = send(c->fd, data, len, MSG_NOSIGNAL);
+   if (rc < 0 && (errno == EAGAIN || errno == EINTR)) BIO_set_retry_write(b);
+   return rc;
+   } /* sock_bio_write */
+
+int sock_bio_read(BIO* b, char* data, int len){
+   struct conn_record* c = BIO_get_data(b);
+   struct msghdr msg;
+   struct iovec iov;
+   struct cmsghdr* cm;
+   struct timespec ts[3];	// software, (deprecated), hardware - only software is enabled
+   char control[256];
+   int rc;
+
+   iov.iov_base = data;
+   iov.iov_len = len;
+   memset(&msg, 0, sizeof(msg));
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = control;
+   msg.msg_controllen = sizeof(control);
+
+   BIO_clear_retry_flags(b);
+   rc = recvmsg(c->fd, &msg, 0);
+   if (rc < 0 && (errno == EAGAIN || errno == EINTR)) BIO_set_retry_read(b);
+   for (cm = CMSG_FIRSTHDR(&msg); rc > 0 && cm != NULL; cm = CMSG_NXTHDR(&msg, cm))
+      if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPING){
+         memcpy(ts, CMSG_DATA(cm), sizeof(ts));
+         if (ts[0].tv_sec != 0) c->rx_ns = (int64_t)ts[0].tv_sec * 1000000000LL + ts[0].tv_nsec;
+         }
+   return rc;
+   } /* sock_bio_read */
+
+long sock_bio_ctrl(BIO* b, int cmd, long num, void* ptr){
+   return cmd == BIO_CTRL_FLUSH ? 1 : 0;
+   } /* sock_bio_ctrl */
+
+// Create socket - thread safe. Returns 0 on failure
+int create_socket(char url_str[], BIO *out, int64_t* resolved) {
    int sockfd;
    char hostname[256] = "";
    char portnum[6] = "443";
-   char proto[6] = "";
    char *tmp_ptr = NULL;
-   int port;
-   struct hostent *host;
-   struct sockaddr_in dest_addr;
+   struct addrinfo hints, *host;
    struct timeval tv;
    char syslog_str[80] = {0};
 
-   if (url_str[strlen(url_str)] == '/')
-      url_str[strlen(url_str)] = '\0';
-
-   strncpy(proto, url_str, (strchr(url_str, ':') - url_str));
-   strncpy(hostname, strstr(url_str, "://") + 3, sizeof(hostname));
+   if (strstr(url_str, "://") == NULL) return 0;
+   strncpy(hostname, strstr(url_str, "://") + 3, sizeof(hostname) - 1);
+   if (strchr(hostname, '/')) *strchr(hostname, '/') = '\0';
    if (strchr(hostname, ':')) {
       tmp_ptr = strchr(hostname, ':');
-      strncpy(portnum, tmp_ptr+1,  sizeof(portnum));
+      strncpy(portnum, tmp_ptr+1,  sizeof(portnum) - 1);
       *tmp_ptr = '\0';
       }
-   port = atoi(portnum);
 
-   if ((host = gethostbyname(hostname)) == NULL ) {
-      strcpy(syslog_str, "Cant resolve hostname: ");
-      strcat(syslog_str, hostname);
+   memset(&hints, 0, sizeof(hints));
+   hints.ai_family = AF_INET;
+   hints.ai_socktype = SOCK_STREAM;
+   if (getaddrinfo(hostname, portnum, &hints, &host) != 0) {
+      snprintf(syslog_str, 79, "Cant resolve hostname: %s", hostname);
       write_syslog(syslog_str, 2);
       return 0;
       }
+   if (resolved != NULL) *resolved = raw_ns();
 
    // create the basic TCP socket
-   sockfd = socket(AF_INET, SOCK_STREAM, 0);
+   sockfd = socket(host->ai_family, host->ai_socktype, host->ai_protocol);
    if (sockfd == -1){
-      strcpy(syslog_str, "Cant create socket: ");
-      strcat(syslog_str, hostname);
+      snprintf(syslog_str, 79, "Cant create socket: %s", hostname);
       write_syslog(syslog_str, 2);
-      close(sockfd);
+      freeaddrinfo(host);
       return 0;
       }
 
-   dest_addr.sin_family = AF_INET;
-   dest_addr.sin_port=htons(port);
-   dest_addr.sin_addr.s_addr = *(long*)(host->h_addr);
-
    // set timeout
    tv.tv_sec = 5;
    tv.tv_usec = 0;
    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv, sizeof(tv));
 
-   // Zeroing the rest of the struct
-   memset(&(dest_addr.sin_zero), '\0', 8);
-
-   tmp_ptr = inet_ntoa(dest_addr.sin_addr);
-
    // Try to make the host connect here
-   if (connect(sockfd, (struct sockaddr *) &dest_addr, sizeof(struct sockaddr)) == -1 ) {
-      strcpy(syslog_str, "Cant connect to hostname: ");
-      strcat(syslog_str, hostname);
+   if (connect(sockfd, host->ai_addr, host->ai_addrlen) == -1 ) {
+      snprintf(syslog_str, 79, "Cant connect to hostname: %s", hostname);
       write_syslog(syslog_str, 2);
       close(sockfd);
+      sockfd = 0;
       }
 
+   freeaddrinfo(host);
    return sockfd;
    } /* create socket */
 
-int init_com(){
-   int rc;
+// Connect to gateway. The SSL context is kept in c between connections - returns 1 if ok
+int init_com(struct conn_record* c){
+   int rc, flags;
+   BIO* bio;
+   X509* cert;
    char syslog_str[80] = {0};
 
-   // Create input/output BIO's
-   certbio = BIO_new(BIO_s_file());
-   outbio  = BIO_new_fp(stdout, BIO_NOCLOSE);
-
-   // Initialize SSL Lib
-   if (SSL_library_init() < 0){
-      write_syslog("Could not initialize the OpenSSL library.", 3);
-      return 0;
-      }
-   method = SSLv23_client_method();
-
    // Create SSL context
-   if ((ctx = SSL_CTX_new(method)) == NULL){
-      strcpy(syslog_str, "Unable to create a new SSL context structure.");
-      write_syslog(syslog_str, 2);
+   if (c->ctx == NULL){
+      if ((c->ctx = SSL_CTX_new(SSLv23_client_method())) == NULL){
+         strcpy(syslog_str, "Unable to create a new SSL context structure.");
+         write_syslog(syslog_str, 2);
+         return 0;
+         }
+      SSL_CTX_set_options(c->ctx, SSL_OP_NO_SSLv2);
+      if (atoi(http2) == 1) SSL_CTX_set_alpn_protos(c->ctx, (const unsigned char*)"\x02h2\x08http/1.1", 12);
       }
-   SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2);
-   ssl = SSL_new(ctx);
 
    // create TCPIP connection
-   server = create_socket(iphost, outbio);
-   if (server == 0){
-      // Clean up
-      SSL_CTX_free(ctx);
-      SSL_free(ssl);
-      BIO_free_all(certbio);
-      BIO_free_all(outbio);
-
+   atomic_fetch_add_explicit(&ov_connects, 1, memory_order_relaxed);
+   c->fresh = 1;
+   c->t_open = raw_ns();
+   c->t_dns = c->t_connect = c->t_tls = 0;
+   c->fd = create_socket(gateway[c->gateway].url, outbio, &c->t_dns);
+   if (c->fd == 0){
       strcpy(syslog_str, "Unable to establish tcp/ip connection.");
       write_syslog(syslog_str, 2);
       return 0;
       }
 
-   if ((server != 0) && TCPIPDEBUG)
-      BIO_printf(outbio, "Successfully made the TCP connection to: %s.\n", iphost);
+   c->t_connect = raw_ns();
+   if (TCPIPDEBUG)
+      BIO_printf(outbio, "Successfully made the TCP connection to: %s.\n", gateway[c->gateway].url);
+
+   // Kernel receive timestamps - TLS then reads through sock_bio
+   c->timestamping = 0;
+   c->rx_ns = 0;
+   c->retrans = 0;
+   flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE;
+   if (atoi(timestamping) > 0 && setsockopt(c->fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0)
+      c->timestamping = 1;
+   else if (atoi(timestamping) > 0)
+      write_syslog("SO_TIMESTAMPING not supported - response times from user space", 2);
 
    // Attach SSL to connection
-   rc = SSL_set_fd(ssl, server);
-   if (rc == 1)
-      rc = SSL_connect(ssl);
+   c->ssl = SSL_new(c->ctx);
+   if (c->timestamping && (bio = sock_bio_new(c)) != NULL){
+      SSL_set_bio(c->ssl, bio, bio);
+      rc = 1;
+      }
+   else
+      rc = SSL_set_fd(c->ssl, c->fd);
+   if (rc == 1){
+      BIO_set_callback_ex(SSL_get_rbio(c->ssl), overhead_bio);
+      rc = SSL_connect(c->ssl);
+      }
+   if (rc == 1) c->t_tls = raw_ns();
    if (TCPIPDEBUG) log_ssl();
    if (rc != 1){
-      SSL_CTX_free(ctx);
-      SSL_free(ssl);
-      close(server);
-      BIO_free_all(certbio);
-      BIO_free_all(outbio);
+      close_com(c);
       strcpy(syslog_str, "Could not build a SSL session.");
       write_syslog(syslog_str, 2);
+      return 0;
       }
-    else
-       if (TCPIPDEBUG) BIO_printf(outbio, "Successfully enabled SSL/TLS session to: %s.\n", iphost);
+   if (TCPIPDEBUG) BIO_printf(outbio, "Successfully enabled SSL/TLS session to: %s.\n", gateway[c->gateway].url);
 
    // Get certificate
-   if (rc == 1) cert = SSL_get_peer_certificate(ssl);
+   cert = SSL_get_peer_certificate(c->ssl);
    if (cert == NULL){
-      // Clean up
-      SSL_CTX_free(ctx);
-      SSL_free(ssl);
-      close(server);
-      BIO_free_all(certbio);
-      BIO_free_all(outbio);
-
+      close_com(c);
       strcpy(syslog_str, "Could not get certificate for.");
       write_syslog(syslog_str, 2);
+      return 0;
       }
-   else
-      if (TCPIPDEBUG) BIO_printf(outbio, "Retrieved the server's certificate from: %s.\n", iphost);
+   if (TCPIPDEBUG) BIO_printf(outbio, "Retrieved the server's certificate from: %s.\n", gateway[c->gateway].url);
 
    // Display cert
    if (TCPIPDEBUG){
       BIO_printf(outbio, "Displaying the certificate subject data:\n");
-      X509_NAME_print_ex(outbio, certname, 0, 0);
+      X509_NAME_print_ex(outbio, X509_get_subject_name(cert), 0, 0);
       BIO_printf(outbio, "\n");
       }
+   X509_free(cert);
+
+   // HTTP/2 if the gateway selected it
+   if (atoi(http2) == 1 && h2_start(c) != 1){
+      close_com(c);
+      write_syslog("Could not start HTTP/2 session.", 2);
+      return 0;
+      }
    if (TCPIPDEBUG) write_syslog("End init_com",5);
-   return rc;
+   return 1;
    } /* init_com */
 
-void close_com(){
-   SSL_free(ssl);
-   close(server);
-   SSL_CTX_free(ctx);
-   BIO_free_all(certbio);
-   BIO_free_all(outbio);
-   X509_free(cert);
-   if (TCPIPDEBUG) BIO_printf(outbio, "Finished SSL/TLS connection with server: %s.\n", iphost);
+// Start HTTP/2 session if h2 was negotiated by ALPN - returns 1 if ok (also when not negotiated)
+int h2_start(struct conn_record* c){
+   static nghttp2_mem mem = {NULL, pool_h2_malloc, pool_h2_free, pool_h2_calloc, pool_h2_realloc};
+   nghttp2_session_callbacks* cb;
+   nghttp2_settings_entry settings[2];
+   const unsigned char* alpn;
+   unsigned int alpn_len;
+
+   SSL_get0_alpn_selected(c->ssl, &alpn, &alpn_len);
+   if (alpn == NULL || alpn_len != 2 || memcmp(alpn, "h2", 2) != 0) return 1;
+
+   nghttp2_session_callbacks_new(&cb);
+   nghttp2_session_callbacks_set_send_callback(cb, h2_send);
+   nghttp2_session_callbacks_set_on_begin_headers_callback(cb, h2_begin_headers);
+   nghttp2_session_callbacks_set_on_header_callback(cb, h2_header);
+   nghttp2_session_callbacks_set_on_frame_recv_callback(cb, h2_frame_recv);
+   nghttp2_session_callbacks_set_on_data_chunk_recv_callback(cb, h2_data);
+   nghttp2_session_callbacks_set_on_stream_close_callback(cb, h2_stream_close);
+   nghttp2_session_client_new3(&c->h2, cb, c, NULL, &mem);
+   nghttp2_session_callbacks_del(cb);
+
+   // No push & large windows - the probe reads everything it asks for
+   settings[0].settings_id = NGHTTP2_SETTINGS_ENABLE_PUSH;
+   settings[0].value = 0;
+   settings[1].settings_id = NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE;
+   settings[1].value = 1 << 24;
+   nghttp2_submit_settings(c->h2, NGHTTP2_FLAG_NONE, settings, 2);
+   nghttp2_session_set_local_window_size(c->h2, NGHTTP2_FLAG_NONE, 0, 1 << 24);
+   return 1;
+   } /* h2_start */
+
+// HTTP/2 callbacks. Session user data is the connection, stream user data the h2_stream
+ssize_t h2_send(nghttp2_session* session, const uint8_t* data, size_t length, int flags, void* user_data){
+   struct conn_record* c;
+   int rc;
+
+   c = (struct conn_record*)user_data;
+   rc = SSL_write(c->ssl, data, length);
+   return rc > 0 ? rc : NGHTTP2_ERR_CALLBACK_FAILURE;
+   } /* h2_send */
+
+// Response HEADERS begin - first byte of response
+int h2_begin_headers(nghttp2_session* session, const nghttp2_frame* frame, void* user_data){
+   struct h2_stream* st;
+
+   st = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+   if (st != NULL && frame->headers.cat == NGHTTP2_HCAT_RESPONSE)
+      st->t_first = ((struct conn_record*)user_data)->h2_read;
+   return 0;
+   } /* h2_begin_headers */
+
+// Header field (HPACK decoded) - rebuilt as "name: value" lines, so http_header() works as for HTTP/1.1
+int h2_header(nghttp2_session* session, const nghttp2_frame* frame, const uint8_t* name, size_t namelen,
+   const uint8_t* value, size_t valuelen, uint8_t flags, void* user_data){
+   struct h2_stream* st;
+   struct http_parser* hp;
+
+   st = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+   if (st == NULL || frame->hd.type != NGHTTP2_HEADERS) return 0;
+   hp = &st->hp;
+   if (namelen == 7 && memcmp(name, ":status", 7) == 0){
+      hp->status = atoi((const char*)value);
+      hp->header_len = snprintf(hp->header, MAX_BUF, "HTTP/2 %i\r\n", hp->status);
+      }
+   else if (hp->header_len + namelen + valuelen + 5 < MAX_BUF)
+      hp->header_len += snprintf(hp->header + hp->header_len, MAX_BUF - hp->header_len, "%.*s: %.*s\r\n",
+         (int)namelen, name, (int)valuelen, value);
+   return 0;
+   } /* h2_header */
+
+// Complete frame - END_STREAM ends the response
+int h2_frame_recv(nghttp2_session* session, const nghttp2_frame* frame, void* user_data){
+   struct h2_stream* st;
+   char value[40];
+
+   if (frame->hd.type != NGHTTP2_HEADERS && frame->hd.type != NGHTTP2_DATA) return 0;
+   st = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+   if (st == NULL) return 0;
+
+   // Header complete - body follows as DATA
+   if (frame->hd.type == NGHTTP2_HEADERS && st->hp.state == HP_HEADER && st->hp.status >= 200){
+      strcat(st->hp.header, "\r\n");
+      st->hp.header_len = st->hp.header_len + 2;
+      st->hp.state = HP_BODY_EOF;
+      if (http_header(&st->hp, "content-encoding", value, sizeof(value)) && !http_decoder(&st->hp, value))
+         st->hp.state = HP_ERROR;
+      }
+   if (frame->hd.flags & NGHTTP2_FLAG_END_STREAM){
+      if (st->hp.state == HP_BODY_EOF) st->hp.state = HP_DONE;
+      st->t_done = ((struct conn_record*)user_data)->h2_read;
+      st->done = 1;
+      }
+   return 0;
+   } /* h2_frame_recv */
+
+// DATA - to stream's parser
+int h2_data(nghttp2_session* session, uint8_t flags, int32_t stream_id, const uint8_t* data, size_t len, void* user_data){
+   struct h2_stream* st;
+
+   st = nghttp2_session_get_stream_user_data(session, stream_id);
+   if (st != NULL && st->hp.state == HP_BODY_EOF) http_parse(&st->hp, (const char*)data, len);
+   return 0;
+   } /* h2_data */
+
+// Stream closed - reset by gateway if not complete
+int h2_stream_close(nghttp2_session* session, int32_t stream_id, uint32_t error_code, void* user_data){
+   struct h2_stream* st;
+
+   st = nghttp2_session_get_stream_user_data(session, stream_id);
+   if (st != NULL && st->done == 0){
+      st->t_done = ((struct conn_record*)user_data)->h2_read;
+      st->done = -1;
+      }
+   return 0;
+   } /* h2_stream_close */
+
+
+void close_com(struct conn_record* c){
+   if (c->h2 != NULL) nghttp2_session_del(c->h2);
+   c->h2 = NULL;
+   if (c->ssl != NULL) SSL_free(c->ssl);
+   if (c->fd > 0) close(c->fd);
+   c->ssl = NULL;
+   c->fd = 0;
+   if (TCPIPDEBUG) BIO_printf(outbio, "Finished SSL/TLS connection with server: %s.\n", gateway[c->gateway].url);
    } /* close_com */
 
 // Read out SSL errors
@@ -1187,142 +5655,483 @@ int log_ssl(void) {
    }
 
 void http_log(char* msg1, char* msg2){
-   http_debug_file = fopen("dmiapi_http.log", "a+");
-   fprintf(http_debug_file, "%s %s\n", msg1, msg2);
-   fclose(http_debug_file);
+   FILE *http_log_file;
+   int n;
+
+   http_log_file = fopen("dmiapi_http.log", "a+");
+   if (http_log_file == NULL) return;
+   n = fprintf(http_log_file, "%s %s\n", msg1, msg2);
+   fclose(http_log_file);
+   overhead_file(OV_LOG, n);
    } /* http_log */
 
-// Get length from header
-long unsigned int get_length(char* buffer){
-   char content_str[128] = {0};
-   char str_size[20] = {0};
-   char *ptr;
-   int x, y,  header_length;
-   long int len;
-
-   if (strstr(buffer, "Content-Length:") != 0){  // Non chunked data
-      strncpy(content_str, strstr(buffer, "Content-Length:"),100);
-      x = 0;
-      do {
-         str_size[x] = content_str[x + 16];
-         x++;
-         } while ((content_str[x + 16] >= '0') && (content_str[x + 16] <= '9') && (x < 20) && content_str[x + 16] != 0x0d && content_str[x + 17] != 0x0a);
-      if (atoi(str_size) > 0) return atoi(str_size); else return 0;
-      } /* if */
+// Reset response parser. Body is copied to body (max body_size-1 bytes) if not NULL.
+// The parser must be zeroed before first use
+void http_parser_init(struct http_parser* hp, char* body, long body_size){
+   hp->state = HP_HEADER;
+   hp->status = 0;
+   hp->chunked = 0;
+   hp->content_length = -1;
+   hp->chunk_left = 0;
+   hp->body_len = 0;
+   hp->coded_len = 0;
+   hp->wire_len = 0;
+   hp->encoding = HP_IDENTITY;
+   hp->header[0] = 0;
+   hp->header_len = 0;
+   hp->line_len = 0;
+   hp->body = body;
+   hp->body_size = body_size;
+   hp->overflow = 0;
+   hp->tok = NULL;
+   hp->json = NULL;
+   if (body != NULL && body_size > 0) body[0] = 0;
+   } /* http_parser_init */
+
+// Copy decoded body data to sink
+static void http_sink(struct http_parser* hp, const char* data, long len){
+   long n;
+
+   // Parse JSON while received
+   if (hp->tok != NULL){
+      if (hp->json == NULL && hp->body_len == 0 && len > 0 && data[0] != '{' && data[0] != '[')
+         hp->tok = NULL; // Not JSON
+      else if (hp->json == NULL && len > 0){
+         arena_cur = arena_own;
+         hp->json = json_tokener_parse_ex(hp->tok, data, len);
+         arena_cur = NULL;
+         if (hp->json == NULL && json_tokener_get_error(hp->tok) != json_tokener_continue)
+            hp->tok = NULL;
+         }
+      hp->body_len = hp->body_len + len;
+      return;
+      }
 
-   else {
-      if (strstr(buffer, "transfer-encoding: chunked") != 0){
-         // Read until end of header
-         x = 0;
-         header_length = 0;
-         while (x < strlen(buffer)){
-            if (buffer[x] == 0x0d && buffer[x + 1] == 0x0a &&
-               buffer[x + 2] == 0x0d && buffer[x + 3] == 0x0a){
-               header_length = x;
+   if (hp->body != NULL){
+      n = len;
+      if (hp->body_len + n > hp->body_size - 1){
+         n = hp->body_size - 1 - hp->body_len;
+         if (n < 0) n = 0;
+         hp->overflow = 1;
+         }
+      memcpy(hp->body + hp->body_len, data, n);
+      hp->body[hp->body_len + n] = 0;
+      }
+   hp->body_len = hp->body_len + len;
+   } /* http_sink */
+
+// Start decoder for Content-Encoding of response - returns 0 if encoding is not supported
+int http_decoder(struct http_parser* hp, const char* encoding){
+   if (strcasecmp(encoding, "gzip") == 0 || strcasecmp(encoding, "x-gzip") == 0){
+      if (hp->z == NULL){
+         hp->z = calloc(1, sizeof(z_stream));
+         if (inflateInit2(hp->z, 15 + 16) != Z_OK){ // gzip header
+            free(hp->z);
+            hp->z = NULL;
+            return 0;
+            }
+         }
+      else
+         inflateReset(hp->z);
+      hp->encoding = HP_GZIP;
+      }
+   else if (strcasecmp(encoding, "br") == 0){
+      if (hp->br != NULL) BrotliDecoderDestroyInstance(hp->br);
+      hp->br = BrotliDecoderCreateInstance(pool_br_alloc, pool_br_free, NULL);
+      if (hp->br == NULL) return 0;
+      hp->encoding = HP_BR;
+      }
+   else if (strcasecmp(encoding, "identity") != 0)
+      return 0;
+   return 1;
+   } /* http_decoder */
+
+// Body data as received - decoded in steps of 16 kB, so a compressed body never has to be held
+static void http_body(struct http_parser* hp, const char* data, long len){
+   unsigned char out[16384];
+   const uint8_t* next_in;
+   uint8_t* next_out;
+   size_t avail_in, avail_out;
+   int rc;
+
+   hp->coded_len = hp->coded_len + len;
+   switch (hp->encoding){
+      case HP_GZIP:
+         hp->z->next_in = (unsigned char*)data;
+         hp->z->avail_in = len;
+         do {
+            hp->z->next_out = out;
+            hp->z->avail_out = sizeof(out);
+            rc = inflate(hp->z, Z_NO_FLUSH);
+            http_sink(hp, (char*)out, sizeof(out) - hp->z->avail_out);
+            } while (rc == Z_OK && hp->z->avail_out == 0);
+         if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) hp->state = HP_ERROR;
+         break;
+
+      case HP_BR:
+         next_in = (const uint8_t*)data;
+         avail_in = len;
+         do {
+            next_out = out;
+            avail_out = sizeof(out);
+            rc = BrotliDecoderDecompressStream(hp->br, &avail_in, &next_in, &avail_out, &next_out, NULL);
+            http_sink(hp, (char*)out, sizeof(out) - avail_out);
+            } while (rc == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT);
+         if (rc == BROTLI_DECODER_RESULT_ERROR) hp->state = HP_ERROR;
+         break;
+
+      default:
+         http_sink(hp, data, len);
+      }
+   } /* http_body */
+
+// Feed received bytes to parser - returns bytes consumed. Parsing stops at end of response,
+// so the rest of data belongs to the next response on the connection
+int http_parse(struct http_parser* hp, const char* data, int len){
+   int x, n;
+   char value[40];
+
+   x = 0;
+   while (x < len && hp->state != HP_DONE && hp->state != HP_ERROR){
+      switch (hp->state){
+         case HP_HEADER:
+            if (hp->header_len >= MAX_BUF - 1){
+               hp->state = HP_ERROR;
                break;
                }
+            hp->header[hp->header_len++] = data[x++];
+            hp->header[hp->header_len] = 0;
+            if (hp->header_len >= 4 && strcmp(hp->header + hp->header_len - 4, "\r\n\r\n") == 0){
+               if (hp->header_len > 12) hp->status = atoi(hp->header + 9);
+               if (http_header(hp, "content-length", value, sizeof(value))) hp->content_length = atol(value);
+               if (http_header(hp, "transfer-encoding", value, sizeof(value)) && strcasecmp(value, "chunked") == 0) hp->chunked = 1;
+               if (http_header(hp, "content-encoding", value, sizeof(value)) && !http_decoder(hp, value)){
+                  hp->state = HP_ERROR;
+                  break;
+                  }
+
+               if (hp->status == 204 || hp->status == 304 || (hp->status >= 100 && hp->status < 200))
+                  hp->state = HP_DONE;
+               else if (hp->chunked)
+                  hp->state = HP_CHUNK_SIZE;
+               else if (hp->content_length == 0)
+                  hp->state = HP_DONE;
+               else if (hp->content_length > 0)
+                  hp->state = HP_BODY;
+               else
+                  hp->state = HP_BODY_EOF;
+               hp->line_len = 0;
+               }
+            break;
+
+         case HP_BODY:
+            n = len - x;
+            if (n > hp->content_length - hp->coded_len) n = hp->content_length - hp->coded_len;
+            http_body(hp, data + x, n);
+            x = x + n;
+            if (hp->coded_len == hp->content_length && hp->state == HP_BODY) hp->state = HP_DONE;
+            break;
+
+         case HP_BODY_EOF:
+            http_body(hp, data + x, len - x);
+            x = len;
+            break;
+
+         case HP_CHUNK_SIZE:
+         case HP_TRAILER:
+            if (data[x] == '\n'){
+               hp->line[hp->line_len] = 0;
+               if (hp->line_len > 0 && hp->line[hp->line_len - 1] == '\r') hp->line[hp->line_len - 1] = 0;
+               if (hp->state == HP_TRAILER){
+                  if (hp->line[0] == 0) hp->state = HP_DONE; // Empty line ends trailer
+                  }
+               else {
+                  hp->chunk_left = strtol(hp->line, NULL, 16);
+                  hp->state = hp->chunk_left == 0 ? HP_TRAILER : HP_CHUNK_DATA;
+                  }
+               hp->line_len = 0;
+               }
+            else if (hp->line_len < (int)sizeof(hp->line) - 1)
+               hp->line[hp->line_len++] = data[x];
             x++;
-           } /* while */
-        if (header_length < strlen(buffer)) header_length = header_length + 4; //4: 0x0d 0x0a 0x0d 0x0a
-
-        x = header_length; //read msg-length
-        y = 0;
-        while (buffer[x] != '{'){
-           str_size[y] = buffer[x];
-           y++;
-           x++; 
-           }
-        str_size[y] = 0;
-        len = strtol(str_size,&ptr,16);
-        return len;
-        } /*  if */
-   } /* else */
-
-   // no header data = 2-n.th. chunk
-   x = 0;
-   header_length = 0;
-   while (x < strlen(buffer)){
-      str_size[x] = buffer[x];
-      if (buffer[x] == 0x0d && buffer[x + 1] == 0x0a){
-         str_size[x + 1] = 0;
-         break;
-         }
-      x++;
+            break;
+
+         case HP_CHUNK_DATA:
+            n = len - x;
+            if (n > hp->chunk_left) n = hp->chunk_left;
+            http_body(hp, data + x, n);
+            x = x + n;
+            hp->chunk_left = hp->chunk_left - n;
+            if (hp->chunk_left == 0 && hp->state == HP_CHUNK_DATA){
+               hp->state = HP_CHUNK_END;
+               hp->line_len = 0;
+               }
+            break;
+
+         case HP_CHUNK_END:
+            if (data[x] == '\n') hp->state = HP_CHUNK_SIZE;
+            x++;
+            break;
+         } /* switch */
       } /* while */
-   len = strtol(str_size,&ptr,16);
-   return len;
-   } /* get_length */
+   hp->wire_len = hp->wire_len + x;
+   return x;
+   } /* http_parse */
+
+// Get value of header (case insensitive name) - returns 1 if found
+int http_header(struct http_parser* hp, const char* name, char* value, int size){
+   char* line;
+   char* end;
+   int n, len;
+
+   len = strlen(name);
+   line = hp->header;
+   while (line != NULL && *line != 0){
+      if (strncasecmp(line, name, len) == 0 && line[len] == ':'){
+         line = line + len + 1;
+         while (*line == ' ') line++;
+         end = strstr(line, "\r\n");
+         n = end == NULL ? strlen(line) : end - line;
+         if (n > size - 1) n = size - 1;
+         memcpy(value, line, n);
+         value[n] = 0;
+         return 1;
+         }
+      line = strstr(line, "\r\n");
+      if (line != NULL) line = line + 2;
+      }
+   return 0;
+   } /* http_header */
+
+// Add latency (us) to histogram
+void hist_add(struct histogram* h, int64_t us){
+   int msb, idx;
+
+   if (us < 0) us = 0;
+   if (us < 64)
+      idx = us;
+   else {
+      msb = 63 - __builtin_clzll(us);
+      idx = 64 + (msb - 6) * 32 + (int)((us >> (msb - 5)) - 32);
+      if (idx >= HIST_BUCKETS) idx = HIST_BUCKETS - 1;
+      }
+   h->count[idx]++;
+   h->total++;
+   if (us > h->max) h->max = us;
+   } /* hist_add */
+
+// Lowest value (us) in histogram bucket
+int64_t hist_value(int idx){
+   int msb;
+
+   if (idx < 64) return idx;
+   msb = (idx - 64) / 32 + 6;
+   return (int64_t)((idx - 64) % 32 + 32) << (msb - 5);
+   } /* hist_value */
+
+// Value (us) at percentile p (0-100)
+int64_t hist_percentile(struct histogram* h, double p){
+   long n, sum;
+   int x;
+
+   if (h->total == 0) return 0;
+   n = (long)ceil(h->total * p / 100.0);
+   if (n < 1) n = 1;
+   sum = 0;
+   for (x = 0; x < HIST_BUCKETS; x++){
+      sum = sum + h->count[x];
+      if (sum >= n) return hist_value(x) < h->max ? hist_value(x) : h->max;
+      }
+   return h->max;
+   } /* hist_percentile */
 
 // Colorcodes for HTML-output
 void compute_colors(){
    int x;
+   char* html_color[] = {HTML_GREEN, HTML_GREEN, HTML_YELLOW, HTML_RED};
 
-   for (x = 0; x <= NUM_OF_APIS; x++){
-      // elapsed meta
-      if (mea[x].elapsed < atoi(th[x].trs_warning)) {
-         strcpy(mea[x].elapsed_html_color, HTML_GREEN);
-         }
-      if ((mea[x].elapsed > atoi(th[x].trs_warning)) && (mea[x].elapsed < atoi(th[x].trs_error))){
-         strcpy(mea[x].elapsed_html_color, HTML_YELLOW);
-         }
-      if (mea[x].elapsed > atoi(th[x].trs_error)) {
-         strcpy(mea[x].elapsed_html_color, HTML_RED);
-         }
+   for (x = 0; x < num_groups; x++){
+      strcpy(mea[x].elapsed_html_color, html_color[threshold_level(x, mea[x].elapsed)]);
+      strcpy(mea[x].elapsed_low_html_color, html_color[threshold_level(x, mea[x].elapsed_low)]);
+      strcpy(mea[x].elapsed_high_html_color, html_color[threshold_level(x, mea[x].elapsed_high)]);
+      strcpy(mea[x].elapsed_gns10_html_color, html_color[threshold_level(x, mea[x].elapsed_gns10)]);
+      strcpy(mea[x].elapsed_gns100_html_color, html_color[threshold_level(x, mea[x].elapsed_gns100)]);
+      strcpy(mea[x].elapsed_gns1000_html_color, html_color[threshold_level(x, mea[x].elapsed_gns1000)]);
 
-      // elapsed low
-      if (mea[x].elapsed_low < atoi(th[x].trs_warning)) {
-         strcpy(mea[x].elapsed_low_html_color, HTML_GREEN);
-         }
-      if ((mea[x].elapsed_low > atoi(th[x].trs_warning)) && (mea[x].elapsed_low < atoi(th[x].trs_error))){
-         strcpy(mea[x].elapsed_low_html_color, HTML_YELLOW);
-         }
-      if (mea[x].elapsed_low > atoi(th[x].trs_error)) {
-         strcpy(mea[x].elapsed_low_html_color, HTML_RED);
-         }
-      // elapsed high
-      if (mea[x].elapsed_high < atoi(th[x].trs_warning)) {
-         strcpy(mea[x].elapsed_high_html_color, HTML_GREEN);
-         }
-      if ((mea[x].elapsed_high > atoi(th[x].trs_warning)) && (mea[x].elapsed_high < atoi(th[x].trs_error))){
-         strcpy(mea[x].elapsed_high_html_color, HTML_YELLOW);
-         }
-      if (mea[x].elapsed_high > atoi(th[x].trs_error)) {
-         strcpy(mea[x].elapsed_high_html_color, HTML_RED);
-         }
-      // Avg 10
-      if (mea[x].elapsed_gns10 < atoi(th[x].trs_warning)) {
-         strcpy(mea[x].elapsed_gns10_html_color, HTML_GREEN);
-         }
-      if ((mea[x].elapsed_gns10 > atoi(th[x].trs_warning)) && (mea[x].elapsed_gns10 < atoi(th[x].trs_error))){
-         strcpy(mea[x].elapsed_gns10_html_color, HTML_YELLOW);
-         }
-      if (mea[x].elapsed_gns10 > atoi(th[x].trs_error)) {
-         strcpy(mea[x].elapsed_gns10_html_color, HTML_RED);
-         }
-      // Avg 100
-      if (mea[x].elapsed_gns100< atoi(th[x].trs_warning)) {
-         strcpy(mea[x].elapsed_gns100_html_color, HTML_GREEN);
-         }
-      if ((mea[x].elapsed_gns100 > atoi(th[x].trs_warning)) && (mea[x].elapsed_gns100 < atoi(th[x].trs_error))){
-         strcpy(mea[x].elapsed_gns100_html_color, HTML_YELLOW);
-         }
-      if (mea[x].elapsed_gns100 > atoi(th[x].trs_error)) {
-         strcpy(mea[x].elapsed_gns100_html_color, HTML_RED);
-         }
-      // Avg 1000
-      if (mea[x].elapsed_gns1000< atoi(th[x].trs_warning)) {
-         strcpy(mea[x].elapsed_gns1000_html_color, HTML_GREEN);
-         }
-      if ((mea[x].elapsed_gns1000 > atoi(th[x].trs_warning)) && (mea[x].elapsed_gns1000 < atoi(th[x].trs_error))){
-         strcpy(mea[x].elapsed_gns1000_html_color, HTML_YELLOW);
-         }
-      if (mea[x].elapsed_gns1000 > atoi(th[x].trs_error)) {
-         strcpy(mea[x].elapsed_gns1000_html_color, HTML_RED);
-         }
       // Color of returncodes
       if (mea[x].last_returncode == 200) strcpy(mea[x].last_returncode_html_color, HTML_GREEN);
          else
          strcpy(mea[x].last_returncode_html_color, HTML_RED);
-
       } /* for */
-   } /* compute_colors */
\ No newline at end of file
+   } /* compute_colors */
+
+// Threshold level of a response time: TTY_GREEN|TTY_YELLOW|TTY_RED
+int threshold_level(int api, float value){
+   if (value < atoi(th[group[api].api].trs_warning)) return TTY_GREEN;
+   if (value < atoi(th[group[api].api].trs_error)) return TTY_YELLOW;
+   return TTY_RED;
+   } /* threshold_level */
+
+// Add latency to sparkline history
+void spark_add(int api, float value){
+   spark_put(&spark[api], value);
+   } /* spark_add */
+
+void spark_put(struct spark_record* s, float value){
+   s->value[s->next] = value;
+   s->next = (s->next + 1) % SPARK_LEN;
+   if (s->count < SPARK_LEN) s->count++;
+   } /* spark_put */
+
+// Sparkline as text for html, scaled between low and high in the window
+void html_spark(char* out, struct spark_record* s){
+   const char* bars[] = {"\u2581", "\u2582", "\u2583", "\u2584", "\u2585", "\u2586", "\u2587", "\u2588"};
+   int x, i;
+   float v, low, high;
+
+   low = high = -1;
+   for (x = 0; x < s->count; x++){
+      v = s->value[x];
+      if (v < 0) continue;
+      if (low < 0 || v < low) low = v;
+      if (v > high) high = v;
+      }
+   out[0] = 0;
+   for (x = 0; x < s->count; x++){
+      i = (s->next - s->count + x + SPARK_LEN) % SPARK_LEN;
+      v = s->value[i];
+      strcat(out, v < 0 ? "x" : bars[high > low ? (int)((v - low) / (high - low) * 7 + 0.5) : 0]);
+      }
+   } /* html_spark */
+
+// Put a text line in the console frame (UTF-8 aware)
+void con_text(int row, const char* text){
+   int col, n, len;
+
+   col = 0;
+   while (*text != 0 && *text != '\n' && col < CONSOLE_COLS){
+      len = 1;
+      if ((*text & 0xe0) == 0xc0) len = 2;
+      else if ((*text & 0xf0) == 0xe0) len = 3;
+      else if ((*text & 0xf8) == 0xf0) len = 4;
+      for (n = 0; n < len && text[n] != 0; n++)
+         frame[row][col].ch[n] = text[n];
+      frame[row][col].ch[n] = 0;
+      frame[row][col].color = TTY_DEFAULT;
+      text = text + n;
+      col++;
+      }
+   for (; col < CONSOLE_COLS; col++){
+      strcpy(frame[row][col].ch, " ");
+      frame[row][col].color = TTY_DEFAULT;
+      }
+   } /* con_text */
+
+// Set color on part of a console line
+void con_color(int row, int col, int len, int color){
+   for (; len > 0 && col < CONSOLE_COLS; len--, col++)
+      frame[row][col].color = color;
+   } /* con_color */
+
+// Draw sparkline of the latest latencies, scaled between low and high in the window
+void con_spark(int row, int col, int api){
+   const char* bars[] = {"\u2581", "\u2582", "\u2583", "\u2584", "\u2585", "\u2586", "\u2587", "\u2588"};
+   int x, i, level;
+   float v, low, high;
+
+   low = high = -1;
+   for (x = 0; x < spark[api].count; x++){
+      v = spark[api].value[x];
+      if (v < 0) continue;
+      if (low < 0 || v < low) low = v;
+      if (v > high) high = v;
+      }
+
+   strcpy(frame[row][col].ch, "[");
+   frame[row][col].color = TTY_DEFAULT;
+   for (x = 0; x < SPARK_LEN && col + x + 1 < CONSOLE_COLS; x++){
+      // Oldest value to the left
+      i = (spark[api].next - spark[api].count + x + SPARK_LEN) % SPARK_LEN;
+      if (x >= spark[api].count){
+         strcpy(frame[row][col + x + 1].ch, " ");
+         frame[row][col + x + 1].color = TTY_DEFAULT;
+         continue;
+         }
+      v = spark[api].value[i];
+      if (v < 0){
+         strcpy(frame[row][col + x + 1].ch, "x");
+         frame[row][col + x + 1].color = TTY_RED;
+         continue;
+         }
+      level = 0;
+      if (high > low) level = (int)((v - low) / (high - low) * 7 + 0.5);
+      strcpy(frame[row][col + x + 1].ch, bars[level]);
+      frame[row][col + x + 1].color = threshold_level(api, v);
+      }
+   if (col + x + 1 < CONSOLE_COLS){
+      strcpy(frame[row][col + x + 1].ch, "]");
+      frame[row][col + x + 1].color = TTY_DEFAULT;
+      }
+   } /* con_spark */
+
+// Write changed cells to tty. Cursor is only moved when a gap of unchanged cells is too long to rewrite
+void con_flush(){
+   const char* sgr[] = {"\e[0m", "\e[32m", "\e[33m", "\e[31m"};
+   static char out[CONSOLE_ROWS * CONSOLE_COLS * 12];
+   int row, col, end, gap, len, color;
+
+   len = 0;
+   color = TTY_DEFAULT;
+
+   // Full redraw at start and every CONSOLE_REFRESH frames
+   if (frame_count % CONSOLE_REFRESH == 0){
+      len += sprintf(out + len, "\e[0m\e[1;1H\e[2J");
+      for (row = 0; row < CONSOLE_ROWS; row++)
+         for (col = 0; col < CONSOLE_COLS; col++){
+            strcpy(prev_frame[row][col].ch, " ");
+            prev_frame[row][col].color = TTY_DEFAULT;
+            }
+      }
+   frame_count++;
+
+   for (row = 0; row < CONSOLE_ROWS; row++){
+      col = 0;
+      while (col < CONSOLE_COLS){
+         if (strcmp(frame[row][col].ch, prev_frame[row][col].ch) == 0 && frame[row][col].color == prev_frame[row][col].color){
+            col++;
+            continue;
+            }
+
+         // Find end of run - short gaps of unchanged cells are cheaper to rewrite than a cursor move
+         end = col;
+         gap = 0;
+         while (end + gap + 1 < CONSOLE_COLS && gap < 8){
+            if (strcmp(frame[row][end + gap + 1].ch, prev_frame[row][end + gap + 1].ch) == 0 &&
+               frame[row][end + gap + 1].color == prev_frame[row][end + gap + 1].color)
+               gap++;
+            else {
+               end = end + gap + 1;
+               gap = 0;
+               }
+            }
+
+         len += sprintf(out + len, "\e[%i;%iH", row + 1, col + 1);
+         for (; col <= end; col++){
+            if (frame[row][col].color != color){
+               color = frame[row][col].color;
+               len += sprintf(out + len, "%s", sgr[color]);
+               }
+            len += sprintf(out + len, "%s", frame[row][col].ch);
+            prev_frame[row][col] = frame[row][col];
+            }
+         }
+      }
+
+   if (len > 0){
+      if (color != TTY_DEFAULT) len += sprintf(out + len, "%s", sgr[TTY_DEFAULT]);
+      len += sprintf(out + len, "\e[%i;1H", console_rows + 1);
+      fwrite(out, 1, len, stdout);
+      fflush(stdout);
+      overhead_write(OV_CONSOLE, len);
+      }
+   } /* con_flush */
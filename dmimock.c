@@ -0,0 +1,856 @@
+//	dmimock.c 	18102026
+//	Build: cc dmimock.c -o dmimock -lssl -lcrypto -lm -lpthread -lz -lnghttp2
+//      https://github.com/michaelorno/DMIOV.git
+//
+//	Call: ./dmimock [configurationfile]
+//
+//	Mock of the DMI API gateway - dmiapi can be run & benchmarked without api-keys & network
+//
+//	Function:
+//	Listens for TLS on [BIND]:[PORT] - set [IPHOST] https://127.0.0.1:8443 in dmiapi's configuration
+//	Answers metObs, oceanObs, lightningdata & climateData queries with canned GeoJSON
+//		stationId=a,b,.. or bbox=.. gives one feature for each station (batch)
+//	HTTP/1.1 with keep-alive & pipelining, Content-Length or chunked bodies, gzip if asked for
+//	HTTP/2 if the client offers h2 in ALPN - each stream is answered as a request, in the order they end
+//	Faults are drawn for each response: latency, http 204/4xx/5xx, slow-drip body & connection reset
+//	Random numbers are from [SEED] & the number of the connection - a run can be repeated
+//
+//	Parameters in configurationfile (all optional)
+//      	[BIND] ip-address to listen on (default 127.0.0.1)
+//      	[PORT] port (default 8443)
+//      	[CERT] [KEY] PEM-files with certificate (chain) & key. Default: a CA & a server certificate for
+//      		localhost & [BIND] are made at start & the CA is written to [CA_FILE] (default dmimock-ca.pem)
+//      	[SEED] seed for random numbers (default 1)
+//      	[ENCODING] length|chunked body framing (default length)
+//      	[CHUNK_SIZE] bytes in each chunk - each chunk is one TLS record (default 1024)
+//      	[COMPRESSION] 0|1 gzip if the request has Accept-Encoding: gzip (default 1)
+//      	[LATENCY] time before response in ms: fixed:ms | uniform:low:high | normal:mean:sd | lognormal:median:sigma (default fixed:0)
+//      	[RATE_204] % of responses with http 204 (default 0)
+//      	[RATE_4XX] % of responses with http 400, 401, 404 or 408 (default 0)
+//      	[RATE_5XX] % of responses with http 500, 502 or 503 (default 0)
+//      	[DRIP_RATE] % of responses sent slowly (default 0)
+//      	[DRIP] bytes:ms - a slow response is sent in writes of bytes with ms between (default 64:20)
+//      	[RESET_RATE] % of responses where the connection is reset (RST) after half the body (default 0)
+//      		HTTP/2: the stream is reset (RST_STREAM) & the connection is kept
+//      	[HTTP2] 0|1 accept h2 in ALPN (default 1). [DRIP_RATE] does not apply to HTTP/2
+//
+//	Versionshistorie
+//		1.0 TLS, canned GeoJSON for the four API's, framing, latency & fault injection
+//		1.1 HTTP/2 via ALPN with an nghttp2 server session
+
+#define _GNU_SOURCE		// memmem
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+#include <zlib.h>
+#include <nghttp2/nghttp2.h>
+
+#define VERSION "1.1"
+#define MAX_REQUEST 16384	// Buffered requests of one connection
+#define MAX_RESPONSE 262144	// Body of one response
+
+// Parameters from configuration - as long as a value read by read_config
+#define MAX_VALUE 200
+char bind_addr[MAX_VALUE];
+char port[MAX_VALUE];
+char cert_file[MAX_VALUE];
+char key_file[MAX_VALUE];
+char ca_file[MAX_VALUE];
+char seed[MAX_VALUE];
+char encoding[MAX_VALUE];
+char chunk_size[MAX_VALUE];
+char compression[MAX_VALUE];
+char latency[MAX_VALUE];
+char rate_204[MAX_VALUE];
+char rate_4xx[MAX_VALUE];
+char rate_5xx[MAX_VALUE];
+char drip_rate[MAX_VALUE];
+char drip[MAX_VALUE];
+char reset_rate[MAX_VALUE];
+char http2[MAX_VALUE];
+
+// Parsed parameters
+struct fault_record{
+   int   chunked;
+   int   chunk;
+   int   gzip;
+   int   latency_type;		// 0 = fixed, 1 = uniform, 2 = normal, 3 = lognormal
+   double latency_a, latency_b;
+   double rate_204, rate_4xx, rate_5xx, drip_rate, reset_rate;
+   int   drip_bytes, drip_ms;
+   } fault;
+
+SSL_CTX* ctx;
+unsigned long seed_value;
+
+// One client connection - random numbers are its own, so responses do not depend on other clients
+struct client{
+   int   fd;
+   SSL*  ssl;
+   uint64_t rng;
+   unsigned long number;
+   char  in[MAX_REQUEST];
+   int   have;
+   char  body[MAX_RESPONSE];
+   char  coded[MAX_RESPONSE];
+   struct h2_stream* streams;	// HTTP/2 streams not closed yet
+   };
+
+// HTTP/2 stream - request headers & the response body until the stream is closed
+struct h2_stream{
+   int32_t id;
+   char  path[4096];
+   int   gzip;
+   char* body;
+   int   len, off;
+   struct h2_stream* next;
+   };
+
+// Stations of the canned responses
+const char* met_stations[] = {"06041", "06079", "06081", "06183", "06193", "06169", "06119", "06188", "06074",
+   "06184", "06149", "06096", "06168", "06068", "04320", "04250", "04220"};
+const char* ocean_stations[] = {"28548", "27084", "30357", "25149", "20101", "31616", "29002", "29038", "29393",
+   "30336", "30407", "31573", "32048", "30202", "22331", "26359", "30017"};
+
+void read_config(char* config_filename);
+int tls_init();
+EVP_PKEY* key_new();
+X509* cert_new(EVP_PKEY* key, const char* cn, X509* ca, EVP_PKEY* ca_key);
+void* client_main(void* arg);
+int request_next(struct client* c);
+void respond(struct client* c, char* path, int gzip, int keep);
+int response_build(struct client* c, char* path, int* gzip, int* slow, int* reset, char** body, int* len);
+void response_id(struct client* c, char* date, int date_size, char* id, int id_size);
+int alpn_select(SSL* ssl, const unsigned char** out, unsigned char* outlen, const unsigned char* in, unsigned int inlen, void* arg);
+void h2_serve(struct client* c);
+int body_build(struct client* c, char* path);
+int feature_add(struct client* c, char* out, int size, const char* api, const char* station, const char* parameter, const char* observed);
+int query_get(char* path, const char* name, char* value, int size);
+int gzip_body(char* in, int len, char* out, int size);
+int send_all(struct client* c, const char* data, int len, int slow);
+uint64_t rng_seed(unsigned long seed, unsigned long number);
+double rng_uniform(struct client* c);
+double rng_normal(struct client* c);
+void latency_wait(struct client* c);
+
+int main(int argc, char *argv[]){
+   struct sockaddr_in addr;
+   struct client* c;
+   pthread_t thread;
+   unsigned long number;
+   int fd, on;
+
+   read_config(argc > 1 ? argv[1] : "");
+   signal(SIGPIPE, SIG_IGN);
+   if (tls_init() != 1){
+      ERR_print_errors_fp(stderr);
+      printf("DMIMOCK: TLS could not be set up - terminating\n");
+      return 3;
+      }
+
+   fd = socket(AF_INET, SOCK_STREAM, 0);
+   on = 1;
+   setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons(atoi(port));
+   if (inet_pton(AF_INET, bind_addr, &addr.sin_addr) != 1 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 128) != 0){
+      printf("DMIMOCK: Can not listen on %s:%s - terminating\n", bind_addr, port);
+      return 3;
+      }
+   printf("DMIMOCK [%s]: listening on https://%s:%s\n", VERSION, bind_addr, port);
+   fflush(stdout);
+
+   // A thread for each connection
+   for (number = 0; ; number++){
+      c = malloc(sizeof(struct client));
+      if (c == NULL) return 3;
+      if ((c->fd = accept(fd, NULL, NULL)) < 0){
+         free(c);
+         continue;
+         }
+      c->number = number;
+      c->rng = rng_seed(seed_value, number);
+      c->have = 0;
+      c->in[0] = 0;
+      c->streams = NULL;
+      if (pthread_create(&thread, NULL, client_main, c) != 0){
+         close(c->fd);
+         free(c);
+         continue;
+         }
+      pthread_detach(thread);
+      }
+   return 0;
+   } /* main */
+
+// Read configuration - every parameter has a default, so the file is optional
+void read_config(char* config_filename){
+   FILE* config_file;
+   char parameter[200], value[MAX_VALUE];
+   char* p;
+
+   config_file = config_filename[0] != 0 ? fopen(config_filename, "r") : NULL;
+   if (config_filename[0] != 0 && config_file == NULL){
+      printf("DMIMOCK: Konfigurationsfil findes ikke - afslutter.\n");
+      exit(3);
+      }
+   while (config_file != NULL && fscanf(config_file, "%199s %199s", parameter, value) == 2){
+      if (strcmp(parameter, "[BIND]") == 0) snprintf(bind_addr, sizeof(bind_addr), "%s", value); else
+      if (strcmp(parameter, "[PORT]") == 0) snprintf(port, sizeof(port), "%s", value); else
+      if (strcmp(parameter, "[CERT]") == 0) snprintf(cert_file, sizeof(cert_file), "%s", value); else
+      if (strcmp(parameter, "[KEY]") == 0) snprintf(key_file, sizeof(key_file), "%s", value); else
+      if (strcmp(parameter, "[CA_FILE]") == 0) snprintf(ca_file, sizeof(ca_file), "%s", value); else
+      if (strcmp(parameter, "[SEED]") == 0) snprintf(seed, sizeof(seed), "%s", value); else
+      if (strcmp(parameter, "[ENCODING]") == 0) snprintf(encoding, sizeof(encoding), "%s", value); else
+      if (strcmp(parameter, "[CHUNK_SIZE]") == 0) snprintf(chunk_size, sizeof(chunk_size), "%s", value); else
+      if (strcmp(parameter, "[COMPRESSION]") == 0) snprintf(compression, sizeof(compression), "%s", value); else
+      if (strcmp(parameter, "[LATENCY]") == 0) snprintf(latency, sizeof(latency), "%s", value); else
+      if (strcmp(parameter, "[RATE_204]") == 0) snprintf(rate_204, sizeof(rate_204), "%s", value); else
+      if (strcmp(parameter, "[RATE_4XX]") == 0) snprintf(rate_4xx, sizeof(rate_4xx), "%s", value); else
+      if (strcmp(parameter, "[RATE_5XX]") == 0) snprintf(rate_5xx, sizeof(rate_5xx), "%s", value); else
+      if (strcmp(parameter, "[DRIP_RATE]") == 0) snprintf(drip_rate, sizeof(drip_rate), "%s", value); else
+      if (strcmp(parameter, "[DRIP]") == 0) snprintf(drip, sizeof(drip), "%s", value); else
+      if (strcmp(parameter, "[RESET_RATE]") == 0) snprintf(reset_rate, sizeof(reset_rate), "%s", value); else
+      if (strcmp(parameter, "[HTTP2]") == 0) snprintf(http2, sizeof(http2), "%s", value); else
+      printf("DMIMOCK: Unknown parameter %s ignored\n", parameter);
+      }
+   if (config_file != NULL) fclose(config_file);
+
+   // Defaults
+   if (strlen(bind_addr) == 0) strcpy(bind_addr, "127.0.0.1");
+   if (strlen(port) == 0) strcpy(port, "8443");
+   if (strlen(ca_file) == 0) strcpy(ca_file, "dmimock-ca.pem");
+   if (strlen(seed) == 0) strcpy(seed, "1");
+   if (strlen(encoding) == 0) strcpy(encoding, "length");
+   if (strlen(chunk_size) == 0) strcpy(chunk_size, "1024");
+   if (strlen(compression) == 0) strcpy(compression, "1");
+   if (strlen(latency) == 0) strcpy(latency, "fixed:0");
+   if (strlen(drip) == 0) strcpy(drip, "64:20");
+   if (strlen(http2) == 0) strcpy(http2, "1");
+
+   // Check: [ENCODING] must be length or chunked & [CHUNK_SIZE] > 0
+   if (strcmp(encoding, "length") != 0 && strcmp(encoding, "chunked") != 0){
+      printf("DMIMOCK: [ENCODING] must be length or chunked - terminating\n");
+      exit(3);
+      }
+   fault.chunked = strcmp(encoding, "chunked") == 0;
+   fault.chunk = atoi(chunk_size);
+   if (fault.chunk < 1){
+      printf("DMIMOCK: [CHUNK_SIZE] must be > 0 - terminating\n");
+      exit(3);
+      }
+   fault.gzip = atoi(compression) == 1;
+
+   // Check: [LATENCY] must be a known distribution
+   p = strchr(latency, ':');
+   fault.latency_a = p != NULL ? atof(p + 1) : 0;
+   fault.latency_b = p != NULL && strchr(p + 1, ':') != NULL ? atof(strchr(p + 1, ':') + 1) : 0;
+   if (strncmp(latency, "fixed:", 6) == 0) fault.latency_type = 0;
+   else if (strncmp(latency, "uniform:", 8) == 0) fault.latency_type = 1;
+   else if (strncmp(latency, "normal:", 7) == 0) fault.latency_type = 2;
+   else if (strncmp(latency, "lognormal:", 10) == 0) fault.latency_type = 3;
+   else {
+      printf("DMIMOCK: [LATENCY] must be fixed:ms, uniform:low:high, normal:mean:sd or lognormal:median:sigma - terminating\n");
+      exit(3);
+      }
+
+   // Check: rates are 0-100 % in all
+   fault.rate_204 = atof(rate_204);
+   fault.rate_4xx = atof(rate_4xx);
+   fault.rate_5xx = atof(rate_5xx);
+   fault.drip_rate = atof(drip_rate);
+   fault.reset_rate = atof(reset_rate);
+   if (fault.rate_204 < 0 || fault.rate_4xx < 0 || fault.rate_5xx < 0 || fault.rate_204 + fault.rate_4xx + fault.rate_5xx > 100 ||
+      fault.drip_rate < 0 || fault.drip_rate > 100 || fault.reset_rate < 0 || fault.reset_rate > 100){
+      printf("DMIMOCK: [RATE_204] + [RATE_4XX] + [RATE_5XX], [DRIP_RATE] & [RESET_RATE] must be 0-100 - terminating\n");
+      exit(3);
+      }
+   if (sscanf(drip, "%i:%i", &fault.drip_bytes, &fault.drip_ms) != 2 || fault.drip_bytes < 1 || fault.drip_ms < 0){
+      printf("DMIMOCK: [DRIP] must be bytes:ms - terminating\n");
+      exit(3);
+      }
+   seed_value = strtoul(seed, NULL, 10);
+
+   // Check: [HTTP2] must be 0 or 1
+   if (strcmp(http2, "0") != 0 && strcmp(http2, "1") != 0){
+      printf("DMIMOCK: [HTTP2] must be 0 or 1 - terminating\n");
+      exit(3);
+      }
+   } /* read_config */
+
+// TLS context - certificate from files or a CA & server certificate made here. Returns 1 if ok
+int tls_init(){
+   EVP_PKEY *ca_key, *key;
+   X509 *ca, *cert;
+   FILE* f;
+
+   ctx = SSL_CTX_new(TLS_server_method());
+   if (ctx == NULL) return 0;
+   SSL_CTX_set_alpn_select_cb(ctx, alpn_select, NULL);
+   if (strlen(cert_file) > 0 || strlen(key_file) > 0){
+      if (SSL_CTX_use_certificate_chain_file(ctx, cert_file) != 1) return 0;
+      if (SSL_CTX_use_PrivateKey_file(ctx, key_file, SSL_FILETYPE_PEM) != 1) return 0;
+      return 1;
+      }
+
+   // Self-signed CA - clients that verify can trust [CA_FILE]
+   ca_key = key_new();
+   key = key_new();
+   if (ca_key == NULL || key == NULL) return 0;
+   ca = cert_new(ca_key, "dmimock CA", NULL, NULL);
+   cert = cert_new(key, "localhost", ca, ca_key);
+   if (ca == NULL || cert == NULL) return 0;
+   if ((f = fopen(ca_file, "w")) != NULL){
+      PEM_write_X509(f, ca);
+      fclose(f);
+      }
+   else
+      printf("DMIMOCK: Could not write %s\n", ca_file);
+
+   if (SSL_CTX_use_certificate(ctx, cert) != 1 || SSL_CTX_use_PrivateKey(ctx, key) != 1) return 0;
+   SSL_CTX_add_extra_chain_cert(ctx, ca); // Owned by ctx from here
+   X509_free(cert);
+   EVP_PKEY_free(key);
+   EVP_PKEY_free(ca_key);
+   return 1;
+   } /* tls_init */
+
+EVP_PKEY* key_new(){
+   return EVP_EC_gen("P-256");
+   } /* key_new */
+
+// Certificate for key - a CA if ca is NULL, else a server certificate for localhost & [BIND] signed by ca
+X509* cert_new(EVP_PKEY* key, const char* cn, X509* ca, EVP_PKEY* ca_key){
+   static long serial;
+   X509* x;
+   X509_NAME* name;
+   X509_EXTENSION* ext;
+   X509V3_CTX v3;
+   char san[MAX_VALUE + 40];
+
+   x = X509_new();
+   if (x == NULL) return NULL;
+   X509_set_version(x, 2);
+   ASN1_INTEGER_set(X509_get_serialNumber(x), ++serial);
+   X509_gmtime_adj(X509_getm_notBefore(x), -3600);
+   X509_gmtime_adj(X509_getm_notAfter(x), 3650L * 86400);
+   X509_set_pubkey(x, key);
+   name = X509_get_subject_name(x);
+   X509_NAME_add_entry_by_txt(name, "O", MBSTRING_ASC, (const unsigned char*)"dmimock", -1, -1, 0);
+   X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)cn, -1, -1, 0);
+   X509_set_issuer_name(x, ca != NULL ? X509_get_subject_name(ca) : name);
+
+   X509V3_set_ctx_nodb(&v3);
+   X509V3_set_ctx(&v3, ca != NULL ? ca : x, x, NULL, NULL, 0);
+   ext = X509V3_EXT_conf_nid(NULL, &v3, NID_basic_constraints, ca == NULL ? "critical,CA:TRUE" : "CA:FALSE");
+   X509_add_ext(x, ext, -1);
+   X509_EXTENSION_free(ext);
+   if (ca == NULL)
+      ext = X509V3_EXT_conf_nid(NULL, &v3, NID_key_usage, "critical,keyCertSign,cRLSign");
+   else {
+      snprintf(san, sizeof(san), "DNS:localhost,IP:127.0.0.1%s%s", strcmp(bind_addr, "127.0.0.1") != 0 ? ",IP:" : "",
+         strcmp(bind_addr, "127.0.0.1") != 0 ? bind_addr : "");
+      ext = X509V3_EXT_conf_nid(NULL, &v3, NID_subject_alt_name, san);
+      }
+   X509_add_ext(x, ext, -1);
+   X509_EXTENSION_free(ext);
+
+   if (X509_sign(x, ca_key != NULL ? ca_key : key, EVP_sha256()) == 0){
+      X509_free(x);
+      return NULL;
+      }
+   return x;
+   } /* cert_new */
+
+// Connection - requests are answered in order until the client closes or a reset is drawn
+void* client_main(void* arg){
+   struct client* c = arg;
+   struct timeval tv;
+   const unsigned char* proto;
+   unsigned int len;
+   int on;
+
+   tv.tv_sec = 30;
+   tv.tv_usec = 0;
+   setsockopt(c->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+   on = 1;
+   setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+   c->ssl = SSL_new(ctx);
+   SSL_set_fd(c->ssl, c->fd);
+   if (SSL_accept(c->ssl) == 1){
+      SSL_get0_alpn_selected(c->ssl, &proto, &len);
+      if (len == 2 && memcmp(proto, "h2", 2) == 0) h2_serve(c);
+      else while (request_next(c) == 1) ;
+      }
+   if (c->ssl != NULL){
+      SSL_shutdown(c->ssl);
+      SSL_free(c->ssl);
+      }
+   if (c->fd > 0) close(c->fd);
+   free(c);
+   return NULL;
+   } /* client_main */
+
+// Read & answer next request - returns 1 if the connection can be used for one more
+int request_next(struct client* c){
+   char path[4096], *end, *line;
+   int n, len, gzip, keep;
+
+   // Header of next request - pipelined requests may be in the buffer already
+   while ((end = strstr(c->in, "\r\n\r\n")) == NULL){
+      if (c->have >= MAX_REQUEST - 1) return 0;
+      n = SSL_read(c->ssl, c->in + c->have, MAX_REQUEST - 1 - c->have);
+      if (n <= 0) return 0;
+      c->have = c->have + n;
+      c->in[c->have] = 0;
+      }
+   *end = 0;
+   len = end + 4 - c->in;
+
+   if (sscanf(c->in, "GET %4095s HTTP/1.", path) != 1){
+      line = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+      send_all(c, line, strlen(line), 0);
+      return 0;
+      }
+   gzip = 0;
+   keep = 1;
+   for (line = strstr(c->in, "\r\n"); line != NULL; line = strstr(line + 2, "\r\n")){
+      if (strncasecmp(line + 2, "Accept-Encoding:", 16) == 0 && strstr(line + 18, "gzip") != NULL) gzip = fault.gzip;
+      if (strncasecmp(line + 2, "Connection:", 11) == 0 && strncasecmp(line + 13, " close", 6) == 0) keep = 0;
+      }
+
+   // Remove request from buffer before answering
+   memmove(c->in, c->in + len, c->have - len);
+   c->have = c->have - len;
+   c->in[c->have] = 0;
+
+   respond(c, path, gzip, keep);
+   return keep && c->ssl != NULL;
+   } /* request_next */
+
+// Status of the responses - response_build returns an index
+const char* reason[] = {"OK", "No Content", "Bad Request", "Unauthorized", "Not Found", "Request Timeout", "Internal Server Error", "Bad Gateway", "Service Unavailable"};
+const int codes[] = {200, 204, 400, 401, 404, 408, 500, 502, 503};
+
+// Answer one request - status, latency, drip & reset are drawn here
+void respond(struct client* c, char* path, int gzip, int keep){
+   char header[1024], chunk_head[20], date[40], id[60];
+   char* body;
+   struct linger lg;
+   int status, len, hlen, off, n, slow, reset;
+
+   status = response_build(c, path, &gzip, &slow, &reset, &body, &len);
+   response_id(c, date, sizeof(date), id, sizeof(id));
+   hlen = snprintf(header, sizeof(header), "HTTP/1.1 %i %s\r\nDate: %s\r\nContent-Type: application/geo+json\r\n"
+      "x-gravitee-transaction-id: %s\r\n%s%s%s\r\n",
+      codes[status], reason[status], date, id,
+      gzip ? "Content-Encoding: gzip\r\n" : "", keep ? "" : "Connection: close\r\n",
+      status == 1 ? "" : fault.chunked ? "Transfer-Encoding: chunked\r\n" : "");
+   if (status != 1 && !fault.chunked) hlen = hlen - 2 + snprintf(header + hlen - 2, sizeof(header) - hlen + 2, "Content-Length: %i\r\n\r\n", len);
+   if (send_all(c, header, hlen, slow) != 1) return;
+
+   // Reset after half the body - SO_LINGER 0 makes close() send RST
+   if (reset){
+      send_all(c, body, len / 2, slow);
+      lg.l_onoff = 1;
+      lg.l_linger = 0;
+      setsockopt(c->fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+      SSL_free(c->ssl);
+      c->ssl = NULL;
+      close(c->fd);
+      c->fd = 0;
+      return;
+      }
+
+   if (status == 1) return;
+   if (!fault.chunked){
+      send_all(c, body, len, slow);
+      return;
+      }
+   for (off = 0; off < len; off = off + n){
+      n = len - off < fault.chunk ? len - off : fault.chunk;
+      snprintf(chunk_head, sizeof(chunk_head), "%x\r\n", n);
+      if (send_all(c, chunk_head, strlen(chunk_head), slow) != 1 || send_all(c, body + off, n, slow) != 1 || send_all(c, "\r\n", 2, slow) != 1) return;
+      }
+   send_all(c, "0\r\n\r\n", 5, slow);
+   } /* respond */
+
+// Draws & body of one response - always the same number of draws. Returns index of status in codes[].
+// gzip is cleared if the body is not compressed
+int response_build(struct client* c, char* path, int* gzip, int* slow, int* reset, char** body, int* len){
+   double r;
+   int status, n;
+
+   r = rng_uniform(c) * 100;
+   status = r < fault.rate_204 ? 1 :
+      r < fault.rate_204 + fault.rate_4xx ? 2 + (int)(rng_uniform(c) * 4) :
+      r < fault.rate_204 + fault.rate_4xx + fault.rate_5xx ? 6 + (int)(rng_uniform(c) * 3) : 0;
+   *slow = rng_uniform(c) * 100 < fault.drip_rate;
+   *reset = rng_uniform(c) * 100 < fault.reset_rate;
+   latency_wait(c);
+
+   *len = 0;
+   *body = c->body;
+   if (status == 0 && (*len = body_build(c, path)) < 0){
+      status = 4;
+      *len = 0;
+      }
+   if (status >= 2) *len = snprintf(c->body, MAX_RESPONSE, "{\"code\":\"%i\",\"message\":\"%s\"}", codes[status], reason[status]);
+   if (*gzip && *len > 0){
+      n = gzip_body(c->body, *len, c->coded, MAX_RESPONSE);
+      if (n > 0){
+         *body = c->coded;
+         *len = n;
+         }
+      else *gzip = 0;
+      }
+   else *gzip = 0;
+   return status;
+   } /* response_build */
+
+// Date & Gravitee transaction id of a response
+void response_id(struct client* c, char* date, int date_size, char* id, int id_size){
+   time_t now;
+   struct tm tm;
+
+   now = time(NULL);
+   strftime(date, date_size, "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&now, &tm));
+   snprintf(id, id_size, "%08x-%04x-%04x-%04x-%012llx",
+      (unsigned)(c->rng >> 32), (unsigned)(c->rng >> 16) & 0xffff, (unsigned)c->rng & 0xffff, (unsigned)c->number & 0xffff,
+      (unsigned long long)(c->rng * 0x2545F4914F6CDD1DULL) & 0xffffffffffffULL);
+   } /* response_id */
+
+// ALPN - h2 if the client offers it & [HTTP2] is 1, else http/1.1
+int alpn_select(SSL* ssl, const unsigned char** out, unsigned char* outlen, const unsigned char* in, unsigned int inlen, void* arg){
+   unsigned int x;
+   int http11;
+
+   http11 = -1;
+   for (x = 0; x < inlen; x = x + 1 + in[x]){
+      if (atoi(http2) == 1 && in[x] == 2 && memcmp(in + x + 1, "h2", 2) == 0){
+         *out = in + x + 1;
+         *outlen = 2;
+         return SSL_TLSEXT_ERR_OK;
+         }
+      if (in[x] == 8 && memcmp(in + x + 1, "http/1.1", 8) == 0) http11 = x;
+      }
+   if (http11 < 0) return SSL_TLSEXT_ERR_NOACK;
+   *out = in + http11 + 1;
+   *outlen = 8;
+   return SSL_TLSEXT_ERR_OK;
+   } /* alpn_select */
+
+// HTTP/2 callbacks - user data is the client
+ssize_t h2_send(nghttp2_session* session, const uint8_t* data, size_t length, int flags, void* user_data){
+   return send_all(user_data, (const char*)data, length, 0) == 1 ? (ssize_t)length : NGHTTP2_ERR_CALLBACK_FAILURE;
+   } /* h2_send */
+
+int h2_begin_headers(nghttp2_session* session, const nghttp2_frame* frame, void* user_data){
+   struct client* c = user_data;
+   struct h2_stream* st;
+
+   if (frame->hd.type != NGHTTP2_HEADERS || frame->headers.cat != NGHTTP2_HCAT_REQUEST) return 0;
+   st = calloc(1, sizeof(struct h2_stream));
+   if (st == NULL) return NGHTTP2_ERR_CALLBACK_FAILURE;
+   st->id = frame->hd.stream_id;
+   st->next = c->streams;
+   c->streams = st;
+   nghttp2_session_set_stream_user_data(session, st->id, st);
+   return 0;
+   } /* h2_begin_headers */
+
+int h2_header(nghttp2_session* session, const nghttp2_frame* frame, const uint8_t* name, size_t namelen,
+   const uint8_t* value, size_t valuelen, uint8_t flags, void* user_data){
+   struct h2_stream* st;
+
+   st = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+   if (st == NULL) return 0;
+   if (namelen == 5 && memcmp(name, ":path", 5) == 0)
+      snprintf(st->path, sizeof(st->path), "%.*s", (int)valuelen, value);
+   if (namelen == 15 && memcmp(name, "accept-encoding", 15) == 0 && memmem(value, valuelen, "gzip", 4) != NULL)
+      st->gzip = fault.gzip;
+   return 0;
+   } /* h2_header */
+
+// Body of a response - copied to the stream, as the client's buffers are used by the next response
+ssize_t h2_body(nghttp2_session* session, int32_t stream_id, uint8_t* buf, size_t length, uint32_t* data_flags,
+   nghttp2_data_source* source, void* user_data){
+   struct h2_stream* st = source->ptr;
+   int n;
+
+   n = st->len - st->off < (int)length ? st->len - st->off : (int)length;
+   memcpy(buf, st->body + st->off, n);
+   st->off = st->off + n;
+   if (st->off == st->len) *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+   return n;
+   } /* h2_body */
+
+// Request has ended - answer it. A drawn reset resets the stream only
+int h2_frame_recv(nghttp2_session* session, const nghttp2_frame* frame, void* user_data){
+   struct client* c = user_data;
+   struct h2_stream* st;
+   nghttp2_data_provider prd;
+   nghttp2_nv nv[5];
+   char status_str[4], date[40], id[60], *body;
+   int status, gzip, slow, reset, len, n;
+
+   if ((frame->hd.type != NGHTTP2_HEADERS && frame->hd.type != NGHTTP2_DATA) || !(frame->hd.flags & NGHTTP2_FLAG_END_STREAM)) return 0;
+   st = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+   if (st == NULL) return 0;
+
+   gzip = st->gzip;
+   status = response_build(c, st->path, &gzip, &slow, &reset, &body, &len);
+   if (reset) return nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, st->id, NGHTTP2_INTERNAL_ERROR);
+   st->body = malloc(len > 0 ? len : 1);
+   if (st->body == NULL) return NGHTTP2_ERR_CALLBACK_FAILURE;
+   memcpy(st->body, body, len);
+   st->len = len;
+
+   response_id(c, date, sizeof(date), id, sizeof(id));
+   snprintf(status_str, sizeof(status_str), "%i", codes[status]);
+   n = 0;
+   nv[n++] = (nghttp2_nv){(uint8_t*)":status", (uint8_t*)status_str, 7, strlen(status_str), NGHTTP2_NV_FLAG_NONE};
+   nv[n++] = (nghttp2_nv){(uint8_t*)"date", (uint8_t*)date, 4, strlen(date), NGHTTP2_NV_FLAG_NONE};
+   nv[n++] = (nghttp2_nv){(uint8_t*)"content-type", (uint8_t*)"application/geo+json", 12, 20, NGHTTP2_NV_FLAG_NONE};
+   nv[n++] = (nghttp2_nv){(uint8_t*)"x-gravitee-transaction-id", (uint8_t*)id, 25, strlen(id), NGHTTP2_NV_FLAG_NONE};
+   if (gzip) nv[n++] = (nghttp2_nv){(uint8_t*)"content-encoding", (uint8_t*)"gzip", 16, 4, NGHTTP2_NV_FLAG_NONE};
+   prd.source.ptr = st;
+   prd.read_callback = h2_body;
+   return nghttp2_submit_response(session, st->id, nv, n, status == 1 ? NULL : &prd);
+   } /* h2_frame_recv */
+
+int h2_stream_close(nghttp2_session* session, int32_t stream_id, uint32_t error_code, void* user_data){
+   struct client* c = user_data;
+   struct h2_stream **p, *st;
+
+   for (p = &c->streams; *p != NULL; p = &(*p)->next)
+      if ((*p)->id == stream_id){
+         st = *p;
+         *p = st->next;
+         free(st->body);
+         free(st);
+         break;
+         }
+   return 0;
+   } /* h2_stream_close */
+
+// HTTP/2 connection - frames are read into the request buffer & handed to the session until either side is done
+void h2_serve(struct client* c){
+   nghttp2_session_callbacks* cb;
+   nghttp2_session* session;
+   nghttp2_settings_entry iv = {NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, 128};
+   struct h2_stream* st;
+   int n;
+
+   if (nghttp2_session_callbacks_new(&cb) != 0) return;
+   nghttp2_session_callbacks_set_send_callback(cb, h2_send);
+   nghttp2_session_callbacks_set_on_begin_headers_callback(cb, h2_begin_headers);
+   nghttp2_session_callbacks_set_on_header_callback(cb, h2_header);
+   nghttp2_session_callbacks_set_on_frame_recv_callback(cb, h2_frame_recv);
+   nghttp2_session_callbacks_set_on_stream_close_callback(cb, h2_stream_close);
+   n = nghttp2_session_server_new(&session, cb, c);
+   nghttp2_session_callbacks_del(cb);
+   if (n != 0) return;
+
+   nghttp2_submit_settings(session, NGHTTP2_FLAG_NONE, &iv, 1);
+   while (nghttp2_session_want_read(session) || nghttp2_session_want_write(session)){
+      if (nghttp2_session_send(session) != 0) break;
+      if (!nghttp2_session_want_read(session)) break;
+      n = SSL_read(c->ssl, c->in, MAX_REQUEST);
+      if (n <= 0 || nghttp2_session_mem_recv(session, (uint8_t*)c->in, n) < 0) break;
+      }
+   nghttp2_session_del(session);
+   while ((st = c->streams) != NULL){
+      c->streams = st->next;
+      free(st->body);
+      free(st);
+      }
+   } /* h2_serve */
+
+// Canned GeoJSON for path - returns length or -1 if the API is not known
+int body_build(struct client* c, char* path){
+   char stations[2048], station[20], parameter[40], observed[40], stamp[40], *p, *next;
+   const char* api;
+   const char** list;
+   int len, n, count, x;
+   time_t now;
+   struct tm tm;
+
+   if (strncmp(path, "/v2/metObs/", 11) == 0){ api = "metObs"; list = met_stations; strcpy(parameter, "temp_dry"); }
+   else if (strncmp(path, "/v2/oceanObs/", 13) == 0){ api = "oceanObs"; list = ocean_stations; strcpy(parameter, "sealev_dvr"); }
+   else if (strncmp(path, "/v2/climateData/", 16) == 0){ api = "climateData"; list = met_stations; strcpy(parameter, "mean_temp"); }
+   else if (strncmp(path, "/v2/lightningdata/", 18) == 0){ api = "lightningdata"; list = NULL; parameter[0] = 0; }
+   else return -1;
+   query_get(path, "parameterId", parameter, sizeof(parameter));
+
+   // Latest 10 minutes
+   now = time(NULL);
+   strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&now, &tm));
+   now = now - now % 600;
+   strftime(observed, sizeof(observed), "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&now, &tm));
+
+   len = snprintf(c->body, MAX_RESPONSE, "{\"type\":\"FeatureCollection\",\"features\":[");
+   count = 0;
+   if (list == NULL)
+      len = len + feature_add(c, c->body + len, MAX_RESPONSE - len, api, "", parameter, observed), count++;
+   else if (query_get(path, "stationId", stations, sizeof(stations)) && strchr(stations, ',') == NULL)
+      len = len + feature_add(c, c->body + len, MAX_RESPONSE - len, api, stations, parameter, observed), count++;
+   else if (stations[0] != 0){
+      // List of stations - two observations of each
+      for (p = stations; p != NULL; p = next){
+         next = strchr(p, ',');
+         n = next != NULL ? next - p : strlen(p);
+         snprintf(station, sizeof(station), "%.*s", n, p);
+         if (next != NULL) next++;
+         for (x = 0; x < 2; x++){
+            if (count > 0 && len < MAX_RESPONSE) c->body[len++] = ',';
+            len = len + feature_add(c, c->body + len, MAX_RESPONSE - len, api, station, parameter, x == 0 ? observed : stamp), count++;
+            }
+         }
+      }
+   else if (strstr(path, "bbox=") != NULL)
+      for (n = 0; n < 17; n++)
+         for (x = 0; x < 2; x++){
+            if (count > 0 && len < MAX_RESPONSE) c->body[len++] = ',';
+            len = len + feature_add(c, c->body + len, MAX_RESPONSE - len, api, list[n], parameter, x == 0 ? observed : stamp), count++;
+            }
+   if (len >= MAX_RESPONSE) return -1;
+   len = len + snprintf(c->body + len, MAX_RESPONSE - len, "],\"timeStamp\":\"%s\",\"numberReturned\":%i,\"links\":[{\"href\":\"https://%s:%s%.200s\","
+      "\"rel\":\"self\",\"type\":\"application/geo+json\",\"title\":\"This document\"}]}", stamp, count, bind_addr, port, path);
+   return len < MAX_RESPONSE ? len : -1;
+   } /* body_build */
+
+// One feature - value is drawn from the random numbers of the connection
+int feature_add(struct client* c, char* out, int size, const char* api, const char* station, const char* parameter, const char* observed){
+   unsigned long id;
+
+   if (size <= 0) return 0;
+   id = (unsigned long)(rng_uniform(c) * 4294967295.0);
+   if (strcmp(api, "lightningdata") == 0)
+      return snprintf(out, size, "{\"geometry\":{\"coordinates\":[%.4f,%.4f],\"type\":\"Point\"},\"id\":\"%08lx-0000-4000-8000-%012lx\",\"type\":\"Feature\","
+         "\"properties\":{\"amp\":%.1f,\"created\":\"%s\",\"observed\":\"%s\",\"sensors\":\"%i,%i\",\"strokes\":%i,\"type\":%i}}",
+         8 + rng_uniform(c) * 7, 54.5 + rng_uniform(c) * 3, id, c->number, rng_uniform(c) * 100 - 50, observed, observed,
+         1 + (int)(rng_uniform(c) * 9), 10 + (int)(rng_uniform(c) * 9), 1 + (int)(rng_uniform(c) * 5), (int)(rng_uniform(c) * 2));
+   if (strcmp(api, "climateData") == 0)
+      return snprintf(out, size, "{\"geometry\":{\"coordinates\":[%.4f,%.4f],\"type\":\"Point\"},\"id\":\"%08lx-0000-4000-8000-%012lx\",\"type\":\"Feature\","
+         "\"properties\":{\"calculatedAt\":\"%s\",\"created\":\"%s\",\"from\":\"%s\",\"parameterId\":\"%s\",\"qcStatus\":\"none\","
+         "\"stationId\":\"%s\",\"timeResolution\":\"hour\",\"to\":\"%s\",\"validity\":true,\"value\":%.1f}}",
+         8 + rng_uniform(c) * 7, 54.5 + rng_uniform(c) * 3, id, c->number, observed, observed, observed, parameter, station, observed,
+         rng_uniform(c) * 25 - 5);
+   return snprintf(out, size, "{\"geometry\":{\"coordinates\":[%.4f,%.4f],\"type\":\"Point\"},\"id\":\"%08lx-0000-4000-8000-%012lx\",\"type\":\"Feature\","
+      "\"properties\":{\"created\":\"%s\",\"observed\":\"%s\",\"parameterId\":\"%s\",\"stationId\":\"%s\",\"value\":%.1f}}",
+      8 + rng_uniform(c) * 7, 54.5 + rng_uniform(c) * 3, id, c->number, observed, observed, parameter, station,
+      strcmp(api, "oceanObs") == 0 ? rng_uniform(c) * 100 - 50 : rng_uniform(c) * 25 - 5);
+   } /* feature_add */
+
+// Value of query parameter name - returns 1 if found
+int query_get(char* path, const char* name, char* value, int size){
+   char* p;
+   int n;
+
+   value[0] = 0;
+   for (p = strchr(path, '?'); p != NULL; p = strchr(p + 1, '&')){
+      n = strlen(name);
+      if (strncmp(p + 1, name, n) == 0 && p[1 + n] == '='){
+         snprintf(value, size, "%.*s", (int)strcspn(p + 2 + n, "&"), p + 2 + n);
+         return 1;
+         }
+      }
+   return 0;
+   } /* query_get */
+
+// gzip of in - returns length or 0 if it does not fit
+int gzip_body(char* in, int len, char* out, int size){
+   z_stream z;
+   int rc;
+
+   memset(&z, 0, sizeof(z));
+   if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) return 0;
+   z.next_in = (Bytef*)in;
+   z.avail_in = len;
+   z.next_out = (Bytef*)out;
+   z.avail_out = size;
+   rc = deflate(&z, Z_FINISH);
+   len = z.total_out;
+   deflateEnd(&z);
+   return rc == Z_STREAM_END ? len : 0;
+   } /* gzip_body */
+
+// Write all of data - a slow response is written in [DRIP] pieces. Returns 1 if ok
+int send_all(struct client* c, const char* data, int len, int slow){
+   struct timespec ts;
+   int off, n;
+
+   for (off = 0; off < len; off = off + n){
+      n = slow && len - off > fault.drip_bytes ? fault.drip_bytes : len - off;
+      if (slow && off > 0){
+         ts.tv_sec = fault.drip_ms / 1000;
+         ts.tv_nsec = (fault.drip_ms % 1000) * 1000000L;
+         nanosleep(&ts, NULL);
+         }
+      n = SSL_write(c->ssl, data + off, n);
+      if (n <= 0) return 0;
+      }
+   return 1;
+   } /* send_all */
+
+// State for connection number - splitmix64, so neighbouring seeds & connections give unrelated numbers
+uint64_t rng_seed(unsigned long seed, unsigned long number){
+   uint64_t z;
+
+   z = seed * 0x9E3779B97F4A7C15ULL + number + 1;
+   z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+   z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+   z = z ^ (z >> 31);
+   return z != 0 ? z : 1;
+   } /* rng_seed */
+
+// Uniform in [0;1) - xorshift64*
+double rng_uniform(struct client* c){
+   c->rng ^= c->rng >> 12;
+   c->rng ^= c->rng << 25;
+   c->rng ^= c->rng >> 27;
+   return ((c->rng * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+   } /* rng_uniform */
+
+// Standard normal - Box-Muller
+double rng_normal(struct client* c){
+   double u;
+
+   u = rng_uniform(c);
+   return sqrt(-2 * log(1 - u)) * cos(2 * M_PI * rng_uniform(c));
+   } /* rng_normal */
+
+// Wait before the response - ms drawn from [LATENCY]
+void latency_wait(struct client* c){
+   struct timespec ts;
+   double ms;
+
+   switch (fault.latency_type){
+      case 1: ms = fault.latency_a + rng_uniform(c) * (fault.latency_b - fault.latency_a); break;
+      case 2: ms = fault.latency_a + rng_normal(c) * fault.latency_b; break;
+      case 3: ms = fault.latency_a * exp(rng_normal(c) * fault.latency_b); break;
+      default: ms = fault.latency_a;
+      }
+   if (ms <= 0) return;
+   ts.tv_sec = (time_t)(ms / 1000);
+   ts.tv_nsec = (long)((ms - ts.tv_sec * 1000) * 1000000);
+   nanosleep(&ts, NULL);
+   } /* latency_wait */